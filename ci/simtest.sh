@@ -0,0 +1,82 @@
+#!/bin/bash
+
+##############################################################################
+#
+# File: ci/simtest.sh
+#
+# Function:
+#     Build and run the host tests in test/sim against the SX127x model.
+#
+# Copyright Notice:
+#     See LICENSE file accompanying this project.
+#
+# Usage:
+#     ci/simtest.sh [test ...]
+#
+#     With no arguments, runs every test/sim/*.c. CC and CFLAGS are
+#     honored. Each test may add flags with a "SIMTEST_CFLAGS:" comment.
+#     Binaries go to a temporary directory, or to $SIMTEST_OUT if set.
+#
+##############################################################################
+
+# Treat unset variables and parameters as an error
+set -o nounset
+
+# Exit immediately if a command fails
+set -e
+
+# If set, the return value of a pipeline is the value of the last (rightmost)
+# command to exit with a non-zero status, or zero if all commands in the
+# pipeline exit successfully
+set -o pipefail
+
+ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+CC="${CC:-gcc}"
+CFLAGS="${CFLAGS:--O2 -g}"
+if [[ -v SIMTEST_OUT ]]
+then
+    OUT="$SIMTEST_OUT"
+    mkdir -p "$OUT"
+else
+    OUT="$(mktemp -d)"
+    trap 'rm -rf "$OUT"' EXIT
+fi
+
+if [ $# -eq 0 ]
+then
+    set -- "$ROOT"/test/sim/*.c
+fi
+
+FAILED=0
+for TEST in "$@"
+do
+    NAME="$(basename "$TEST" .c)"
+    TESTFLAGS="$(sed -n 's/^.*SIMTEST_CFLAGS:\(.*\)$/\1/p' "$TEST")"
+
+    # tests that need static functions include lmic.c themselves.
+    LMICSRC="$(ls "$ROOT"/src/lmic/*.c)"
+    if grep -q '#include "lmic/lmic.c"' "$TEST"
+    then
+        LMICSRC="$(echo "$LMICSRC" | grep -v '/lmic\.c$')"
+    fi
+
+    echo "==== $NAME"
+    # shellcheck disable=SC2086
+    $CC -std=gnu99 $CFLAGS \
+        -DLMIC_SX127X_SIM -DARDUINO_LMIC_PROJECT_CONFIG_H_SUPPRESS \
+        -DUSE_ORIGINAL_AES $TESTFLAGS \
+        -I"$ROOT/src" -I"$ROOT/src/lmic" \
+        -o "$OUT/$NAME" "$TEST" $LMICSRC \
+        "$ROOT"/src/aes/*.c "$ROOT/src/hal/sx127x_sim.c" -lm
+
+    if ! "$OUT/$NAME"
+    then
+        FAILED=$((FAILED + 1))
+    fi
+done
+
+if [ $FAILED -ne 0 ]
+then
+    echo "$FAILED test(s) failed"
+    exit 1
+fi
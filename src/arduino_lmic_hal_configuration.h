@@ -92,6 +92,14 @@ public:
 	virtual void end(void) {}
 	virtual bool queryUsingTcxo(void) { return false; }
 
+	// sleep until shortly before `time` (in os ticks), with a timer
+	// or compare interrupt armed to wake up; the LMIC spins for the
+	// rest. Return false if not supported, which is the default.
+	virtual bool sleepUntil(ostime_t time) {
+		LMIC_API_PARAMETER(time);
+		return false;
+	}
+
 	// compute desired transmit power policy.  HopeRF needs
 	// (and previous versions of this library always chose)
 	// PA_BOOST mode. So that's our default. Override this
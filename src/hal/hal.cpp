@@ -187,6 +187,12 @@ static void hal_spi_init () {
 static void hal_spi_trx(u1_t cmd, u1_t* buf, size_t len, bit_t is_read) {
     uint32_t spi_freq;
     u1_t nss = plmic_pins->nss;
+#if LMIC_ENABLE_spi_stats
+    lmic_spi_stats_t * const pStats = &LMIC.radio.spi[LMIC.radio.spi_phase];
+    ++pStats->transactions;
+    pStats->bytes += len + 1;
+    u4_t const tBegin = micros();
+#endif
 
     if ((spi_freq = plmic_pins->spi_freq) == 0)
         spi_freq = LMIC_SPI_FREQ;
@@ -206,6 +212,9 @@ static void hal_spi_trx(u1_t cmd, u1_t* buf, size_t len, bit_t is_read) {
 
     digitalWrite(nss, 1);
     SPI.endTransaction();
+#if LMIC_ENABLE_spi_stats
+    pStats->us += micros() - tBegin;
+#endif
 }
 
 void hal_spi_write(u1_t cmd, const u1_t* buf, size_t len) {
@@ -499,6 +508,10 @@ bit_t hal_queryUsingTcxo(void) {
     return pHalConfig->queryUsingTcxo();
 }
 
+bit_t hal_sleepUntil(u4_t time) {
+    return pHalConfig->sleepUntil((ostime_t) time);
+}
+
 uint8_t hal_getTxPowerPolicy(
     u1_t inputPolicy,
     s1_t requestedPower,
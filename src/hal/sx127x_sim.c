@@ -0,0 +1,1102 @@
+/*
+
+Module:  sx127x_sim.c
+
+Function:
+        Register-level SX127x model and host HAL; see sx127x_sim.h.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+*/
+
+#if defined(LMIC_SX127X_SIM)
+
+#include "sx127x_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// -----------------------------------------------------------------------------
+// Registers and bits (SX1276 numbering, as in radio.c)
+
+enum {
+        R_Fifo                  = 0x00,
+        R_OpMode                = 0x01,
+        R_FskBitrateMsb         = 0x02,
+        R_FskBitrateLsb         = 0x03,
+        R_FrfMsb                = 0x06,
+        R_FrfMid                = 0x07,
+        R_FrfLsb                = 0x08,
+        // 0x0D .. 0x3F are banked: LoRa or FSK, by RegOpMode.LongRangeMode
+        R_BankFirst             = 0x0D,
+        R_BankLast              = 0x3F,
+        R_LoraFifoAddrPtr       = 0x0D,
+        R_LoraFifoTxBaseAddr    = 0x0E,
+        R_LoraFifoRxBaseAddr    = 0x0F,
+        R_LoraFifoRxCurrentAddr = 0x10,
+        R_LoraIrqFlagsMask      = 0x11,
+        R_LoraIrqFlags          = 0x12,
+        R_LoraRxNbBytes         = 0x13,
+        R_LoraModemStat         = 0x18,
+        R_LoraPktSnrValue       = 0x19,
+        R_LoraPktRssiValue      = 0x1A,
+        R_LoraRssiValue         = 0x1B,
+        R_LoraHopChannel        = 0x1C,
+        R_LoraModemConfig1      = 0x1D,
+        R_LoraModemConfig2      = 0x1E,
+        R_LoraSymbTimeoutLsb    = 0x1F,
+        R_LoraPreambleMsb       = 0x20,
+        R_LoraPreambleLsb       = 0x21,
+        R_LoraPayloadLength     = 0x22,
+        R_LoraMaxPayloadLength  = 0x23,
+        R_LoraModemConfig3      = 0x26,
+        R_LoraRssiWideband      = 0x2C,
+        R_LoraSyncWord          = 0x39,
+        R_FskRssiValue          = 0x11,
+        R_FskRxTimeout2         = 0x21,
+        R_FskPreambleMsb        = 0x25,
+        R_FskPreambleLsb        = 0x26,
+        R_FskSyncConfig         = 0x27,
+        R_FskPayloadLength      = 0x32,
+        R_FskFifoThresh         = 0x35,
+        R_FskIrqFlags1          = 0x3E,
+        R_FskIrqFlags2          = 0x3F,
+        R_DioMapping1           = 0x40,
+        R_Version               = 0x42,
+};
+
+#define OM_LORA                 0x80
+#define OM_MODE                 0x07
+enum { M_SLEEP = 0, M_STDBY, M_FSTX, M_TX, M_FSRX, M_RXCONT, M_RXSINGLE, M_CAD };
+
+#define LIRQ_RXTOUT             0x80
+#define LIRQ_RXDONE             0x40
+#define LIRQ_CRCERR             0x20
+#define LIRQ_HEADER             0x10
+#define LIRQ_TXDONE             0x08
+#define LIRQ_CDDONE             0x04
+#define LIRQ_FHSSCH             0x02
+#define LIRQ_CDDETD             0x01
+
+#define FIRQ1_MODEREADY         0x80
+#define FIRQ1_RXREADY           0x40
+#define FIRQ1_TXREADY           0x20
+#define FIRQ1_TIMEOUT           0x04
+#define FIRQ2_FIFOFULL          0x80
+#define FIRQ2_FIFOEMPTY         0x40
+#define FIRQ2_FIFOLEVEL         0x20
+#define FIRQ2_FIFOOVERRUN       0x10
+#define FIRQ2_PACKETSENT        0x08
+#define FIRQ2_PAYLOADREADY      0x04
+#define FIRQ2_CRCOK             0x02
+
+#if defined(CFG_sx1272_radio)
+# define SIM_VERSION            0x22
+# define SIM_RSSI_ADJUST_LF     139
+# define SIM_RSSI_ADJUST_HF     139
+#else
+# define SIM_VERSION            0x12
+# define SIM_RSSI_ADJUST_LF     164
+# define SIM_RSSI_ADJUST_HF     157
+#endif
+#define SIM_FREQ_LF_MAX         525000000
+
+enum {
+        SIM_MAX_FRAMES = 32,
+        SIM_FSK_FIFO_SIZE = 64,
+        SIM_FREQ_TOLERANCE = 10000,     // Hz; receiver and frame are "on channel"
+        SIM_JOB_DISPATCH_US = 10,       // CPU time to hand out one timed job
+};
+#define SIM_NEVER               UINT64_MAX
+
+// -----------------------------------------------------------------------------
+// State
+
+typedef struct {
+        u1_t    sf;             // 7..12
+        u1_t    bw;             // 0, 1, 2 == 125, 250, 500 kHz
+        u1_t    cr;             // 1..4 == 4/5 .. 4/8
+        u1_t    ih;
+        u1_t    crc;
+        u1_t    ldro;
+        u2_t    preamble;
+        u2_t    symTimeout;
+} loracfg_t;
+
+static struct {
+        uint64_t        now;                    // us
+        u1_t            reg[0x80];              // common registers
+        u1_t            bankLora[0x40];         // 0x0D .. 0x3F, LoRa
+        u1_t            bankFsk[0x40];          // 0x0D .. 0x3F, FSK
+        u1_t            fifo[256];              // LoRa FIFO data buffer
+
+        // operation in progress
+        u1_t            mode;
+        uint64_t        modeStart;
+        uint64_t        opStart;
+        uint64_t        opEnd;                  // TX/CAD done, RX timeout, FSK PacketSent/PayloadReady
+        int             rxFrame;                // frame being received, or -1
+        bit_t           rxHeaderDone;
+        uint64_t        rxHeader;               // ValidHeader time
+        uint64_t        rxEnd;                  // RxDone time
+        uint64_t        rxAfter;                // continuous RX: frames must start at or after this
+        u1_t            rxWr;                   // continuous RX: FIFO write pointer
+        sx127x_sim_frame_t txFrame;             // frame being sent, for the hook
+
+        // FSK packet engine
+        u1_t            fskq[SIM_FSK_FIFO_SIZE];
+        u1_t            fskHead;
+        u1_t            fskCount;
+        u1_t            fskFlags1;              // latched bits
+        u1_t            fskFlags2;              // latched bits
+        u2_t            fskTotal;               // bytes incl. length byte; 0 == not known yet
+        u2_t            fskDone;                // bytes sent or delivered
+        uint64_t        fskNext;                // next byte leaves / arrives
+        uint64_t        fskByteUs;
+
+        // interrupt lines
+        u1_t            dio;
+        ostime_t        irqTime[3];
+        u1_t            irqLevel;
+        bit_t           rstAsserted;
+
+        // configuration
+        s2_t            noise;
+        u4_t            spiHz;
+        u2_t            spiOverheadUs;
+        u4_t            rnd;
+        sx127x_sim_tx_hook_t *txHook;
+        hal_failure_handler_t *failureHandler;
+
+        sx127x_sim_frame_t frames[SIM_MAX_FRAMES];
+        bit_t           frameUsed[SIM_MAX_FRAMES];
+        sx127x_sim_stats_t stats;
+} sim;
+
+static void runUntil (uint64_t until);
+
+// -----------------------------------------------------------------------------
+// Helpers
+
+static ostime_t ticksAt (uint64_t us) {
+        return (ostime_t)(u4_t)((us * OSTICKS_PER_SEC) / 1000000);
+}
+
+static u1_t *regp (u1_t addr) {
+        if (addr >= R_BankFirst && addr <= R_BankLast)
+                return (sim.reg[R_OpMode] & OM_LORA) ? &sim.bankLora[addr - R_BankFirst]
+                                                     : &sim.bankFsk[addr - R_BankFirst];
+        return &sim.reg[addr];
+}
+
+static u1_t lreg (u1_t addr) {
+        return sim.bankLora[addr - R_BankFirst];
+}
+
+static u1_t freg (u1_t addr) {
+        return sim.bankFsk[addr - R_BankFirst];
+}
+
+static bit_t isLora (void) {
+        return (sim.reg[R_OpMode] & OM_LORA) != 0;
+}
+
+static u4_t rxfreq (void) {
+        u4_t const frf = ((u4_t)sim.reg[R_FrfMsb] << 16) |
+                         ((u4_t)sim.reg[R_FrfMid] << 8) | sim.reg[R_FrfLsb];
+        return (u4_t)(((uint64_t)frf * 32000000u) >> 19);
+}
+
+static bit_t onChannel (const sx127x_sim_frame_t *f) {
+        u4_t const f0 = rxfreq();
+        u4_t const d = f->freq > f0 ? f->freq - f0 : f0 - f->freq;
+        return d < SIM_FREQ_TOLERANCE;
+}
+
+static u1_t rnd8 (void) {
+        u4_t x = sim.rnd;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        sim.rnd = x;
+        return (u1_t)x;
+}
+
+static uint64_t tsymUs (u1_t sf, u1_t bw) {
+        // 2^SF chips at 125 kHz is 2^SF * 8 us
+        return ((uint64_t)1 << sf) * 8 >> bw;
+}
+
+static void loracfg (loracfg_t *c) {
+        u1_t const mc1 = lreg(R_LoraModemConfig1);
+        u1_t const mc2 = lreg(R_LoraModemConfig2);
+
+#if defined(CFG_sx1272_radio)
+        c->bw = (mc1 >> 6) > 2 ? 2 : (mc1 >> 6);
+        c->cr = (mc1 >> 3) & 7;
+        c->ih = (mc1 >> 2) & 1;
+        c->crc = (mc1 >> 1) & 1;
+        c->ldro = mc1 & 1;
+#else
+        u1_t const bwcode = mc1 >> 4;
+        // only the LoRaWAN bandwidths are modelled; narrower ones read as 125 kHz
+        c->bw = bwcode >= 9 ? 2 : bwcode == 8 ? 1 : 0;
+        c->cr = (mc1 >> 1) & 7;
+        c->ih = mc1 & 1;
+        c->crc = (mc2 >> 2) & 1;
+        c->ldro = (lreg(R_LoraModemConfig3) >> 3) & 1;
+#endif
+        c->sf = mc2 >> 4;
+        if (c->sf < 6)
+                c->sf = 6;
+        if (c->cr < 1 || c->cr > 4)
+                c->cr = 1;
+        c->preamble = ((u2_t)lreg(R_LoraPreambleMsb) << 8) | lreg(R_LoraPreambleLsb);
+        c->symTimeout = ((u2_t)(mc2 & 3) << 8) | lreg(R_LoraSymbTimeoutLsb);
+}
+
+// time on air, per the SX127x datasheet formula.
+static uint64_t loraAirtime (u1_t sf, u1_t bw, u1_t cr, u1_t ih, u1_t crc, u1_t ldro, u2_t pre, u1_t len) {
+        uint64_t const ts = tsymUs(sf, bw);
+        int const num = 8 * len - 4 * sf + 28 + 16 * crc - 20 * ih;
+        int const den = 4 * (sf - 2 * ldro);
+        int const nPayload = 8 + (num > 0 ? (num + den - 1) / den * (cr + 4) : 0);
+
+        return ((uint64_t)pre * 4 + 17) * ts / 4 + (uint64_t)nPayload * ts;
+}
+
+// parameters of an injected or transmitted frame.
+static void frameCfg (const sx127x_sim_frame_t *f, loracfg_t *c) {
+        c->sf = getSf(f->rps) + 6;
+        c->bw = getBw(f->rps);
+        c->cr = getCr(f->rps) + 1;
+        c->ih = getIh(f->rps) != 0;
+        c->crc = ! getNocrc(f->rps);
+        c->ldro = tsymUs(c->sf, c->bw) >= 16000;
+        c->preamble = f->preamble ? f->preamble : 8;
+        c->symTimeout = 0;
+}
+
+static uint64_t frameEnd (const sx127x_sim_frame_t *f) {
+        if (getSf(f->rps) == FSK) {
+                u2_t const pre = f->preamble ? f->preamble : 5;
+                // preamble, 3-byte sync, length, payload, CRC at 50 kbps
+                return f->start_us + (uint64_t)(pre + 3 + 1 + f->len + 2) * 160;
+        }
+        loracfg_t c;
+        frameCfg(f, &c);
+        return f->start_us + loraAirtime(c.sf, c.bw, c.cr, c.ih, c.crc, c.ldro, c.preamble, f->len);
+}
+
+static s2_t rssiNow (void) {
+        s2_t r = sim.noise;
+
+        for (int i = 0; i < SIM_MAX_FRAMES; ++i) {
+                sx127x_sim_frame_t const * const f = &sim.frames[i];
+                if (sim.frameUsed[i] && onChannel(f) &&
+                    f->start_us <= sim.now && frameEnd(f) > sim.now && f->rssi > r)
+                        r = f->rssi;
+        }
+        return r;
+}
+
+// -----------------------------------------------------------------------------
+// FSK packet engine
+
+static u1_t fskFlags1 (void) {
+        u1_t f = FIRQ1_MODEREADY | sim.fskFlags1;
+        if (sim.mode == M_RXCONT)
+                f |= FIRQ1_RXREADY;
+        if (sim.mode == M_TX)
+                f |= FIRQ1_TXREADY;
+        return f;
+}
+
+static u1_t fskFlags2 (void) {
+        u1_t f = sim.fskFlags2;
+        if (sim.fskCount == SIM_FSK_FIFO_SIZE)
+                f |= FIRQ2_FIFOFULL;
+        if (sim.fskCount == 0)
+                f |= FIRQ2_FIFOEMPTY;
+        if (sim.fskCount > (freg(R_FskFifoThresh) & 0x3F))
+                f |= FIRQ2_FIFOLEVEL;
+        return f;
+}
+
+static void fskPush (u1_t b) {
+        if (sim.fskCount == SIM_FSK_FIFO_SIZE) {
+                sim.fskFlags2 |= FIRQ2_FIFOOVERRUN;
+                ++sim.stats.fsk_overruns;
+                return;
+        }
+        sim.fskq[(sim.fskHead + sim.fskCount) % SIM_FSK_FIFO_SIZE] = b;
+        ++sim.fskCount;
+}
+
+static u1_t fskPop (void) {
+        if (sim.fskCount == 0)
+                return 0;
+        u1_t const b = sim.fskq[sim.fskHead];
+        sim.fskHead = (sim.fskHead + 1) % SIM_FSK_FIFO_SIZE;
+        --sim.fskCount;
+        return b;
+}
+
+static uint64_t fskByteUs (void) {
+        u2_t const br = ((u2_t)sim.reg[R_FskBitrateMsb] << 8) | sim.reg[R_FskBitrateLsb];
+        return br ? (uint64_t)8 * br / 32 : 160;    // 8 bits of 32 MHz / br
+}
+
+static u2_t fskHeaderBytes (void) {
+        u2_t const pre = ((u2_t)freg(R_FskPreambleMsb) << 8) | freg(R_FskPreambleLsb);
+        u1_t const sc = freg(R_FskSyncConfig);
+        return pre + ((sc & 0x10) ? (sc & 7) + 1 : 0);
+}
+
+// -----------------------------------------------------------------------------
+// Operations
+
+// pick the frame a LoRa receiver opened at opStart will lock onto: it needs
+// to see four preamble symbols, before the symbol timeout in single mode.
+static void loraPickRx (void) {
+        loracfg_t c;
+        uint64_t best = SIM_NEVER;
+
+        loracfg(&c);
+        uint64_t const deadline = sim.mode == M_RXSINGLE
+                ? sim.opStart + (uint64_t)c.symTimeout * tsymUs(c.sf, c.bw)
+                : SIM_NEVER;
+
+        sim.rxFrame = -1;
+        for (int i = 0; i < SIM_MAX_FRAMES; ++i) {
+                sx127x_sim_frame_t const * const f = &sim.frames[i];
+                loracfg_t fc;
+
+                if (! sim.frameUsed[i] || getSf(f->rps) == FSK || ! onChannel(f))
+                        continue;
+                frameCfg(f, &fc);
+                if (fc.sf != c.sf || fc.bw != c.bw || f->start_us < sim.rxAfter)
+                        continue;
+
+                uint64_t const ts = tsymUs(fc.sf, fc.bw);
+                uint64_t const from = f->start_us > sim.opStart ? f->start_us : sim.opStart;
+                uint64_t const tDetect = from + 4 * ts;
+                if (tDetect > f->start_us + fc.preamble * ts || tDetect > deadline || tDetect >= best)
+                        continue;
+
+                best = tDetect;
+                sim.rxFrame = i;
+                sim.rxHeaderDone = 0;
+                sim.rxHeader = f->start_us + ((uint64_t)fc.preamble * 4 + 17) * ts / 4 + 8 * ts;
+                sim.rxEnd = frameEnd(f);
+        }
+        sim.opEnd = (sim.rxFrame < 0) ? deadline : SIM_NEVER;
+}
+
+static void fskPickRx (void) {
+        uint64_t const bt = sim.fskByteUs;
+        uint64_t const timeout = freg(R_FskRxTimeout2)
+                ? sim.opStart + (uint64_t)freg(R_FskRxTimeout2) * 2 * bt
+                : SIM_NEVER;
+        uint64_t best = SIM_NEVER;
+
+        sim.rxFrame = -1;
+        for (int i = 0; i < SIM_MAX_FRAMES; ++i) {
+                sx127x_sim_frame_t const * const f = &sim.frames[i];
+                u2_t const pre = f->preamble ? f->preamble : 5;
+
+                if (! sim.frameUsed[i] || getSf(f->rps) != FSK || ! onChannel(f))
+                        continue;
+                if (f->start_us < sim.rxAfter || f->len > freg(R_FskPayloadLength))
+                        continue;
+                // we need the last two preamble bytes and the sync word
+                if (sim.opStart > f->start_us + (uint64_t)(pre - 2) * bt)
+                        continue;
+                uint64_t const tSync = f->start_us + (uint64_t)(pre + 3) * bt;
+                if (tSync > timeout || tSync >= best)
+                        continue;
+                best = tSync;
+                sim.rxFrame = i;
+        }
+        if (sim.rxFrame >= 0) {
+                sim.fskTotal = 1 + sim.frames[sim.rxFrame].len;
+                sim.fskDone = 0;
+                sim.fskNext = best + bt;
+                sim.opEnd = SIM_NEVER;
+        } else {
+                sim.opEnd = timeout;
+        }
+}
+
+static void setMode (u1_t mode) {
+        sim.stats.mode_us[sim.mode] += sim.now - sim.modeStart;
+        sim.modeStart = sim.now;
+        if (mode != sim.mode && ! isLora()) {
+                // FSK status bits don't survive a mode change
+                sim.fskFlags1 = 0;
+                sim.fskFlags2 = 0;
+        }
+        if (mode == M_SLEEP) {
+                // nor does the FIFO survive sleep
+                sim.fskHead = sim.fskCount = 0;
+        }
+        sim.mode = mode;
+        sim.reg[R_OpMode] = (sim.reg[R_OpMode] & ~OM_MODE) | mode;
+}
+
+static void startOp (void) {
+        sim.opStart = sim.now;
+        sim.opEnd = SIM_NEVER;
+        sim.rxFrame = -1;
+        sim.fskNext = SIM_NEVER;
+        sim.rxAfter = 0;
+
+        if (isLora()) {
+                loracfg_t c;
+                loracfg(&c);
+
+                switch (sim.mode) {
+                case M_TX: {
+                        u1_t const len = lreg(R_LoraPayloadLength);
+                        u1_t const base = lreg(R_LoraFifoTxBaseAddr);
+                        sx127x_sim_frame_t * const f = &sim.txFrame;
+
+                        f->start_us = sim.now;
+                        f->freq = rxfreq();
+                        f->rps = makeRps((sf_t)(c.sf - 6), (bw_t)c.bw, (cr_t)(c.cr - 1), c.ih, ! c.crc);
+                        f->preamble = c.preamble;
+                        f->rssi = 0;
+                        f->snr = 0;
+                        f->crc_err = 0;
+                        f->len = len;
+                        for (u2_t i = 0; i < len && i < sizeof(f->data); ++i)
+                                f->data[i] = sim.fifo[(u1_t)(base + i)];
+                        sim.opEnd = sim.now + loraAirtime(c.sf, c.bw, c.cr, c.ih, c.crc, c.ldro, c.preamble, len);
+                        break;
+                }
+                case M_RXSINGLE:
+                case M_RXCONT:
+                        sim.rxWr = lreg(R_LoraFifoRxBaseAddr);
+                        loraPickRx();
+                        break;
+                case M_CAD:
+                        ++sim.stats.cad_runs;
+                        sim.opEnd = sim.now + tsymUs(c.sf, c.bw) + (32 * 8 >> c.bw);
+                        break;
+                default:
+                        break;
+                }
+        } else {
+                sim.fskByteUs = fskByteUs();
+                switch (sim.mode) {
+                case M_TX:
+                        sim.txFrame.start_us = sim.now;
+                        sim.txFrame.freq = rxfreq();
+                        sim.txFrame.rps = FSK;
+                        sim.txFrame.preamble = ((u2_t)freg(R_FskPreambleMsb) << 8) | freg(R_FskPreambleLsb);
+                        sim.txFrame.len = 0;
+                        sim.fskTotal = 0;
+                        sim.fskDone = 0;
+                        sim.fskNext = sim.now + (uint64_t)(fskHeaderBytes() + 1) * sim.fskByteUs;
+                        break;
+                case M_RXCONT:
+                        fskPickRx();
+                        break;
+                default:
+                        break;
+                }
+        }
+}
+
+static void writeOpMode (u1_t v) {
+        u1_t const cur = sim.reg[R_OpMode];
+
+        // LongRangeMode can only be changed in sleep
+        if ((cur & OM_MODE) != M_SLEEP)
+                v = (v & ~OM_LORA) | (cur & OM_LORA);
+        sim.reg[R_OpMode] = (v & ~OM_MODE) | (cur & OM_MODE);
+        setMode(v & OM_MODE);
+        startOp();
+}
+
+static void loraFlag (u1_t bits) {
+        sim.bankLora[R_LoraIrqFlags - R_BankFirst] |= bits & ~lreg(R_LoraIrqFlagsMask);
+}
+
+static void txDone (void) {
+        ++sim.stats.tx_frames;
+        if (sim.txHook != NULL)
+                sim.txHook(&sim.txFrame);
+}
+
+// complete whatever is due at sim.now
+static void doEvent (void) {
+        if (sim.fskNext <= sim.now) {
+                uint64_t const bt = sim.fskByteUs;
+
+                if (sim.mode == M_TX) {
+                        if (sim.fskCount == 0) {
+                                // nothing to send: the frame is ruined
+                                ++sim.stats.fsk_underruns;
+                                sim.fskNext = SIM_NEVER;
+                                return;
+                        }
+                        u1_t const b = fskPop();
+                        if (sim.fskDone == 0)
+                                sim.fskTotal = 1 + b;
+                        else
+                                sim.txFrame.data[sim.txFrame.len++] = b;
+                        ++sim.fskDone;
+                        if (sim.fskDone == sim.fskTotal) {
+                                sim.fskNext = SIM_NEVER;
+                                sim.opEnd = sim.now + 2 * bt;      // CRC
+                        } else {
+                                sim.fskNext = sim.now + bt;
+                        }
+                } else {
+                        sx127x_sim_frame_t const * const f = &sim.frames[sim.rxFrame];
+                        fskPush(sim.fskDone == 0 ? f->len : f->data[sim.fskDone - 1]);
+                        ++sim.fskDone;
+                        if (sim.fskDone == sim.fskTotal) {
+                                sim.fskNext = SIM_NEVER;
+                                sim.opEnd = sim.now + 2 * bt;      // CRC
+                        } else {
+                                sim.fskNext = sim.now + bt;
+                        }
+                }
+                return;
+        }
+
+        if (sim.rxFrame >= 0 && isLora()) {
+                sx127x_sim_frame_t const * const f = &sim.frames[sim.rxFrame];
+
+                if (! sim.rxHeaderDone && sim.rxHeader <= sim.now) {
+                        sim.rxHeaderDone = 1;
+                        sim.bankLora[R_LoraRxNbBytes - R_BankFirst] = f->len;
+                        loraFlag(LIRQ_HEADER);
+                        return;
+                }
+                if (sim.rxHeaderDone && sim.rxEnd <= sim.now) {
+                        u1_t const adj = f->freq > SIM_FREQ_LF_MAX ? SIM_RSSI_ADJUST_HF : SIM_RSSI_ADJUST_LF;
+                        s2_t rssi = f->rssi + adj;
+
+                        sim.bankLora[R_LoraFifoRxCurrentAddr - R_BankFirst] = sim.rxWr;
+                        for (u2_t i = 0; i < f->len; ++i)
+                                sim.fifo[sim.rxWr++] = f->data[i];
+                        sim.bankLora[R_LoraRxNbBytes - R_BankFirst] = f->len;
+                        sim.bankLora[R_LoraPktSnrValue - R_BankFirst] = (u1_t)(s1_t)(f->snr * 4);
+                        sim.bankLora[R_LoraPktRssiValue - R_BankFirst] = (u1_t)(rssi < 0 ? 0 : rssi > 255 ? 255 : rssi);
+                        loraFlag(LIRQ_RXDONE | (f->crc_err ? LIRQ_CRCERR : 0));
+                        ++sim.stats.rx_frames;
+
+                        sim.rxAfter = f->start_us + 1;
+                        if (sim.mode == M_RXSINGLE) {
+                                sim.rxFrame = -1;
+                                setMode(M_STDBY);
+                        } else {
+                                loraPickRx();
+                        }
+                        return;
+                }
+        }
+
+        if (sim.opEnd <= sim.now) {
+                sim.opEnd = SIM_NEVER;
+                if (isLora()) {
+                        switch (sim.mode) {
+                        case M_TX:
+                                loraFlag(LIRQ_TXDONE);
+                                setMode(M_STDBY);
+                                txDone();
+                                break;
+                        case M_RXSINGLE:
+                                loraFlag(LIRQ_RXTOUT);
+                                ++sim.stats.rx_timeouts;
+                                setMode(M_STDBY);
+                                break;
+                        case M_CAD: {
+                                loracfg_t c;
+                                bit_t busy = 0;
+
+                                loracfg(&c);
+                                for (int i = 0; i < SIM_MAX_FRAMES; ++i) {
+                                        sx127x_sim_frame_t const * const f = &sim.frames[i];
+                                        loracfg_t fc;
+                                        if (! sim.frameUsed[i] || getSf(f->rps) == FSK || ! onChannel(f))
+                                                continue;
+                                        frameCfg(f, &fc);
+                                        if (fc.sf == c.sf && fc.bw == c.bw &&
+                                            f->start_us < sim.now && frameEnd(f) > sim.opStart)
+                                                busy = 1;
+                                }
+                                if (busy)
+                                        ++sim.stats.cad_detects;
+                                loraFlag(LIRQ_CDDONE | (busy ? LIRQ_CDDETD : 0));
+                                setMode(M_STDBY);
+                                break;
+                        }
+                        default:
+                                break;
+                        }
+                } else if (sim.mode == M_TX) {
+                        sim.fskFlags2 |= FIRQ2_PACKETSENT;
+                        txDone();
+                } else if (sim.mode == M_RXCONT) {
+                        if (sim.rxFrame >= 0) {
+                                sim.fskFlags2 |= FIRQ2_PAYLOADREADY |
+                                        (sim.frames[sim.rxFrame].crc_err ? 0 : FIRQ2_CRCOK);
+                                sim.rxAfter = sim.frames[sim.rxFrame].start_us + 1;
+                                sim.rxFrame = -1;
+                                ++sim.stats.rx_frames;
+                        } else {
+                                sim.fskFlags1 |= FIRQ1_TIMEOUT;
+                                ++sim.stats.rx_timeouts;
+                        }
+                }
+        }
+}
+
+static uint64_t nextEvent (void) {
+        uint64_t t = sim.opEnd;
+
+        if (sim.fskNext < t)
+                t = sim.fskNext;
+        if (sim.rxFrame >= 0 && isLora()) {
+                uint64_t const tf = sim.rxHeaderDone ? sim.rxEnd : sim.rxHeader;
+                if (tf < t)
+                        t = tf;
+        }
+        return t;
+}
+
+// -----------------------------------------------------------------------------
+// DIO lines
+
+static u1_t dioLevels (void) {
+        u1_t const map = sim.reg[R_DioMapping1];
+        u1_t lv = 0;
+
+        if (isLora()) {
+                static const u1_t dio0[4] = { LIRQ_RXDONE, LIRQ_TXDONE, LIRQ_CDDONE, 0 };
+                static const u1_t dio1[4] = { LIRQ_RXTOUT, LIRQ_FHSSCH, LIRQ_CDDETD, 0 };
+                u1_t const flags = lreg(R_LoraIrqFlags);
+
+                if (flags & dio0[map >> 6])
+                        lv |= 1;
+                if (flags & dio1[(map >> 4) & 3])
+                        lv |= 2;
+                if (((map >> 2) & 3) != 3 && (flags & LIRQ_FHSSCH))
+                        lv |= 4;
+        } else {
+                u1_t const f1 = fskFlags1();
+                u1_t const f2 = fskFlags2();
+                static const u1_t dio1[4] = { FIRQ2_FIFOLEVEL, FIRQ2_FIFOEMPTY, FIRQ2_FIFOFULL, 0 };
+
+                if ((map >> 6) == 0 && (f2 & (FIRQ2_PACKETSENT | FIRQ2_PAYLOADREADY)))
+                        lv |= 1;
+                if (f2 & dio1[(map >> 4) & 3])
+                        lv |= 2;
+                switch ((map >> 2) & 3) {
+                case 0: if (f2 & FIRQ2_FIFOFULL) lv |= 4; break;
+                case 1: if (f1 & FIRQ1_RXREADY) lv |= 4; break;
+                case 2: if (f1 & FIRQ1_TIMEOUT) lv |= 4; break;
+                default: break;
+                }
+        }
+        return lv;
+}
+
+// latch rising edges, first-timestamp-wins, like the Arduino HAL
+static void updateDio (void) {
+        u1_t const lv = dioLevels();
+        u1_t const rising = lv & ~sim.dio;
+
+        sim.dio = lv;
+        for (u1_t i = 0; i < 3; ++i) {
+                if ((rising & (1 << i)) && sim.irqTime[i] == 0) {
+                        ostime_t const t = ticksAt(sim.now);
+                        sim.irqTime[i] = t ? t : 1;
+                }
+        }
+}
+
+static void runUntil (uint64_t until) {
+        for (;;) {
+                uint64_t const t = nextEvent();
+                if (t > until)
+                        break;
+                if (t > sim.now)
+                        sim.now = t;
+                doEvent();
+                updateDio();
+        }
+        if (until > sim.now)
+                sim.now = until;
+}
+
+// -----------------------------------------------------------------------------
+// Register access
+
+static void regWrite (u1_t addr, u1_t v) {
+        if (addr == R_OpMode) {
+                writeOpMode(v);
+        } else if (addr == R_Fifo) {
+                if (isLora()) {
+                        u1_t * const ptr = &sim.bankLora[R_LoraFifoAddrPtr - R_BankFirst];
+                        sim.fifo[(*ptr)++] = v;
+                } else {
+                        fskPush(v);
+                        if (sim.mode == M_TX && sim.fskNext == SIM_NEVER &&
+                            sim.opEnd == SIM_NEVER && (sim.fskTotal == 0 || sim.fskDone < sim.fskTotal))
+                                sim.fskNext = sim.now + sim.fskByteUs;
+                }
+        } else if (isLora() && addr == R_LoraIrqFlags) {
+                sim.bankLora[R_LoraIrqFlags - R_BankFirst] &= ~v;
+        } else if (! isLora() && (addr == R_FskIrqFlags1 || addr == R_FskIrqFlags2)) {
+                // only FifoOverrun is write-1-to-clear; the rest is status
+                if (addr == R_FskIrqFlags2)
+                        sim.fskFlags2 &= ~(v & FIRQ2_FIFOOVERRUN);
+        } else if (addr != R_Version) {
+                *regp(addr) = v;
+        }
+}
+
+static u1_t regRead (u1_t addr) {
+        if (addr == R_Fifo) {
+                if (isLora()) {
+                        u1_t * const ptr = &sim.bankLora[R_LoraFifoAddrPtr - R_BankFirst];
+                        return sim.fifo[(*ptr)++];
+                }
+                return fskPop();
+        }
+        if (isLora()) {
+                switch (addr) {
+                case R_LoraRssiValue: {
+                        s2_t const dbm = rssiNow();
+                        s2_t const v = dbm + (rxfreq() > SIM_FREQ_LF_MAX ? SIM_RSSI_ADJUST_HF : SIM_RSSI_ADJUST_LF);
+                        return (u1_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+                }
+                case R_LoraRssiWideband:
+                        return rnd8();
+                case R_LoraModemStat:
+                        if (sim.rxFrame >= 0 && sim.rxHeaderDone) {
+                                loracfg_t fc;
+                                frameCfg(&sim.frames[sim.rxFrame], &fc);
+                                return (u1_t)((fc.cr << 5) | 0x0B);     // header valid, synced, detected
+                        }
+                        return sim.rxFrame >= 0 ? 0x01 : 0x10;         // detected / modem clear
+                case R_LoraHopChannel:
+                        if (sim.rxFrame >= 0 && sim.rxHeaderDone && ! getNocrc(sim.frames[sim.rxFrame].rps))
+                                return 0x40;
+                        return 0;
+                default:
+                        break;
+                }
+        } else {
+                switch (addr) {
+                case R_FskIrqFlags1:
+                        return fskFlags1();
+                case R_FskIrqFlags2:
+                        return fskFlags2();
+                case R_FskRssiValue: {
+                        s2_t const v = -2 * rssiNow();
+                        return (u1_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+                }
+                default:
+                        break;
+                }
+        }
+        return *regp(addr);
+}
+
+static void spiCost (size_t len) {
+        u1_t const m = sim.mode;
+        u4_t const us = sim.spiOverheadUs +
+                (u4_t)(((uint64_t)(len + 1) * 8 * 1000000 + sim.spiHz - 1) / sim.spiHz);
+
+        ++sim.stats.spi_transactions[m];
+        sim.stats.spi_bytes[m] += (u4_t)(len + 1);
+#if LMIC_ENABLE_spi_stats
+        lmic_spi_stats_t * const pStats = &LMIC.radio.spi[LMIC.radio.spi_phase];
+        ++pStats->transactions;
+        pStats->bytes += (u4_t)(len + 1);
+        pStats->us += us;
+#endif
+        runUntil(sim.now + us);
+}
+
+// -----------------------------------------------------------------------------
+// Model API
+
+static void chipReset (void) {
+        memset(sim.reg, 0, sizeof(sim.reg));
+        memset(sim.bankLora, 0, sizeof(sim.bankLora));
+        memset(sim.bankFsk, 0, sizeof(sim.bankFsk));
+
+        sim.reg[R_OpMode] = 0x09;               // FSK, LF, standby
+        sim.reg[R_FskBitrateMsb] = 0x1A;
+        sim.reg[R_FskBitrateLsb] = 0x0B;
+        sim.reg[R_FrfMsb] = 0x6C;
+        sim.reg[R_FrfMid] = 0x80;
+        sim.reg[R_Version] = SIM_VERSION;
+        sim.bankLora[R_LoraFifoTxBaseAddr - R_BankFirst] = 0x80;
+        sim.bankLora[R_LoraModemConfig1 - R_BankFirst] = 0x72;
+        sim.bankLora[R_LoraModemConfig2 - R_BankFirst] = 0x70;
+        sim.bankLora[R_LoraSymbTimeoutLsb - R_BankFirst] = 0x64;
+        sim.bankLora[R_LoraPreambleLsb - R_BankFirst] = 0x08;
+        sim.bankLora[R_LoraPayloadLength - R_BankFirst] = 0x01;
+        sim.bankLora[R_LoraMaxPayloadLength - R_BankFirst] = 0xFF;
+        sim.bankLora[R_LoraSyncWord - R_BankFirst] = 0x12;
+        sim.bankFsk[R_FskPreambleLsb - R_BankFirst] = 0x03;
+        sim.bankFsk[R_FskSyncConfig - R_BankFirst] = 0x93;
+        sim.bankFsk[R_FskPayloadLength - R_BankFirst] = 0x40;
+        sim.bankFsk[R_FskFifoThresh - R_BankFirst] = 0x8F;
+
+        sim.stats.mode_us[sim.mode] += sim.now - sim.modeStart;
+        sim.modeStart = sim.now;
+        sim.mode = M_STDBY;
+        sim.opEnd = SIM_NEVER;
+        sim.fskNext = SIM_NEVER;
+        sim.rxFrame = -1;
+        sim.fskHead = sim.fskCount = 0;
+        sim.fskFlags1 = sim.fskFlags2 = 0;
+        sim.dio = 0;
+}
+
+//! \brief power-on: registers to defaults, time to zero, no frames.
+void sx127x_sim_reset(void) {
+        memset(&sim, 0, sizeof(sim));
+        sim.noise = -120;
+        sim.spiHz = (u4_t) LMIC_SPI_FREQ;
+        sim.spiOverheadUs = 5;
+        sim.rnd = 0x2545F491;
+        chipReset();
+}
+
+uint64_t sx127x_sim_now_us(void) {
+        return sim.now;
+}
+
+//! \brief let `us` microseconds pass, completing radio events on the way.
+void sx127x_sim_advance_us(uint64_t us) {
+        runUntil(sim.now + us);
+}
+
+//! \brief put a frame from another node on the air. Returns 0, or -1 if
+//! the table of frames is full.
+int sx127x_sim_inject(const sx127x_sim_frame_t *pFrame) {
+        int slot = -1;
+
+        for (int i = 0; i < SIM_MAX_FRAMES; ++i) {
+                if (sim.frameUsed[i] && i != sim.rxFrame && frameEnd(&sim.frames[i]) < sim.now)
+                        sim.frameUsed[i] = 0;
+                if (! sim.frameUsed[i] && slot < 0)
+                        slot = i;
+        }
+        if (slot < 0)
+                return -1;
+
+        sim.frames[slot] = *pFrame;
+        sim.frameUsed[slot] = 1;
+
+        // a receiver that's still looking may lock onto it
+        if (sim.rxFrame < 0 && sim.opEnd != sim.now) {
+                if (isLora() && (sim.mode == M_RXCONT || sim.mode == M_RXSINGLE))
+                        loraPickRx();
+                else if (! isLora() && sim.mode == M_RXCONT && sim.fskNext == SIM_NEVER)
+                        fskPickRx();
+        }
+        return 0;
+}
+
+void sx127x_sim_set_noise(s2_t dbm) {
+        sim.noise = dbm;
+}
+
+void sx127x_sim_set_spi_timing(u4_t spi_hz, u2_t overhead_us) {
+        sim.spiHz = spi_hz ? spi_hz : 1;
+        sim.spiOverheadUs = overhead_us;
+}
+
+void sx127x_sim_set_tx_hook(sx127x_sim_tx_hook_t *pHook) {
+        sim.txHook = pHook;
+}
+
+const sx127x_sim_stats_t *sx127x_sim_get_stats(void) {
+        sim.stats.mode_us[sim.mode] += sim.now - sim.modeStart;
+        sim.modeStart = sim.now;
+        return &sim.stats;
+}
+
+void sx127x_sim_clear_stats(void) {
+        memset(&sim.stats, 0, sizeof(sim.stats));
+        sim.modeStart = sim.now;
+}
+
+// -----------------------------------------------------------------------------
+// HAL
+
+void hal_init (void) {
+        if (sim.spiHz == 0)
+                sx127x_sim_reset();
+}
+
+void hal_init_ex (const void *pContext) {
+        LMIC_API_PARAMETER(pContext);
+        hal_init();
+}
+
+void hal_pin_rxtx (u1_t val) {
+        LMIC_API_PARAMETER(val);
+}
+
+void hal_pin_rst (u1_t val) {
+#if defined(CFG_sx1272_radio)
+        bit_t const assert = (val == 1);
+#else
+        bit_t const assert = (val == 0);
+#endif
+        if (val == 2 || ! assert) {
+                if (sim.rstAsserted)
+                        chipReset();
+                sim.rstAsserted = 0;
+        } else {
+                sim.rstAsserted = 1;
+        }
+}
+
+void hal_spi_write (u1_t cmd, const u1_t *buf, size_t len) {
+        u1_t addr = cmd & 0x7F;
+
+        spiCost(len);
+        for (size_t i = 0; i < len; ++i) {
+                regWrite(addr, buf[i]);
+                if (addr != R_Fifo)
+                        addr = (addr + 1) & 0x7F;
+        }
+        updateDio();
+}
+
+void hal_spi_read (u1_t cmd, u1_t *buf, size_t len) {
+        u1_t addr = cmd & 0x7F;
+
+        spiCost(len);
+        for (size_t i = 0; i < len; ++i) {
+                buf[i] = regRead(addr);
+                if (addr != R_Fifo)
+                        addr = (addr + 1) & 0x7F;
+        }
+        updateDio();
+}
+
+void hal_disableIRQs (void) {
+        ++sim.irqLevel;
+}
+
+void hal_enableIRQs (void) {
+        if (sim.irqLevel != 0)
+                --sim.irqLevel;
+}
+
+uint8_t hal_getIrqLevel (void) {
+        return sim.irqLevel;
+}
+
+// nothing is scheduled: skip to the next radio event, or a millisecond.
+void hal_sleep (void) {
+        uint64_t const t = nextEvent();
+        runUntil(t == SIM_NEVER ? sim.now + 1000 : t);
+}
+
+u4_t hal_ticks (void) {
+        return (u4_t) ticksAt(sim.now);
+}
+
+static uint64_t usAtTick (u4_t time) {
+        s4_t const delta = (s4_t)(time - hal_ticks());
+        if (delta <= 0)
+                return sim.now;
+        return sim.now + ((uint64_t)delta * 1000000 + OSTICKS_PER_SEC - 1) / OSTICKS_PER_SEC;
+}
+
+u4_t hal_waitUntil (u4_t time) {
+        s4_t const delta = (s4_t)(time - hal_ticks());
+        if (delta < 0)
+                return (u4_t) -delta;
+        runUntil(usAtTick(time));
+        return 0;
+}
+
+bit_t hal_sleepUntil (u4_t time) {
+        LMIC_API_PARAMETER(time);
+        return 0;
+}
+
+// jump ahead to the deadline, unless the radio has something to say first.
+u1_t hal_checkTimer (u4_t time) {
+        // charge for the dispatch, so that a job that reschedules itself
+        // for "now" sees time move, as it would on hardware.
+        if ((s4_t)(time - hal_ticks()) <= 0) {
+                runUntil(sim.now + SIM_JOB_DISPATCH_US);
+                return 1;
+        }
+        if (sim.irqTime[0] | sim.irqTime[1] | sim.irqTime[2])
+                return 0;
+
+        uint64_t const t = usAtTick(time);
+        uint64_t const next = nextEvent();
+        if (next < t) {
+                runUntil(next);
+                return 0;
+        }
+        runUntil(t);
+        return 1;
+}
+
+void hal_failed (const char *file, u2_t line) {
+        if (sim.failureHandler != NULL)
+                (*sim.failureHandler)(file, line);
+        fprintf(stderr, "FAILURE %s:%u\n", file, line);
+        abort();
+}
+
+void hal_set_failure_handler (const hal_failure_handler_t* const handler) {
+        sim.failureHandler = (hal_failure_handler_t *) handler;
+}
+
+s1_t hal_getRssiCal (void) {
+        return 0;
+}
+
+ostime_t hal_setModuleActive (bit_t val) {
+        LMIC_API_PARAMETER(val);
+        return 0;
+}
+
+bit_t hal_queryUsingTcxo (void) {
+        return 0;
+}
+
+uint8_t hal_getTxPowerPolicy (u1_t inputPolicy, s1_t requestedPower, u4_t freq) {
+        LMIC_API_PARAMETER(requestedPower);
+        LMIC_API_PARAMETER(freq);
+        return inputPolicy;
+}
+
+void hal_pollPendingIRQs_helper (void) {
+        // edges are latched by the model as they happen
+}
+
+void hal_processPendingIRQs (void) {
+        for (u1_t i = 0; i < 3; ++i) {
+                ostime_t const t = sim.irqTime[i];
+                if (t) {
+                        sim.irqTime[i] = 0;
+                        radio_irq_handler_v2(i, t);
+                }
+        }
+}
+
+#endif // defined(LMIC_SX127X_SIM)
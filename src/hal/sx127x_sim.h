@@ -0,0 +1,106 @@
+/*
+
+Module:  sx127x_sim.h
+
+Function:
+        In-process SX127x model behind the LMIC HAL, for running the
+        unmodified radio driver and MAC on a host.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+*/
+
+#ifndef _sx127x_sim_h_
+# define _sx127x_sim_h_
+
+#ifndef _lmic_h_
+# include "../lmic/lmic.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+
+Overview:
+        When LMIC_SX127X_SIM is defined, sx127x_sim.c provides every hal_*()
+        routine that lmic.c, radio.c and oslmic.c need. Build it with the
+        LMIC core instead of hal.cpp.
+
+        Time is virtual and measured in microseconds. It advances only
+        - in hal_waitUntil();
+        - when hal_checkTimer()/hal_sleep() skip ahead to the next scheduled
+          job or radio event;
+        - by the modelled cost of each SPI transaction.
+        A run is therefore fully deterministic.
+
+        The model covers:
+        - the register file and the 256-byte LoRa FIFO;
+        - the FSK FIFO, including level/empty flags and bytes arriving or
+          leaving at the configured bitrate;
+        - opmode transitions;
+        - the IRQ flags and mask, and DIO0..2 with their mappings;
+        - LoRa TX, single and continuous RX, CAD and RSSI, with their timing.
+
+        Frames other nodes put on the air are injected with
+        sx127x_sim_inject(). Frames the device sends are reported through
+        the TX hook.
+
+        Not modelled:
+        - collisions and capture: the earliest eligible frame wins;
+        - IQ polarity;
+        - FHSS;
+        - the FSK RSSI/preamble timeouts other than RxTimeout2.
+
+*/
+
+typedef struct sx127x_sim_frame_s sx127x_sim_frame_t;
+
+struct sx127x_sim_frame_s {
+        uint64_t        start_us;       // start of the preamble, sim time
+        u4_t            freq;           // carrier, Hz
+        rps_t           rps;            // SF (FSK for FSK frames), BW, CR, CRC, IH
+        u2_t            preamble;       // LoRa symbols / FSK bytes; 0 == 8 / 5
+        s2_t            rssi;           // dBm at the device
+        s1_t            snr;            // dB (LoRa)
+        u1_t            crc_err;        // deliver with a CRC error
+        u1_t            len;
+        u1_t            data[MAX_LEN_FRAME];
+};
+
+// radio-level counters; index [m] is by opmode (OPMODE_SLEEP .. OPMODE_CAD)
+// at the time of the SPI transaction or interval.
+typedef struct sx127x_sim_stats_s sx127x_sim_stats_t;
+
+struct sx127x_sim_stats_s {
+        u4_t            spi_transactions[8];
+        u4_t            spi_bytes[8];
+        uint64_t        mode_us[8];     // time spent in each opmode
+        u4_t            tx_frames;
+        u4_t            rx_frames;
+        u4_t            rx_timeouts;
+        u4_t            cad_runs;
+        u4_t            cad_detects;
+        u4_t            fsk_underruns;
+        u4_t            fsk_overruns;
+};
+
+typedef void sx127x_sim_tx_hook_t(const sx127x_sim_frame_t *pFrame);
+
+void sx127x_sim_reset(void);
+uint64_t sx127x_sim_now_us(void);
+void sx127x_sim_advance_us(uint64_t us);
+int sx127x_sim_inject(const sx127x_sim_frame_t *pFrame);
+void sx127x_sim_set_noise(s2_t dbm);
+void sx127x_sim_set_spi_timing(u4_t spi_hz, u2_t overhead_us);
+void sx127x_sim_set_tx_hook(sx127x_sim_tx_hook_t *pHook);
+const sx127x_sim_stats_t *sx127x_sim_get_stats(void);
+void sx127x_sim_clear_stats(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _sx127x_sim_h_ */
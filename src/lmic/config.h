@@ -212,8 +212,127 @@
 # define LMIC_ENABLE_arbitrary_clock_error 0	/* PARAM */
 #endif
 
+// LMIC_ENABLE_rx_calibration
+// Learn, per SF and bandwidth, where Class A downlinks really arrive relative
+// to the nominal RX1/RX2 time, and use that to center and narrow the windows
+// once enough frames have been seen. Costs about 110 bytes of RAM.
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_rx_calibration)
+# define LMIC_ENABLE_rx_calibration 0	/* PARAM */
+#endif
+
+// LMIC_ENABLE_tx_power_control
+// Let the device back its TX power off below the ADR power while downlinks
+// and LinkCheckAns show margin to spare, and step back up when confirmed
+// uplinks go unanswered. The ADR power is never exceeded.
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_tx_power_control)
+# define LMIC_ENABLE_tx_power_control 0	/* PARAM */
+#endif
+
+// LMIC_RXRING_DEPTH
+// Number of frames held by the continuous-receive ring (RADIO_RXON_RING).
+// Each slot costs MAX_LEN_FRAME plus about 8 bytes of RAM.
+// This is always defined; zero disables the ring.
+#if !defined(LMIC_RXRING_DEPTH)
+# define LMIC_RXRING_DEPTH 0	/* PARAM */
+#endif
+
+// LMIC_RXQUEUE_DEPTH
+// Number of application downlinks kept, with their metadata, until the
+// application takes them with LMIC_rxQueuePeek()/LMIC_rxQueuePop().
+// This is always defined; zero disables the queue.
+#if !defined(LMIC_RXQUEUE_DEPTH)
+# define LMIC_RXQUEUE_DEPTH 0	/* PARAM */
+#endif
+
+// LMIC_RXQUEUE_MAXLEN
+// Largest downlink payload a receive queue slot holds; longer ones are
+// dropped and counted as lost. Each slot costs this plus about 14 bytes.
+#if !defined(LMIC_RXQUEUE_MAXLEN)
+# define LMIC_RXQUEUE_MAXLEN 51	/* PARAM */
+#endif
+
+// LMIC_ENABLE_tx_zerocopy
+// Let the application write an uplink payload straight into LMIC.frame;
+// see LMIC_getTxBuffer().
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_tx_zerocopy)
+# define LMIC_ENABLE_tx_zerocopy 0	/* PARAM */
+#endif
+
+// LMIC_ENABLE_tx_gather
+// Allow uplinks to be given as a list of segments (LMIC_sendSegments()),
+// gathered straight into LMIC.frame when the frame is built.
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_tx_gather)
+# define LMIC_ENABLE_tx_gather 0	/* PARAM */
+#endif
+
+// LMIC_PENDTXDATA_SIZE
+// Size of LMIC.pendTxData, which holds uplinks from LMIC_setTxData2() and
+// the transmit queue, and MAC answers sent on port 0. Zero means the
+// largest possible payload (MAX_LEN_PAYLOAD). Applications that send only
+// with LMIC_commitTxBuffer() can set this small, e.g. 16, to save RAM;
+// longer payloads are then refused with LMIC_ERROR_TX_TOO_LARGE. A
+// LMIC.pendTxLen set larger than this before LMIC_setTxData() completes
+// the uplink at once with TXRX_LENERR.
+#if !defined(LMIC_PENDTXDATA_SIZE)
+# define LMIC_PENDTXDATA_SIZE 0	/* PARAM */
+#endif
+
+// LMIC_TXQUEUE_DEPTH
+// Number of uplinks LMIC_queueTx() can hold while the MAC is busy. The MAC
+// sends them one at a time, as duty cycle and channel access allow.
+// This is always defined; zero disables the queue.
+#if !defined(LMIC_TXQUEUE_DEPTH)
+# define LMIC_TXQUEUE_DEPTH 0	/* PARAM */
+#endif
+
+// LMIC_TXQUEUE_MAXLEN
+// Largest payload a queue slot holds. Each slot costs this plus about 12
+// bytes of RAM. The default is the DR0 payload limit in most regions.
+#if !defined(LMIC_TXQUEUE_MAXLEN)
+# define LMIC_TXQUEUE_MAXLEN 51	/* PARAM */
+#endif
+
+// LMIC_ENABLE_tx_aggregation
+// Allow small records (LMIC_queueRecord()) to be packed several to an
+// uplink, as length-prefixed records. Needs the transmit queue.
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_tx_aggregation)
+# define LMIC_ENABLE_tx_aggregation 0	/* PARAM */
+#endif
+#if LMIC_ENABLE_tx_aggregation && ! (LMIC_TXQUEUE_DEPTH > 0)
+# error "LMIC_ENABLE_tx_aggregation needs LMIC_TXQUEUE_DEPTH > 0"
+#endif
+
+// LMIC_ENABLE_spi_stats
+// Count SPI transactions, bytes and bus time per phase of radio operation
+// (TX setup, FIFO download, CAD, RSSI, IRQ, sleep). See LMIC_getSpiStats().
+// Costs a timer read per transaction and about 90 bytes of RAM.
+// This is always defined, and non-zero to enable. Default is disabled.
+#if !defined(LMIC_ENABLE_spi_stats)
+# define LMIC_ENABLE_spi_stats 0	/* PARAM */
+#endif
+
 // LMIC CAD from LORAMAC
 # define LMIC_CSMA_LEVEL 1
 # define SYSNAME_TX_BTONE 0
 
+// SYSNAME_BTONE_COORD
+// Enable the busy-tone coordinator role: the node emits the tones that
+// revcadlora() listens for. Always defined; non-zero to enable.
+#if !defined(SYSNAME_BTONE_COORD)
+# define SYSNAME_BTONE_COORD 0
+#endif
+
+// SYSNAME_LPL
+// Enable low-power listening: periodic CAD on a sniff channel, with RX only
+// when a preamble is detected. See LMIC_startSniff(). Always defined;
+// non-zero to enable.
+#if !defined(SYSNAME_LPL)
+# define SYSNAME_LPL 0
+#endif
+
 #endif // _lmic_config_h_
@@ -115,6 +115,15 @@ u4_t hal_ticks (void);
  */
 u4_t hal_waitUntil (u4_t time);
 
+/*
+ * sleep until shortly before the specified timestamp, with a one-shot timer
+ * or compare interrupt armed to wake the CPU, so that a following
+ * hal_waitUntil() only has to spin for the last stretch.
+ *   - return 1 if the platform slept; 0 if it can't, in which case
+ *     the caller just spins in hal_waitUntil().
+ */
+bit_t hal_sleepUntil (u4_t time);
+
 /*
  * check and rewind timer for target time.
  *   - return 1 if target time is close
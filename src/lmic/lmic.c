@@ -50,6 +50,15 @@ static bit_t processJoinAccept_nojoinframe(void);
 static void startScan (void);
 #endif
 
+#if LMIC_TXQUEUE_DEPTH > 0
+static void txqPump (void);
+#endif
+
+#if LMIC_ENABLE_tx_power_control
+static void tpcReset (void);
+static void tpcUpdate (int headroom);
+#endif
+
 // set the txrxFlags, with debugging
 static inline void initTxrxFlags(const char *func, u1_t mask) {
 	LMIC_DEBUG2_PARAMETER(func);
@@ -378,7 +387,7 @@ static bit_t rxschedNext (xref2rxsched_t rxsched, ostime_t cando) {
 
 
 ostime_t LMICcore_rndDelay (u1_t secSpan) {
-    u2_t r = os_getRndU2();
+    u2_t r = os_getFastRndU2();
     ostime_t delay = r;
     if( delay > OSTICKS_PER_SEC )
         delay = r % (u2_t)OSTICKS_PER_SEC;
@@ -426,6 +435,10 @@ static bit_t setDrTxpow (u1_t reason, u1_t dr, s1_t pow) {
 
     if( pow != KEEP_TXPOW && pow != LMIC.adrTxPow ) {
         LMIC.adrTxPow = pow;
+#if LMIC_ENABLE_tx_power_control
+        // the network has taken a view on our power; start from there.
+        tpcReset();
+#endif
         result = 1;
     }
     if( LMIC.datarate != dr ) {
@@ -462,6 +475,48 @@ static void runEngineUpdate (xref2osjob_t osjob) {
     engineUpdate();
 }
 
+#if LMIC_RXQUEUE_DEPTH > 0
+// Downlink queue. Producer is reportEventNoUpdate(); consumer is the
+// application, through LMIC_rxQueuePeek()/LMIC_rxQueuePop(), from any job.
+// Both run from the os loop, so no locking is needed.
+static void rxqPush (void) {
+    if (LMIC.rxqCount == LMIC_RXQUEUE_DEPTH || LMIC.dataLen > LMIC_RXQUEUE_MAXLEN) {
+        LMICOS_logEventUint32("rxq dropped", ((u4_t)LMIC.rxqCount << 8u) | LMIC.dataLen);
+        if (LMIC.rxqLost != 0xFF)
+            ++LMIC.rxqLost;
+        return;
+    }
+
+    lmic_rxqueue_entry_t * const e = &LMIC.rxq[LMIC.rxqHead];
+    e->rxtime = LMIC.rxtime;
+    e->seqnoDn = LMIC.seqnoDn - 1;
+    e->rssi = LMIC.rssi - RSSI_OFF;
+    e->snr = LMIC.snr;
+    e->txrxFlags = LMIC.txrxFlags;
+    e->port = (LMIC.txrxFlags & TXRX_PORT) ? LMIC.frame[LMIC.dataBeg - 1] : 0;
+    e->lost = LMIC.rxqLost;
+    e->len = LMIC.dataLen;
+    os_copyMem(e->data, LMIC.frame + LMIC.dataBeg, LMIC.dataLen);
+
+    LMIC.rxqLost = 0;
+    LMIC.rxqHead = (LMIC.rxqHead + 1) % LMIC_RXQUEUE_DEPTH;
+    ++LMIC.rxqCount;
+}
+
+//! \brief return the oldest queued downlink, or NULL if none.
+lmic_rxqueue_entry_t const *LMIC_rxQueuePeek(void) {
+    if (LMIC.rxqCount == 0)
+        return NULL;
+    return &LMIC.rxq[(LMIC.rxqHead + LMIC_RXQUEUE_DEPTH - LMIC.rxqCount) % LMIC_RXQUEUE_DEPTH];
+}
+
+//! \brief release the downlink returned by LMIC_rxQueuePeek().
+void LMIC_rxQueuePop(void) {
+    if (LMIC.rxqCount != 0)
+        --LMIC.rxqCount;
+}
+#endif // LMIC_RXQUEUE_DEPTH > 0
+
 static void reportEventAndUpdate(ev_t ev) {
     reportEventNoUpdate(ev);
     engineUpdate();
@@ -472,6 +527,16 @@ static void reportEventNoUpdate (ev_t ev) {
     EV(devCond, INFO, (e_.reason = EV::devCond_t::LMIC_EV,
                        e_.eui    = MAIN::CDEV->getEui(),
                        e_.info   = ev));
+#if LMIC_RXQUEUE_DEPTH > 0
+    // same test as for the rx-message callback below. Push before any
+    // callback, so that the downlink is already queued when onEvent()
+    // or the callbacks look, and a new uplink they start can't
+    // overwrite the frame first.
+    if ((evSet & ((UINT32_C(1)<<EV_TXCOMPLETE) | (UINT32_C(1)<<EV_RXCOMPLETE))) != 0 &&
+        (LMIC.dataLen  != 0 || LMIC.dataBeg != 0))
+        rxqPush();
+#endif
+
 #if LMIC_ENABLE_onEvent
     void (*pOnEvent)(ev_t) = onEvent;
 
@@ -526,6 +591,11 @@ static void reportEventNoUpdate (ev_t ev) {
             if (ev == EV_TXCANCELED || (LMIC.txrxFlags & TXRX_LENERR) != 0) {
                 // canceled, or killed because of length error: unsuccessful.
                 fSuccess = 0;
+#if LMIC_CSMA_LEVEL > 0
+            } else if (LMIC.sysname_cad_result == SYSNAME_CAD_DROPPED) {
+                // channel access gave up; nothing was sent.
+                fSuccess = 0;
+#endif
             } else if (/* ev == EV_TXCOMPLETE  && */ LMIC.pendTxConf) {
                 fSuccess = (LMIC.txrxFlags & TXRX_ACK) != 0;
             } else {
@@ -608,6 +678,9 @@ static void stateJustJoined (void) {
 #endif
     LMIC.moreData    = 0;
     LMIC.upRepeat    = 0;
+#if LMIC_ENABLE_tx_power_control
+    tpcReset();
+#endif
     resetJoinParams();
 #if !defined(DISABLE_BEACONS)
     LMIC.bcnChnl     = CHNL_BCN;
@@ -701,37 +774,12 @@ static bit_t put_mac_uplink_byte3(u1_t b1, u1_t b2, u1_t b3) {
     }
 }
 
-static CONST_TABLE(u1_t, macCmdSize)[] = {
-    /* 2: LinkCheckAns */ 3,
-    /* 3: LinkADRReq */ 5,
-    /* 4: DutyCycleReq */ 2,
-    /* 5: RXParamSetupReq */ 5,
-    /* 6: DevStatusReq */ 1,
-    /* 7: NewChannelReq */ 6,
-    /* 8: RXTimingSetupReq */ 2,
-    /* 9: TxParamSetupReq */ 2,
-    /* 0x0A: DlChannelReq */ 5,
-    /* B, C: RFU */ 0, 0,
-    /* 0x0D: DeviceTimeAns */ 6,
-    /* 0x0E, 0x0F */ 0, 0,
-    /* 0x10: PingSlotInfoAns */ 1,
-    /* 0x11: PingSlotChannelReq */ 5,
-    /* 0x12: BeaconTimingAns */ 4,
-    /* 0x13: BeaconFreqReq */ 4
-};
-
-static u1_t getMacCmdSize(u1_t macCmd) {
-    if (macCmd >= 2) {
-        const unsigned macCmdMinus2 = macCmd - 2u;
-        if (macCmdMinus2 < LENOF_TABLE(macCmdSize)) {
-            // macCmd in table, fetch it's size.
-            return TABLE_GET_U1(macCmdSize, macCmdMinus2);
-        }
-    }
-    // macCmd too small or too large: return zero. Zero is
-    // never a legal command size, so it signals an error
-    // to the caller.
-    return 0;
+// room left for MAC answers in the current output buffer.
+static int mac_uplink_room(void) {
+    if (LMIC.pendMacPiggyback)
+        return (int) sizeof(LMIC.pendMacData) - LMIC.pendMacLen;
+    else
+        return (int) sizeof(LMIC.pendTxData) - LMIC.pendMacLen;
 }
 
 static bit_t
@@ -876,298 +924,383 @@ scan_mac_cmds_link_adr(
     return lastOidx;
     }
 
-// scan mac commands starting at opts[] for olen, return count of bytes consumed.
-// build response in pendMacData[], but limit length as needed; simply chop at last
-// response that fits.
-static int
-scan_mac_cmds(
-    const uint8_t *opts,
-    int olen,
-    int port
-    ) {
-    int oidx = 0;
-    uint8_t cmd;
+// MAC command handlers. Each is called with opts[0] == its CID and olen
+// bytes available, at least the size from macCmdTable[]. *pcmdlen is that
+// size on entry; a handler that consumes more (LinkADRReq blocks) adds to
+// it. The result is zero if the answer didn't fit.
+typedef bit_t mcmd_handler_t(const uint8_t *opts, int olen, int *pcmdlen);
 
-    LMIC.pendMacLen = 0;
-    if (port == 0) {
-        // port zero: mac data is in the normal payload, and there can't be
-        // piggyback mac data.
-        LMIC.pendMacPiggyback = 0;
-    } else {
-        // port is either -1 (no port) or non-zero (piggyback): treat as piggyback.
-        LMIC.pendMacPiggyback = 1;
-    }
+static bit_t mcmd_LinkCheckAns (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
 
-    while( oidx < olen ) {
-        bit_t response_fit;
+    // TODO(tmm@mcci.com) capture these, reliably..
+    //int ngws = opts[2];
+#if LMIC_ENABLE_tx_power_control
+    // margin of our last uplink at the best gateway; 255 is reserved.
+    if (opts[1] != 0xFF)
+        tpcUpdate(opts[1] - LMIC.tpcOffset);
+#else
+    LMIC_API_PARAMETER(opts);
+#endif
+    return 1;
+}
 
-        response_fit = 1;
-        cmd = opts[oidx];
+// from 1.0.3 spec section 5.2:
+// For the purpose of configuring the end-device channel mask, the end-device will
+// process all contiguous LinkAdrReq messages, in the order present in the downlink message,
+// as a single atomic block command. The end-device will accept or reject all Channel Mask
+// controls in the contiguous block, and provide consistent Channel Mask ACK status
+// indications for each command in the contiguous block in each LinkAdrAns message,
+// reflecting the acceptance or rejection of this atomic channel mask setting.
+//
+// So we need to process all the contigious commands
+static bit_t mcmd_LinkADRReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    bit_t response_fit = 1;
+    int nAns = 0;
 
-        /* compute length, and exit for illegal commands */
-        // cmdlen == 0 for error, or > 0 length of command.
-        int const cmdlen = getMacCmdSize(cmd);
-        if (cmdlen <= 0 || cmdlen > olen - oidx) {
-            // "the first unknown command terminates processing"
-            olen = oidx;
-            break;
-        }
+    // the block gets one answer per command; don't apply any of it unless
+    // all of them fit.
+    for (int i = 0; olen - i >= 5 && opts[i] == MCMD_LinkADRReq; i += 5)
+        ++nAns;
+    if (2 * nAns > mac_uplink_room())
+        return 0;
 
-        switch( cmd ) {
-        case MCMD_LinkCheckAns: {
-            // TODO(tmm@mcci.com) capture these, reliably..
-            //int gwmargin = opts[oidx+1];
-            //int ngws = opts[oidx+2];
-            break;
-        }
-        // from 1.0.3 spec section 5.2:
-        // For the purpose of configuring the end-device channel mask, the end-device will
-        // process all contiguous LinkAdrReq messages, in the order present in the downlink message,
-        // as a single atomic block command. The end-device will accept or reject all Channel Mask
-        // controls in the contiguous block, and provide consistent Channel Mask ACK status
-        // indications for each command in the contiguous block in each LinkAdrAns message,
-        // reflecting the acceptance or rejection of this atomic channel mask setting.
-        //
-        // So we need to process all the contigious commands
-        case MCMD_LinkADRReq: {
-            // skip over all but the last command.
-            oidx += scan_mac_cmds_link_adr(opts + oidx, olen - oidx, &response_fit);
-            break;
-        }
+    // skip over all but the last command.
+    *pcmdlen += scan_mac_cmds_link_adr(opts, olen, &response_fit);
+    return response_fit;
+}
 
-        case MCMD_DevStatusReq: {
-            // LMIC.snr is SNR times 4, convert to real SNR; rounding towards zero.
-            const int snr = (LMIC.snr + 2) / 4;
-            // per [1.02] 5.5. the margin is the SNR.
-            LMIC.devAnsMargin = (u1_t)(0b00111111 & (snr <= -32 ? -32 : snr >= 31 ? 31 : snr));
+static bit_t mcmd_DevStatusReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(opts);
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
 
-            response_fit = put_mac_uplink_byte3(MCMD_DevStatusAns, os_getBattLevel(), LMIC.devAnsMargin);
-            break;
-        }
+    // LMIC.snr is SNR times 4, convert to real SNR; rounding towards zero.
+    const int snr = (LMIC.snr + 2) / 4;
+    // per [1.02] 5.5. the margin is the SNR.
+    LMIC.devAnsMargin = (u1_t)(0b00111111 & (snr <= -32 ? -32 : snr >= 31 ? 31 : snr));
 
-#if !defined(DISABLE_MCMD_RXParamSetupReq)
-        case MCMD_RXParamSetupReq: {
-            dr_t dr = (dr_t)(opts[oidx+1] & 0x0F);
-            u1_t rx1DrOffset = (u1_t)((opts[oidx+1] & 0x70) >> 4);
-            u4_t freq = LMICbandplan_convFreq(&opts[oidx+2]);
-            LMIC.dn2Ans = 0xC0;   // answer pending, but send this one in order.
-            if( validDR(dr) )
-                LMIC.dn2Ans |= MCMD_RXParamSetupAns_RX2DataRateACK;
-            if( freq != 0 )
-                LMIC.dn2Ans |= MCMD_RXParamSetupAns_ChannelACK;
-            if (rx1DrOffset <= 3)
-                LMIC.dn2Ans |= MCMD_RXParamSetupAns_RX1DrOffsetAck;
-
-            if( LMIC.dn2Ans == (0xC0|MCMD_RXParamSetupAns_RX2DataRateACK|MCMD_RXParamSetupAns_ChannelACK| MCMD_RXParamSetupAns_RX1DrOffsetAck) ) {
-                LMIC.dn2Dr = dr;
-                LMIC.dn2Freq = freq;
-                LMIC.rx1DrOffset = rx1DrOffset;
-                DO_DEVDB(LMIC.dn2Dr,dn2Dr);
-                DO_DEVDB(LMIC.dn2Freq,dn2Freq);
-            }
+    return put_mac_uplink_byte3(MCMD_DevStatusAns, os_getBattLevel(), LMIC.devAnsMargin);
+}
 
-            /* put the first copy of the message */
-            response_fit = put_mac_uplink_byte2(MCMD_RXParamSetupAns, LMIC.dn2Ans & ~MCMD_RXParamSetupAns_RFU);
-            break;
-        }
+#if !defined(DISABLE_MCMD_RXParamSetupReq)
+static bit_t mcmd_RXParamSetupReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    dr_t dr = (dr_t)(opts[1] & 0x0F);
+    u1_t rx1DrOffset = (u1_t)((opts[1] & 0x70) >> 4);
+    u4_t freq = LMICbandplan_convFreq(&opts[2]);
+    LMIC.dn2Ans = 0xC0;   // answer pending, but send this one in order.
+    if( validDR(dr) )
+        LMIC.dn2Ans |= MCMD_RXParamSetupAns_RX2DataRateACK;
+    if( freq != 0 )
+        LMIC.dn2Ans |= MCMD_RXParamSetupAns_ChannelACK;
+    if (rx1DrOffset <= 3)
+        LMIC.dn2Ans |= MCMD_RXParamSetupAns_RX1DrOffsetAck;
+
+    if( LMIC.dn2Ans == (0xC0|MCMD_RXParamSetupAns_RX2DataRateACK|MCMD_RXParamSetupAns_ChannelACK| MCMD_RXParamSetupAns_RX1DrOffsetAck) ) {
+        LMIC.dn2Dr = dr;
+        LMIC.dn2Freq = freq;
+        LMIC.rx1DrOffset = rx1DrOffset;
+        DO_DEVDB(LMIC.dn2Dr,dn2Dr);
+        DO_DEVDB(LMIC.dn2Freq,dn2Freq);
+    }
+
+    /* put the first copy of the message */
+    return put_mac_uplink_byte2(MCMD_RXParamSetupAns, LMIC.dn2Ans & ~MCMD_RXParamSetupAns_RFU);
+}
+#else
+# define mcmd_RXParamSetupReq NULL
 #endif // !DISABLE_MCMD_RXParamSetupReq
 
 #if !defined(DISABLE_MCMD_RXTimingSetupReq)
-        case MCMD_RXTimingSetupReq: {
-            u1_t delay = opts[oidx+1] & MCMD_RXTimingSetupReq_Delay;
-            if (delay == 0)
-                delay = 1;
-
-            LMIC.rxDelay = delay;
-            LMIC.macRxTimingSetupAns = 2;
-            response_fit = put_mac_uplink_byte(MCMD_RXTimingSetupAns);
-            break;
-        }
+static bit_t mcmd_RXTimingSetupReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    u1_t delay = opts[1] & MCMD_RXTimingSetupReq_Delay;
+    if (delay == 0)
+        delay = 1;
+
+    LMIC.rxDelay = delay;
+    LMIC.macRxTimingSetupAns = 2;
+    return put_mac_uplink_byte(MCMD_RXTimingSetupAns);
+}
+#else
+# define mcmd_RXTimingSetupReq NULL
 #endif // !DISABLE_MCMD_RXTimingSetupReq
 
 #if !defined(DISABLE_MCMD_DutyCycleReq)
-        case MCMD_DutyCycleReq: {
-            u1_t cap = opts[oidx+1];
-            LMIC.globalDutyRate  = cap & 0xF;
-            LMIC.globalDutyAvail = os_getTime();
-            DO_DEVDB(cap,dutyCap);
+static bit_t mcmd_DutyCycleReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
 
-            response_fit = put_mac_uplink_byte(MCMD_DutyCycleAns);
-            break;
-        }
+    u1_t cap = opts[1];
+    LMIC.globalDutyRate  = cap & 0xF;
+    LMIC.globalDutyAvail = os_getTime();
+    DO_DEVDB(cap,dutyCap);
+
+    return put_mac_uplink_byte(MCMD_DutyCycleAns);
+}
+#else
+# define mcmd_DutyCycleReq NULL
 #endif // !DISABLE_MCMD_DutyCycleReq
 
 #if !defined(DISABLE_MCMD_NewChannelReq) && CFG_LMIC_EU_like
-        case MCMD_NewChannelReq: {
-            u1_t chidx = opts[oidx+1];  // channel
-            u4_t raw_f_not_zero = opts[oidx+2] | opts[oidx+3] | opts[oidx+4];
-            u4_t freq  = LMICbandplan_convFreq(&opts[oidx+2]); // freq
-            u1_t drs   = opts[oidx+5];  // datarate span
-            u1_t ans   = MCMD_NewChannelAns_DataRateACK|MCMD_NewChannelAns_ChannelACK;
-
-            if (freq == 0 && raw_f_not_zero) {
-                ans &= ~MCMD_NewChannelAns_ChannelACK;
-            }
-            u1_t MaxDR = drs >> 4;
-            u1_t MinDR = drs & 0xF;
-            if (MaxDR < MinDR || !validDR(MaxDR) || !validDR(MinDR)) {
-                ans &= ~MCMD_NewChannelAns_DataRateACK;
-            }
+static bit_t mcmd_NewChannelReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
 
-            if( ans == (MCMD_NewChannelAns_DataRateACK|MCMD_NewChannelAns_ChannelACK)) {
-                if ( ! LMIC_setupChannel(chidx, freq, DR_RANGE_MAP(MinDR, MaxDR), -1) ) {
-                    LMICOS_logEventUint32("NewChannelReq: setupChannel failed", ((u4_t)MaxDR << 24u) | ((u4_t)MinDR << 16u) | (raw_f_not_zero << 8) | (chidx << 0));
-                    ans &= ~MCMD_NewChannelAns_ChannelACK;
-                }
-            }
+    u1_t chidx = opts[1];  // channel
+    u4_t raw_f_not_zero = opts[2] | opts[3] | opts[4];
+    u4_t freq  = LMICbandplan_convFreq(&opts[2]); // freq
+    u1_t drs   = opts[5];  // datarate span
+    u1_t ans   = MCMD_NewChannelAns_DataRateACK|MCMD_NewChannelAns_ChannelACK;
 
-            response_fit = put_mac_uplink_byte2(MCMD_NewChannelAns, ans);
-            break;
+    if (freq == 0 && raw_f_not_zero) {
+        ans &= ~MCMD_NewChannelAns_ChannelACK;
+    }
+    u1_t MaxDR = drs >> 4;
+    u1_t MinDR = drs & 0xF;
+    if (MaxDR < MinDR || !validDR(MaxDR) || !validDR(MinDR)) {
+        ans &= ~MCMD_NewChannelAns_DataRateACK;
+    }
+
+    if( ans == (MCMD_NewChannelAns_DataRateACK|MCMD_NewChannelAns_ChannelACK)) {
+        if ( ! LMIC_setupChannel(chidx, freq, DR_RANGE_MAP(MinDR, MaxDR), -1) ) {
+            LMICOS_logEventUint32("NewChannelReq: setupChannel failed", ((u4_t)MaxDR << 24u) | ((u4_t)MinDR << 16u) | (raw_f_not_zero << 8) | (chidx << 0));
+            ans &= ~MCMD_NewChannelAns_ChannelACK;
         }
+    }
+
+    return put_mac_uplink_byte2(MCMD_NewChannelAns, ans);
+}
+#else
+# define mcmd_NewChannelReq NULL
 #endif // !DISABLE_MCMD_NewChannelReq
 
 #if !defined(DISABLE_MCMD_DlChannelReq) && CFG_LMIC_EU_like
-        case MCMD_DlChannelReq: {
-            u1_t chidx = opts[oidx+1];  // channel
-            u4_t freq  = LMICbandplan_convFreq(&opts[oidx+2]); // freq
-            u1_t ans   = MCMD_DlChannelAns_FreqACK|MCMD_DlChannelAns_ChannelACK;
+static bit_t mcmd_DlChannelReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
 
-            if (freq == 0) {
-                ans &= ~MCMD_DlChannelAns_ChannelACK;
-            }
-            if (chidx > MAX_CHANNELS) {
-                // this is not defined by the 1.0.3 spec
-                ans = 0;
-            } else if ((LMIC.channelMap & (1 << chidx)) == 0) {
-                // the channel is not enabled for downlink.
-                ans &= ~MCMD_DlChannelAns_FreqACK;
-            }
+    u1_t chidx = opts[1];  // channel
+    u4_t freq  = LMICbandplan_convFreq(&opts[2]); // freq
+    u1_t ans   = MCMD_DlChannelAns_FreqACK|MCMD_DlChannelAns_ChannelACK;
 
-            if( ans == (MCMD_DlChannelAns_FreqACK|MCMD_DlChannelAns_ChannelACK)) {
-                LMIC.channelDlFreq[chidx] = freq;
-            }
+    if (freq == 0) {
+        ans &= ~MCMD_DlChannelAns_ChannelACK;
+    }
+    if (chidx > MAX_CHANNELS) {
+        // this is not defined by the 1.0.3 spec
+        ans = 0;
+    } else if ((LMIC.channelMap & (1 << chidx)) == 0) {
+        // the channel is not enabled for downlink.
+        ans &= ~MCMD_DlChannelAns_FreqACK;
+    }
 
-            response_fit = put_mac_uplink_byte2(MCMD_DlChannelAns, ans);
-            // set sticky answer.
-            LMIC.macDlChannelAns = ans | 0xC0;
-            break;
-        }
+    if( ans == (MCMD_DlChannelAns_FreqACK|MCMD_DlChannelAns_ChannelACK)) {
+        LMIC.channelDlFreq[chidx] = freq;
+    }
+
+    bit_t const response_fit = put_mac_uplink_byte2(MCMD_DlChannelAns, ans);
+    // set sticky answer.
+    LMIC.macDlChannelAns = ans | 0xC0;
+    return response_fit;
+}
+#else
+# define mcmd_DlChannelReq NULL
 #endif // !DISABLE_MCMD_DlChannelReq
 
 #if !defined(DISABLE_MCMD_PingSlotChannelReq) && !defined(DISABLE_PING)
-        case MCMD_PingSlotChannelReq: {
-            u4_t raw_f_not_zero = opts[oidx+1] | opts[oidx+2] | opts[oidx+3];
-            u4_t freq = LMICbandplan_convFreq(&opts[oidx+1]);
-            u1_t dr = opts[oidx+4] & 0xF;
-            u1_t ans = MCMD_PingSlotFreqAns_DataRateACK|MCMD_PingSlotFreqAns_ChannelACK;
-            if (! raw_f_not_zero) {
-                freq = FREQ_PING;
-            } else if (freq == 0) {
-                ans &= ~MCMD_PingSlotFreqAns_ChannelACK;
-            }
-            if (! validDR(dr))
-                ans &= ~MCMD_PingSlotFreqAns_DataRateACK;
-
-            if (ans == (MCMD_PingSlotFreqAns_DataRateACK|MCMD_PingSlotFreqAns_ChannelACK)) {
-                LMIC.ping.freq = freq;
-                LMIC.ping.dr = dr;
-                DO_DEVDB(LMIC.ping.intvExp, pingIntvExp);
-                DO_DEVDB(LMIC.ping.freq, pingFreq);
-                DO_DEVDB(LMIC.ping.dr, pingDr);
-            }
-            response_fit = put_mac_uplink_byte2(MCMD_PingSlotChannelAns, ans);
-            break;
-        }
+static bit_t mcmd_PingSlotChannelReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    u4_t raw_f_not_zero = opts[1] | opts[2] | opts[3];
+    u4_t freq = LMICbandplan_convFreq(&opts[1]);
+    u1_t dr = opts[4] & 0xF;
+    u1_t ans = MCMD_PingSlotFreqAns_DataRateACK|MCMD_PingSlotFreqAns_ChannelACK;
+    if (! raw_f_not_zero) {
+        freq = FREQ_PING;
+    } else if (freq == 0) {
+        ans &= ~MCMD_PingSlotFreqAns_ChannelACK;
+    }
+    if (! validDR(dr))
+        ans &= ~MCMD_PingSlotFreqAns_DataRateACK;
+
+    if (ans == (MCMD_PingSlotFreqAns_DataRateACK|MCMD_PingSlotFreqAns_ChannelACK)) {
+        LMIC.ping.freq = freq;
+        LMIC.ping.dr = dr;
+        DO_DEVDB(LMIC.ping.intvExp, pingIntvExp);
+        DO_DEVDB(LMIC.ping.freq, pingFreq);
+        DO_DEVDB(LMIC.ping.dr, pingDr);
+    }
+    return put_mac_uplink_byte2(MCMD_PingSlotChannelAns, ans);
+}
+#else
+# define mcmd_PingSlotChannelReq NULL
 #endif // !DISABLE_MCMD_PingSlotChannelReq && !DISABLE_PING
 
 #if defined(ENABLE_MCMD_BeaconTimingAns) && !defined(DISABLE_BEACONS)
-        case MCMD_BeaconTimingAns: {
-            // Ignore if tracking already enabled or bcninfoTries == 0
-            if( (LMIC.opmode & OP_TRACK) == 0 && LMIC.bcninfoTries != 0) {
-                LMIC.bcnChnl = opts[oidx+3];
-                // Enable tracking - bcninfoTries
-                LMIC.opmode |= OP_TRACK;
-                // LMIC.bcninfoTries is cleared later in txComplete handling - triggers EV_BEACON_FOUND
-                // Setup RX parameters
-                LMIC.bcninfo.txtime = (LMIC.rxtime
-                                       + ms2osticks(os_rlsbf2(&opts[oidx+1]) * MCMD_BeaconTimingAns_TUNIT)
-                                       + ms2osticksCeil(MCMD_BeaconTimingAns_TUNIT/2)
-                                       - BCN_INTV_osticks);
-                LMIC.bcninfo.flags = 0;  // txtime above cannot be used as reference (BCN_PARTIAL|BCN_FULL cleared)
-                calcBcnRxWindowFromMillis(MCMD_BeaconTimingAns_TUNIT,1);  // error of +/-N ms
-
-                EV(lostFrame, INFO, (e_.reason  = EV::lostFrame_t::MCMD_BeaconTimingAns,
-                                     e_.eui     = MAIN::CDEV->getEui(),
-                                     e_.lostmic = Base::lsbf4(&d[pend]),
-                                     e_.info    = (LMIC.missedBcns |
-                                                   (osticks2us(LMIC.bcninfo.txtime + BCN_INTV_osticks
-                                                               - LMIC.bcnRxtime) << 8)),
-                                     e_.time    = MAIN::CDEV->ostime2ustime(LMIC.bcninfo.txtime + BCN_INTV_osticks)));
-            }
-            break;
-        } /* end case */
+static bit_t mcmd_BeaconTimingAns (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    // Ignore if tracking already enabled or bcninfoTries == 0
+    if( (LMIC.opmode & OP_TRACK) == 0 && LMIC.bcninfoTries != 0) {
+        LMIC.bcnChnl = opts[3];
+        // Enable tracking - bcninfoTries
+        LMIC.opmode |= OP_TRACK;
+        // LMIC.bcninfoTries is cleared later in txComplete handling - triggers EV_BEACON_FOUND
+        // Setup RX parameters
+        LMIC.bcninfo.txtime = (LMIC.rxtime
+                               + ms2osticks(os_rlsbf2(&opts[1]) * MCMD_BeaconTimingAns_TUNIT)
+                               + ms2osticksCeil(MCMD_BeaconTimingAns_TUNIT/2)
+                               - BCN_INTV_osticks);
+        LMIC.bcninfo.flags = 0;  // txtime above cannot be used as reference (BCN_PARTIAL|BCN_FULL cleared)
+        calcBcnRxWindowFromMillis(MCMD_BeaconTimingAns_TUNIT,1);  // error of +/-N ms
+
+        EV(lostFrame, INFO, (e_.reason  = EV::lostFrame_t::MCMD_BeaconTimingAns,
+                             e_.eui     = MAIN::CDEV->getEui(),
+                             e_.lostmic = Base::lsbf4(&d[pend]),
+                             e_.info    = (LMIC.missedBcns |
+                                           (osticks2us(LMIC.bcninfo.txtime + BCN_INTV_osticks
+                                                       - LMIC.bcnRxtime) << 8)),
+                             e_.time    = MAIN::CDEV->ostime2ustime(LMIC.bcninfo.txtime + BCN_INTV_osticks)));
+    }
+    return 1;
+}
+#else
+# define mcmd_BeaconTimingAns NULL
 #endif // !ENABLE_MCMD_BeaconTimingAns && !DISABLE_BEACONS
 
 #if LMIC_ENABLE_TxParamSetupReq
-        case MCMD_TxParamSetupReq: {
-            uint8_t txParam;
-            txParam = opts[oidx+1];
-
-            // we don't allow unrecognized bits to get to txParam.
-            txParam &= (MCMD_TxParam_RxDWELL_MASK|
-                        MCMD_TxParam_TxDWELL_MASK|
-                        MCMD_TxParam_MaxEIRP_MASK);
-            LMIC.txParam = txParam;
-            response_fit = put_mac_uplink_byte(MCMD_TxParamSetupAns);
-            break;
-        } /* end case */
+static bit_t mcmd_TxParamSetupReq (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    uint8_t txParam;
+    txParam = opts[1];
+
+    // we don't allow unrecognized bits to get to txParam.
+    txParam &= (MCMD_TxParam_RxDWELL_MASK|
+                MCMD_TxParam_TxDWELL_MASK|
+                MCMD_TxParam_MaxEIRP_MASK);
+    LMIC.txParam = txParam;
+    return put_mac_uplink_byte(MCMD_TxParamSetupAns);
+}
+#else
+# define mcmd_TxParamSetupReq NULL
 #endif // LMIC_ENABLE_TxParamSetupReq
 
 #if LMIC_ENABLE_DeviceTimeReq
-        case MCMD_DeviceTimeAns: {
-            // don't process a spurious downlink.
-            if ( LMIC.txDeviceTimeReqState == lmic_RequestTimeState_rx ) {
-                // remember that it's time to notify the client.
-                LMIC.txDeviceTimeReqState = lmic_RequestTimeState_success;
-
-                // the network time is linked to the time of the last TX.
-                LMIC.localDeviceTime = LMIC.txend;
-
-                // save the network time.
-                // The first 4 bytes contain the seconds since the GPS epoch
-                // (i.e January the 6th 1980 at 00:00:00 UTC).
-                // Note: as per the LoRaWAN specs, the octet order for all
-                //       multi-octet fields is little endian
-                // Note: the casts are necessary, because opts is an array of
-                //       single byte values, and they might overflow when shifted
-                LMIC.netDeviceTime = ( (lmic_gpstime_t) opts[oidx + 1]       ) |
-                                     (((lmic_gpstime_t) opts[oidx + 2]) <<  8) |
-                                     (((lmic_gpstime_t) opts[oidx + 3]) << 16) |
-                                     (((lmic_gpstime_t) opts[oidx + 4]) << 24);
-
-                // The 5th byte contains the fractional seconds in 2^-8 second steps
-                LMIC.netDeviceTimeFrac = opts[oidx + 5];
+static bit_t mcmd_DeviceTimeAns (const uint8_t *opts, int olen, int *pcmdlen) {
+    LMIC_API_PARAMETER(olen);
+    LMIC_API_PARAMETER(pcmdlen);
+
+    // don't process a spurious downlink.
+    if ( LMIC.txDeviceTimeReqState == lmic_RequestTimeState_rx ) {
+        // remember that it's time to notify the client.
+        LMIC.txDeviceTimeReqState = lmic_RequestTimeState_success;
+
+        // the network time is linked to the time of the last TX.
+        LMIC.localDeviceTime = LMIC.txend;
+
+        // save the network time.
+        // The first 4 bytes contain the seconds since the GPS epoch
+        // (i.e January the 6th 1980 at 00:00:00 UTC).
+        // Note: as per the LoRaWAN specs, the octet order for all
+        //       multi-octet fields is little endian
+        // Note: the casts are necessary, because opts is an array of
+        //       single byte values, and they might overflow when shifted
+        LMIC.netDeviceTime = ( (lmic_gpstime_t) opts[1]       ) |
+                             (((lmic_gpstime_t) opts[2]) <<  8) |
+                             (((lmic_gpstime_t) opts[3]) << 16) |
+                             (((lmic_gpstime_t) opts[4]) << 24);
+
+        // The 5th byte contains the fractional seconds in 2^-8 second steps
+        LMIC.netDeviceTimeFrac = opts[5];
 #if LMIC_DEBUG_LEVEL > 0
-                LMIC_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": MAC command DeviceTimeAns received: seconds_since_gps_epoch=%"PRIu32", fractional_seconds=%d\n", os_getTime(), LMIC.netDeviceTime, LMIC.netDeviceTimeFrac);
+        LMIC_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": MAC command DeviceTimeAns received: seconds_since_gps_epoch=%"PRIu32", fractional_seconds=%d\n", os_getTime(), LMIC.netDeviceTime, LMIC.netDeviceTimeFrac);
 #endif
-            }
-            break;
-        } /* end case */
+    }
+    return 1;
+}
+#else
+# define mcmd_DeviceTimeAns NULL
 #endif // LMIC_ENABLE_DeviceTimeReq
 
-        default: {
-            // force olen to current oidx so we'll exit the while()
-            olen = oidx;
+typedef struct mcmd_desc_s mcmd_desc_t;
+
+struct mcmd_desc_s {
+    u1_t            len;        // bytes, including the CID; 0 for RFU
+    u1_t            anslen;     // bytes of answer needed in the uplink
+    mcmd_handler_t  *handler;   // NULL if not supported in this build
+};
+
+// indexed by CID - 2.
+static CONST_TABLE(mcmd_desc_t, macCmdTable)[] = {
+    /* 2: LinkCheckAns */           { 3, 0, mcmd_LinkCheckAns },
+    /* 3: LinkADRReq */             { 5, 2, mcmd_LinkADRReq },   // per command in the block
+    /* 4: DutyCycleReq */           { 2, 1, mcmd_DutyCycleReq },
+    /* 5: RXParamSetupReq */        { 5, 2, mcmd_RXParamSetupReq },
+    /* 6: DevStatusReq */           { 1, 3, mcmd_DevStatusReq },
+    /* 7: NewChannelReq */          { 6, 2, mcmd_NewChannelReq },
+    /* 8: RXTimingSetupReq */       { 2, 1, mcmd_RXTimingSetupReq },
+    /* 9: TxParamSetupReq */        { 2, 1, mcmd_TxParamSetupReq },
+    /* 0x0A: DlChannelReq */        { 5, 2, mcmd_DlChannelReq },
+    /* B, C: RFU */                 { 0, 0, NULL }, { 0, 0, NULL },
+    /* 0x0D: DeviceTimeAns */       { 6, 0, mcmd_DeviceTimeAns },
+    /* 0x0E, 0x0F */                { 0, 0, NULL }, { 0, 0, NULL },
+    /* 0x10: PingSlotInfoAns */     { 1, 0, NULL },
+    /* 0x11: PingSlotChannelReq */  { 5, 2, mcmd_PingSlotChannelReq },
+    /* 0x12: BeaconTimingAns */     { 4, 0, mcmd_BeaconTimingAns },
+    /* 0x13: BeaconFreqReq */       { 4, 0, NULL }
+};
+
+// scan mac commands starting at opts[] for olen, return count of bytes consumed.
+// build response in pendMacData[], but limit length as needed; simply chop at last
+// response that fits.
+static int
+scan_mac_cmds(
+    const uint8_t *opts,
+    int olen,
+    int port
+    ) {
+    int oidx = 0;
+
+    LMIC.pendMacLen = 0;
+    if (port == 0) {
+        // port zero: mac data is in the normal payload, and there can't be
+        // piggyback mac data.
+        LMIC.pendMacPiggyback = 0;
+    } else {
+        // port is either -1 (no port) or non-zero (piggyback): treat as piggyback.
+        LMIC.pendMacPiggyback = 1;
+    }
+
+    while( oidx < olen ) {
+        unsigned const icmd = opts[oidx] - 2u;
+        mcmd_desc_t desc;
+
+        // "the first unknown command terminates processing"; so does one
+        // this build doesn't handle, a truncated one, or one we couldn't
+        // answer.
+        if (icmd >= LENOF_TABLE(macCmdTable))
             break;
-        } /* end case */
-        } /* end switch */
+        TABLE_GET_STRUCT(macCmdTable, icmd, &desc);
 
-        /* if we're out of spce for responses, skip to end. */
-        if (! response_fit) {
-            olen = oidx;
-        } else {
-            oidx += cmdlen;
-        }
+        int cmdlen = desc.len;
+        if (desc.handler == NULL || cmdlen == 0 || cmdlen > olen - oidx)
+            break;
+        if (desc.anslen > mac_uplink_room())
+            break;
+        if (! desc.handler(opts + oidx, olen - oidx, &cmdlen))
+            break;
+        oidx += cmdlen;
     } /* end while */
 
     return oidx;
@@ -1508,6 +1641,154 @@ ostime_t LMICcore_adjustForDrift (ostime_t delay, ostime_t hsym, rxsyms_t rxsyms
     return delay + rxoffset;
 }
 
+#if LMIC_ENABLE_rx_calibration
+static lmic_rxcal_t *rxcalEntry (rps_t rps) {
+    u1_t const sf = getSf(rps);
+    u1_t const bw = getBw(rps);
+
+    if (sf < SF7 || sf > SF12 || bw > BW500)
+        return NULL;
+    return &LMIC.rxcal[sf - SF7][bw];
+}
+
+// Place the window from the learned arrival estimate rather than the
+// static margin. Returns the offset from txend, and sets LMIC.rxsyms.
+// Falls back to LMICcore_adjustForDrift() until the estimate is trusted,
+// or if the previous window launched late (the estimate says nothing
+// about how late the HAL will be this time).
+static ostime_t rxcalAdjust (ostime_t delay, ostime_t hsym, u1_t dr) {
+    lmic_rxcal_t const * const e = rxcalEntry(dndr2rps(dr));
+    unsigned const late = LMIC.radio.rxlate_count;
+    bit_t const wasLate = (late != LMIC.rxcalLate);
+
+    LMIC.rxcalNominal = LMIC.txend + delay;
+    LMIC.rxcalLate = late;
+
+    if (e == NULL || e->n < LMIC_RXCAL_MIN_SAMPLES || wasLate)
+        return LMICcore_adjustForDrift(delay, hsym, LMICbandplan_MINRX_SYMS_LoRa_ClassA);
+
+    // three mean deviations either side, but never less than half a symbol
+    // and never more than the static margin would give us.
+    ostime_t margin = 3 * (ostime_t)e->spread;
+    if (margin < hsym)
+        margin = hsym;
+    if (margin > LMICbandplan_RX_EXTRA_MARGIN_osticks)
+        margin = LMICbandplan_RX_EXTRA_MARGIN_osticks;
+
+    ostime_t const tsym = 2 * hsym;
+    setRxsyms(LMICbandplan_MINRX_SYMS_LoRa_ClassA + (2 * margin + tsym - 1) / tsym);
+    return delay + e->offset - margin;
+}
+
+// Called for every accepted Class A downlink. `len` is the PHY payload
+// length as received, before decodeFrame() trimmed it.
+static void rxcalUpdate (u1_t len) {
+    lmic_rxcal_t * const e = rxcalEntry(LMIC.rps);
+
+    if (e == NULL)
+        return;
+
+    // LMIC.rxtime is the (fixed-up) end of the frame; back out the airtime
+    // to get the start of the preamble.
+    ostime_t sample = LMIC.rxtime - calcAirTime(LMIC.rps, len) - LMIC.rxcalNominal;
+
+    // anything this far out is a different problem (wrong window, clock
+    // step); don't let it poison the estimate.
+    if (sample > LMICbandplan_RX_ERROR_ABS_osticks || sample < -LMICbandplan_RX_ERROR_ABS_osticks)
+        return;
+
+    if (e->n == 0) {
+        e->offset = (s2_t) sample;
+        e->spread = LMICbandplan_RX_EXTRA_MARGIN_osticks / 2;
+    } else {
+        ostime_t dev = sample - e->offset;
+        e->offset = (s2_t) (e->offset + dev / 8);
+        if (dev < 0)
+            dev = -dev;
+        e->spread = (u2_t) (e->spread + (dev - (ostime_t)e->spread) / 8);
+    }
+    if (e->n != 0xFF)
+        ++e->n;
+}
+
+static void rxcalForget (rps_t rps) {
+    lmic_rxcal_t * const e = rxcalEntry(rps);
+
+    if (e != NULL && e->n >= LMIC_RXCAL_MIN_SAMPLES)
+        e->n = 0;
+}
+
+// A confirmed uplink got no answer. That may be the network, but it may
+// also be a window we narrowed too far; stop trusting the estimates until
+// they have been rebuilt from frames seen in full windows. We get here
+// after RX2, so LMIC.rps is RX2's; RX1's entry is the likelier culprit.
+static void rxcalMiss (void) {
+    rxcalForget(dndr2rps(LMIC.dndr));
+    rxcalForget(dndr2rps(LMIC.dn2Dr));
+}
+#endif // LMIC_ENABLE_rx_calibration
+
+#if LMIC_ENABLE_tx_power_control
+// Closed-loop TX power control. tpcHeadroom estimates how far above the
+// gateway's demodulation floor our uplinks would arrive at the ADR power.
+// LinkCheckAns gives the uplink margin directly, as received at our
+// backed-off power; it is referred back to the ADR power by removing
+// tpcOffset, so backing off doesn't feed into the estimate. Class A
+// downlinks give the downlink margin, from SNR and RSSI, which overstates
+// the uplink by roughly the difference in TX power but doesn't depend on
+// our offset at all; they are used as they are.
+
+static void tpcReset (void) {
+    LMIC.tpcOffset = 0;
+    LMIC.tpcSamples = 0;
+}
+
+// one headroom sample, in dB at the ADR power.
+static void tpcUpdate (int headroom) {
+    int h = headroom;
+
+    if (LMIC.tpcSamples != 0)
+        h = LMIC.tpcHeadroom + (headroom - LMIC.tpcHeadroom) / 4;
+    // LinkCheckAns margins go up to 254, less a negative offset.
+    if (h > 127)
+        h = 127;
+    else if (h < -128)
+        h = -128;
+    LMIC.tpcHeadroom = (s1_t) h;
+    if (LMIC.tpcSamples != 0xFF)
+        ++LMIC.tpcSamples;
+    if (LMIC.tpcSamples < LMIC_TPC_MIN_SAMPLES)
+        return;
+
+    // one step at a time towards the target, downwards only: going up is
+    // left to tpcMiss(), which has better evidence.
+    int const want = LMIC_TPC_TARGET_MARGIN_DB - LMIC.tpcHeadroom;
+    if (want <= LMIC.tpcOffset - LMIC_TPC_STEP_DB &&
+        LMIC.tpcOffset - LMIC_TPC_STEP_DB >= -LMIC_TPC_MAX_BACKOFF_DB)
+        LMIC.tpcOffset -= LMIC_TPC_STEP_DB;
+}
+
+// after an accepted Class A downlink.
+static void tpcDownlink (void) {
+    // SNR margin over the demod floor: -7.5 dB at SF7 down to -20 dB at SF12
+    int const snrFloor4 = -20 - 10 * getSf(LMIC.rps);
+    int const snrMargin = (LMIC.snr - snrFloor4) / SNR_SCALEUP;
+    int const rssiMargin = LMIC.rssi - RSSI_OFF - getSensitivity(LMIC.rps);
+    int const margin = snrMargin < rssiMargin ? snrMargin : rssiMargin;
+
+    tpcUpdate(margin - LMIC_TPC_DOWNLINK_BIAS_DB);
+}
+
+// a confirmed uplink went unanswered: two steps back up, and distrust
+// the estimate until it has been rebuilt.
+static void tpcMiss (void) {
+    LMIC.tpcOffset += 2 * LMIC_TPC_STEP_DB;
+    if (LMIC.tpcOffset > 0)
+        LMIC.tpcOffset = 0;
+    LMIC.tpcSamples = 0;
+}
+#endif // LMIC_ENABLE_tx_power_control
+
 static void schedRx12 (ostime_t delay, osjobcb_t func, u1_t dr) {
     ostime_t hsym = dr2hsym(dr);
 
@@ -1516,7 +1797,11 @@ static void schedRx12 (ostime_t delay, osjobcb_t func, u1_t dr) {
     // time things accurately.
     //
     // This also sets LMIC.rxsyms. This is NOT normally used for FSK; see LMICbandplan_txDoneFSK()
+#if LMIC_ENABLE_rx_calibration
+    LMIC.rxtime = LMIC.txend + rxcalAdjust(delay, hsym, dr);
+#else
     LMIC.rxtime = LMIC.txend + LMICcore_adjustForDrift(delay, hsym, LMICbandplan_MINRX_SYMS_LoRa_ClassA);
+#endif
 
     LMIC_X_DEBUG_PRINTF("%"LMIC_PRId_ostime_t": sched Rx12 %"LMIC_PRId_ostime_t"\n", os_getTime(), LMIC.rxtime - os_getRadioRxRampup());
     os_setTimedCallback(&LMIC.osjob, LMIC.rxtime - os_getRadioRxRampup(), func);
@@ -1556,6 +1841,60 @@ static void txDone (ostime_t delay, osjobcb_t func) {
     }
 }
 
+#if LMIC_CSMA_LEVEL > 0
+// The radio gave up on channel access and didn't transmit. Finish the
+// uplink according to LMIC.sysname_cad_fallback; returns true if so.
+// Join requests are always retried. Zero-copy uplinks are always dropped:
+// the build encrypted them in place, so there's nothing to rebuild from.
+static bit_t txAbandoned (void) {
+    u1_t const result = LMIC.sysname_cad_result;
+
+    if (result != SYSNAME_CAD_DROPPED && result != SYSNAME_CAD_REQUEUED)
+        return 0;
+
+    bit_t requeue = (result == SYSNAME_CAD_REQUEUED);
+#if LMIC_ENABLE_tx_zerocopy
+    if (LMIC.pendTxInFrame)
+        requeue = 0;
+#endif
+
+    LMIC.opmode &= ~OP_TXRXPEND;
+    if (requeue || (LMIC.opmode & OP_JOINING) != 0) {
+        // consumed; don't let it leak into the next uplink or join.
+        LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
+        // try again later, on whichever channel is next.
+        txDelay(os_getTime() + LMIC.sysname_cad_requeue, 0);
+        engineUpdate();
+    } else {
+        initTxrxFlags(__func__, (LMIC.pendTxConf || LMIC.txCnt) ? TXRX_NACK : 0);
+        LMIC.opmode &= ~(OP_POLL|OP_RNDTX|OP_TXDATA);
+#if LMIC_ENABLE_tx_zerocopy
+        LMIC.pendTxInFrame = 0;
+#endif
+#if LMIC_ENABLE_tx_gather
+        LMIC.pendTxNSegs = 0;
+#endif
+        LMIC.txCnt = LMIC.upRepeatCount = 0;
+        LMIC.dataBeg = LMIC.dataLen = 0;
+        // the report needs the result to fail txMessageCb(); clear it
+        // before the engine can start another TX.
+        reportEventNoUpdate(EV_TXCOMPLETE);
+        LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
+        engineUpdate();
+    }
+    return 1;
+}
+#endif
+
+// expected extra delay from channel access before a TX really starts.
+static inline ostime_t accessDelay (void) {
+#if LMIC_CSMA_LEVEL > 0
+    return LMIC_getExpectedAccessDelay();
+#else
+    return 0;
+#endif
+}
+
 // ======================================== Join frames
 
 
@@ -1778,6 +2117,11 @@ static void setupRx1Jacc (xref2osjob_t osjob) {
 static void jreqDone (xref2osjob_t osjob) {
     LMIC_API_PARAMETER(osjob);
 
+#if LMIC_CSMA_LEVEL > 0
+    if (txAbandoned())
+        return;
+    LMICbandplan_delayTx(LMIC.sysname_cad_access);
+#endif
     txDone(DELAY_JACC1_osticks, FUNC_ADDR(setupRx1Jacc));
 }
 
@@ -1833,6 +2177,15 @@ static void setupRx1DnData (xref2osjob_t osjob) {
 static void updataDone (xref2osjob_t osjob) {
     LMIC_API_PARAMETER(osjob);
 
+#if LMIC_CSMA_LEVEL > 0
+    if (txAbandoned())
+        return;
+    LMICbandplan_delayTx(LMIC.sysname_cad_access);
+#endif
+#if LMIC_ENABLE_tx_zerocopy
+    // sent; from here on LMIC.frame is the receive buffer.
+    LMIC.pendTxInFrame = 0;
+#endif
     txDone(sec2osticks(LMIC.rxDelay), FUNC_ADDR(setupRx1DnData));
 }
 
@@ -1856,10 +2209,35 @@ static bit_t sendAdrAckReq(void) {
     }
 }
 
+// the payload is to come from pendTxData, but pendTxLen runs past its
+// end; LMIC_setTxData() callers set pendTxLen themselves.
+static bit_t pendTxOverflows (void) {
+#if LMIC_ENABLE_tx_zerocopy
+    if (LMIC.pendTxInFrame)
+        return 0;
+#endif
+#if LMIC_ENABLE_tx_gather
+    if (LMIC.pendTxNSegs != 0)
+        return 0;
+#endif
+    return LMIC.pendTxLen > SIZEOFEXPR(LMIC.pendTxData);
+}
+
 static bit_t buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
     u1_t dlen = txdata ? LMIC.pendTxLen : 0;
 
+    if (txdata && pendTxOverflows()) {
+        LMICOS_logEventUint32("pendTxLen too long", dlen);
+        return 0;
+    }
+#if LMIC_ENABLE_tx_zerocopy
+    // the payload in LMIC.frame is only good for one build: it's moved and
+    // encrypted in place. pendTxInFrame stays set until the frame is on
+    // the air, so that txAbandoned() knows not to build it again.
+    bit_t const inFrame = LMIC.pendTxInFrame;
+#endif
+
     // Piggyback MAC options
     // Prioritize by importance
     // highest importance are the ones in the pendMac buffer.
@@ -1975,13 +2353,34 @@ static bit_t buildDataFrame (void) {
             // Confirmed only makes sense if we have a payload (or at least a port)
             LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DCUP | HDR_MAJOR_V1;
             if( LMIC.txCnt == 0 ) LMIC.txCnt = 1;
-        } else if (LMIC.upRepeat != 0) {
+        } else if (LMIC.upRepeat != 0
+#if LMIC_ENABLE_tx_zerocopy
+                   // the receive windows overwrite the payload, so
+                   // there is nothing to repeat from.
+                   && ! inFrame
+#endif
+                  ) {
             // we are repeating.  So we need to count here.
             if (LMIC.upRepeatCount == 0) {
                 LMIC.upRepeatCount = 1;
             }
         }
         LMIC.frame[end] = LMIC.pendTxPort;
+#if LMIC_ENABLE_tx_zerocopy
+        if (inFrame)
+            os_moveMem(LMIC.frame+end+1, LMIC.frame+LMIC_TX_ZEROCOPY_OFFSET, dlen);
+        else
+#endif
+#if LMIC_ENABLE_tx_gather
+        if (LMIC.pendTxNSegs != 0) {
+            // gathered afresh for each retry; the segments sum to dlen.
+            u1_t *p = LMIC.frame+end+1;
+            for (u1_t i = 0; i < LMIC.pendTxNSegs; ++i) {
+                os_copyMem(p, LMIC.pendTxSegs[i].pData, LMIC.pendTxSegs[i].len);
+                p += LMIC.pendTxSegs[i].len;
+            }
+        } else
+#endif
         os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
         aes_cipher(LMIC.pendTxPort==0 ? LMIC.nwkKey : LMIC.artKey,
                    LMIC.devaddr, LMIC.seqnoUp-1,
@@ -2244,9 +2643,13 @@ static bit_t processDnData (void) {
         // norx() doesn't call txcomplete if this is RX1.
         return processDnData_norx();
     }
+
+#if LMIC_ENABLE_rx_calibration
+    u1_t const rxlen = LMIC.dataLen;
+#endif
     // if we get here, LMIC.dataLen != 0, so there is some
     // traffic.
-    else if( !decodeFrame() ) {
+    if( !decodeFrame() ) {
         // if we are in downlink window 1, we need to schedule
         // downlink window 2.
         if( (LMIC.txrxFlags & TXRX_DNW1) != 0 )
@@ -2257,6 +2660,14 @@ static bit_t processDnData (void) {
             // to close the books on this uplink attempt
             return processDnData_norx();
     }
+
+#if LMIC_ENABLE_rx_calibration
+    rxcalUpdate(rxlen);
+#endif
+#if LMIC_ENABLE_tx_power_control
+    tpcDownlink();
+#endif
+
     // downlink frame was accepted. This means that we're done. Except
     // there's one bizarre corner case. If we sent a confirmed message
     // and got a downlink that didn't have an ACK, we have to retry.
@@ -2265,7 +2676,7 @@ static bit_t processDnData (void) {
     // windows is clear confirmation that the uplink made it to the
     // network and was valid. However, compliance checks this, so
     // we have to handle it and retransmit.
-    else if (LMIC.txCnt != 0 && (LMIC.txrxFlags & TXRX_NACK) != 0)
+    if (LMIC.txCnt != 0 && (LMIC.txrxFlags & TXRX_NACK) != 0)
         {
         // grr.  we're confirmed but the network downlink did not
         // set the ACK bit. We know txCnt is non-zero, so this
@@ -2282,6 +2693,13 @@ static bit_t processDnData (void) {
 // nothing was received this window.
 static bit_t processDnData_norx(void) {
     if( LMIC.txCnt != 0 ) {
+#if LMIC_ENABLE_rx_calibration
+        if (LMIC.dataLen == 0)
+            rxcalMiss();
+#endif
+#if LMIC_ENABLE_tx_power_control
+        tpcMiss();
+#endif
         if( LMIC.txCnt < TXCONF_ATTEMPTS ) {
             // Per [1.0.3] section 18.4, it is recommended that the device adjust datarate down.
             // The spec is not clear about what should happen in case the data size is too large
@@ -2331,6 +2749,10 @@ static bit_t processDnData_norx(void) {
 // this Class-A uplink-and-receive cycle is complete.
 static bit_t processDnData_txcomplete(void) {
     LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND);
+#if LMIC_ENABLE_tx_gather
+    // the segments are the caller's again.
+    LMIC.pendTxNSegs = 0;
+#endif
     // turn off all the repeat stuff.
     LMIC.txCnt = LMIC.upRepeatCount = 0;
 
@@ -2395,6 +2817,9 @@ static bit_t processDnData_txcomplete(void) {
         EV(devCond, ERR, (e_.reason = EV::devCond_t::LINK_DEAD,
                             e_.eui    = MAIN::CDEV->getEui(),
                             e_.info   = LMIC.adrAckReq));
+#if LMIC_ENABLE_tx_power_control
+        tpcReset();
+#endif
         dr_t newDr = decDR((dr_t)LMIC.datarate);
         // newDr must be feasible; there must be at least
         // one channel that supports the new datarate. If not, stay
@@ -2540,6 +2965,10 @@ static void engineUpdate_inner (void) {
     if( (LMIC.opmode & (OP_SCAN|OP_TXRXPEND|OP_SHUTDOWN)) != 0 )
         return;
 
+#if LMIC_TXQUEUE_DEPTH > 0
+    txqPump();
+#endif
+
 #if !defined(DISABLE_JOIN)
     if( LMIC.devaddr == 0 && (LMIC.opmode & OP_JOINING) == 0 ) {
         LMIC_startJoining();
@@ -2590,7 +3019,7 @@ static void engineUpdate_inner (void) {
         // If we're tracking a beacon...
         // then make sure TX-RX transaction is complete before beacon
         if( (LMIC.opmode & OP_TRACK) != 0 &&
-            txbeg + (jacc ? JOIN_GUARD_osticks : TXRX_GUARD_osticks) - rxtime > 0 ) {
+            txbeg + accessDelay() + (jacc ? JOIN_GUARD_osticks : TXRX_GUARD_osticks) - rxtime > 0 ) {
             // Not enough time to complete TX-RX before beacon - postpone after beacon.
             // In order to avoid clustering of postponed TX right after beacon randomize start!
             txDelay(rxtime + BCN_RESERVE_osticks, 16);
@@ -2647,6 +3076,12 @@ static void engineUpdate_inner (void) {
                         orTxrxFlags(__func__, TXRX_NACK);
                     }
                     LMIC.opmode &= ~(OP_POLL|OP_RNDTX|OP_TXDATA|OP_TXRXPEND);
+#if LMIC_ENABLE_tx_zerocopy
+                    LMIC.pendTxInFrame = 0;
+#endif
+#if LMIC_ENABLE_tx_gather
+                    LMIC.pendTxNSegs = 0;
+#endif
                     LMIC.dataBeg = LMIC.dataLen = 0;
                     reportEventNoUpdate(EV_TXCOMPLETE);
                     return;
@@ -2657,8 +3092,29 @@ static void engineUpdate_inner (void) {
             LMIC.dndr   = txdr;  // carry TX datarate (can be != LMIC.datarate) over to txDone/setupRx1
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             LMICbandplan_updateTx(txbeg);
+#if LMIC_CSMA_LEVEL > 0
+            // channel access must give up rather than run into the beacon
+            // or the next ping slot.
+            LMIC.sysname_cad_deadline = 0;
+#if !defined(DISABLE_BEACONS)
+            if( (LMIC.opmode & OP_TRACK) != 0 )
+                LMIC.sysname_cad_deadline = rxtime - (jacc ? JOIN_GUARD_osticks : TXRX_GUARD_osticks);
+#if !defined(DISABLE_PING)
+            if( (LMIC.opmode & OP_PINGINI) != 0 && LMIC.ping.rxtime - now > 0 ) {
+                ostime_t const pingDeadline = LMIC.ping.rxtime - calcAirTime(LMIC.rps, LMIC.dataLen);
+                if( LMIC.sysname_cad_deadline == 0 || pingDeadline - LMIC.sysname_cad_deadline < 0 )
+                    LMIC.sysname_cad_deadline = pingDeadline;
+            }
+#endif // !DISABLE_PING
+#endif // !DISABLE_BEACONS
+#endif // LMIC_CSMA_LEVEL > 0
             // limit power to value asked in adr
             LMIC.radio_txpow = LMIC.txpow > LMIC.adrTxPow ? LMIC.adrTxPow : LMIC.txpow;
+#if LMIC_ENABLE_tx_power_control
+            // joins always go at full power.
+            if (! jacc)
+                LMIC.radio_txpow += LMIC.tpcOffset;
+#endif
             reportEventNoUpdate(EV_TXSTART);
             os_radio(RADIO_TX);
             return;
@@ -2774,6 +3230,15 @@ void LMIC_reset (void) {
                        e_.info   = EV_RESET));
     os_radio(RADIO_RST);
     os_clearCallback(&LMIC.osjob);
+#if SYSNAME_BTONE_COORD == 1
+    LMIC_stopBusyTone();
+#endif
+#if SYSNAME_LPL == 1
+    LMIC_stopSniff();
+#endif
+#if LMIC_ENABLE_tx_aggregation
+    os_clearCallback(&LMIC.txqJob);
+#endif
 
     // save callback info, clear LMIC, restore.
     do {
@@ -2784,6 +3249,11 @@ void LMIC_reset (void) {
         LMIC.client = client;
     } while (0);
 
+#if LMIC_TXQUEUE_DEPTH > 0
+    for (u1_t i = 0; i < LMIC_TXQUEUE_DEPTH; ++i)
+        LMIC.txqOrder[i] = i;
+#endif
+
     // LMIC.devaddr      =  0;      // true from os_clearMem().
     LMIC.devNonce     =  os_getRndU2();
     LMIC.opmode       =  OP_NONE;
@@ -2833,6 +3303,12 @@ void LMIC_clrTxData (void) {
         return;
     }
     LMIC.pendTxLen = 0;
+#if LMIC_ENABLE_tx_zerocopy
+    LMIC.pendTxInFrame = 0;
+#endif
+#if LMIC_ENABLE_tx_gather
+    LMIC.pendTxNSegs = 0;
+#endif
     opmode &= ~(OP_TXDATA | OP_POLL);
     if (! (opmode & OP_JOINING)) {
         // in this case, we are joining, and the TX data
@@ -2903,6 +3379,15 @@ void LMIC_setTxData (void) {
 
 void LMIC_setTxData_strict (void) {
     LMICOS_logEventUint32(__func__, ((u4_t)LMIC.pendTxPort << 24u) | ((u4_t)LMIC.pendTxConf << 16u) | (LMIC.pendTxLen << 0u));
+    if (pendTxOverflows()) {
+        // complete it now, as buildDataFrame() would, rather than send
+        // whatever lies past pendTxData.
+        LMIC.opmode &= ~(OP_POLL|OP_TXDATA);
+        initTxrxFlags(__func__, TXRX_LENERR);
+        LMIC.dataBeg = LMIC.dataLen = 0;
+        reportEventAndUpdate(EV_TXCOMPLETE);
+        return;
+    }
     LMIC.opmode |= OP_TXDATA;
     if( (LMIC.opmode & OP_JOINING) == 0 ) {
         LMIC.txCnt = 0;             // reset the confirmed uplink FSM
@@ -2911,6 +3396,20 @@ void LMIC_setTxData_strict (void) {
     engineUpdate();
 }
 
+// start the uplink set up in LMIC.pendTx*, and say how that went.
+static lmic_tx_error_t startTxData (void) {
+    LMIC_setTxData_strict();
+    if ( (LMIC.opmode & OP_TXDATA) == 0 ) {
+        if (LMIC.txrxFlags & TXRX_LENERR) {
+            return LMIC_ERROR_TX_NOT_FEASIBLE;
+        } else {
+            // data has already been completed with error for some reason
+            return LMIC_ERROR_TX_FAILED;
+        }
+    }
+    return 0;
+}
+
 
 // send a message, attempting to adjust TX data rate
 lmic_tx_error_t LMIC_setTxData2 (u1_t port, xref2u1_t data, u1_t dlen, u1_t confirmed) {
@@ -2931,16 +3430,7 @@ lmic_tx_error_t LMIC_setTxData2_strict (u1_t port, xref2u1_t data, u1_t dlen, u1
     LMIC.pendTxConf = confirmed;
     LMIC.pendTxPort = port;
     LMIC.pendTxLen  = dlen;
-    LMIC_setTxData_strict();
-    if ( (LMIC.opmode & OP_TXDATA) == 0 ) {
-        if (LMIC.txrxFlags & TXRX_LENERR) {
-            return LMIC_ERROR_TX_NOT_FEASIBLE;
-        } else {
-            // data has already been completed with error for some reason
-            return LMIC_ERROR_TX_FAILED;
-        }
-    }
-    return 0;
+    return startTxData();
 }
 
 // send a message with callback; try to adjust data rate
@@ -2965,6 +3455,394 @@ lmic_tx_error_t LMIC_sendWithCallback_strict (
     return result;
 }
 
+#if LMIC_ENABLE_tx_zerocopy
+// Zero-copy transmit. LMIC.frame doubles as the receive buffer, so the
+// span can only be lent while nothing that writes the frame (join,
+// beacon and ping reception, another uplink, or a receive the radio is
+// running on its own: continuous RX, the RX ring, low-power listening) is
+// pending. The payload is encrypted in place and moved down over the
+// unused FOpts space when the frame is built.
+
+static bit_t isFrameBusy (void) {
+    return LMIC.devaddr == 0 ||
+           (LMIC.opmode & (OP_SCAN|OP_TRACK|OP_PINGINI|OP_JOINING|OP_TXDATA|OP_POLL|OP_TXRXPEND|OP_SHUTDOWN)) != 0 ||
+#if LMIC_TXQUEUE_DEPTH > 0
+           // the next engineUpdate() loads and builds a queued uplink;
+           // txqJob is only ever scheduled with records still queued.
+           LMIC.txqCount != 0 ||
+#endif
+           radio_frameBusy();
+}
+
+//! \brief lend the application the payload area of the next uplink.
+//! \param pMaxLen if not NULL, set to the most bytes that may be written.
+//! \return the buffer, or NULL if the MAC may overwrite it before it's sent,
+//! which includes whenever the transmit queue holds anything.
+//! The span stays valid until LMIC_commitTxBuffer() or any other call that
+//! starts MAC or radio activity; with low-power listening on, that includes
+//! the next pass of the os loop.
+xref2u1_t LMIC_getTxBuffer (u1_t *pMaxLen) {
+    if (isFrameBusy())
+        return NULL;
+    if (pMaxLen != NULL)
+        *pMaxLen = MAX_LEN_FRAME - LMIC_TX_ZEROCOPY_OFFSET - 4;
+    return LMIC.frame + LMIC_TX_ZEROCOPY_OFFSET;
+}
+
+//! \brief send the payload written through LMIC_getTxBuffer(), unconfirmed.
+//! The header, encryption and MIC are done when the frame is built. Since
+//! the payload is not kept anywhere else, the uplink is never repeated,
+//! whatever NbTrans says.
+lmic_tx_error_t LMIC_commitTxBuffer (u1_t port, u1_t dlen, lmic_txmessage_cb_t *pCb, void *pUserData) {
+    if (isFrameBusy())
+        return LMIC_ERROR_TX_BUSY;
+    if (dlen > MAX_LEN_FRAME - LMIC_TX_ZEROCOPY_OFFSET - 4)
+        return LMIC_ERROR_TX_TOO_LARGE;
+
+    adjustDrForFrameIfNotBusy(dlen);
+    LMIC.pendTxConf = 0;
+    LMIC.pendTxPort = port;
+    LMIC.pendTxLen  = dlen;
+    LMIC.pendTxInFrame = 1;
+#if LMIC_ENABLE_user_events
+    LMIC.client.txMessageCb = pCb;
+    LMIC.client.txMessageUserData = pUserData;
+#else
+    LMIC_API_PARAMETER(pCb);
+    LMIC_API_PARAMETER(pUserData);
+#endif
+    return startTxData();
+}
+#endif // LMIC_ENABLE_tx_zerocopy
+
+#if LMIC_ENABLE_tx_gather
+//! \brief send an uplink made of several pieces, without staging them.
+//! The segments are copied into LMIC.frame each time the frame is built,
+//! so `pSegs` and the data it points to must stay unchanged until the
+//! uplink completes (EV_TXCOMPLETE, EV_TXCANCELED or the callback).
+lmic_tx_error_t LMIC_sendSegments (
+    u1_t port, const lmic_txseg_t *pSegs, u1_t nSegs, u1_t confirmed,
+    lmic_txmessage_cb_t *pCb, void *pUserData
+) {
+    unsigned dlen = 0;
+
+    if ( LMIC.opmode & OP_TXDATA ) {
+        return LMIC_ERROR_TX_BUSY;
+    }
+    for (u1_t i = 0; i < nSegs; ++i)
+        dlen += pSegs[i].len;
+    if (dlen > MAX_LEN_PAYLOAD)
+        return LMIC_ERROR_TX_TOO_LARGE;
+
+    adjustDrForFrameIfNotBusy((u1_t) dlen);
+    LMIC.pendTxSegs = pSegs;
+    LMIC.pendTxNSegs = nSegs;
+    LMIC.pendTxConf = confirmed;
+    LMIC.pendTxPort = port;
+    LMIC.pendTxLen  = (u1_t) dlen;
+#if LMIC_ENABLE_user_events
+    LMIC.client.txMessageCb = pCb;
+    LMIC.client.txMessageUserData = pUserData;
+#else
+    LMIC_API_PARAMETER(pCb);
+    LMIC_API_PARAMETER(pUserData);
+#endif
+    return startTxData();
+}
+#endif // LMIC_ENABLE_tx_gather
+
+#if LMIC_TXQUEUE_DEPTH > 0
+// Transmit queue. The MAC still sends one uplink at a time from
+// pendTxData; txqPump() refills it from the queue whenever the MAC is
+// idle, so completion, duty cycle and channel access work as for
+// LMIC_setTxData2().
+
+// remove txqOrder[i], returning its slot to the free part.
+static void txqRemove (u1_t i) {
+    u1_t const slot = LMIC.txqOrder[i];
+
+    for (; i + 1 < LMIC.txqCount; ++i)
+        LMIC.txqOrder[i] = LMIC.txqOrder[i + 1];
+    LMIC.txqOrder[--LMIC.txqCount] = slot;
+}
+
+// claim a slot, behind everything of the same or higher priority.
+static lmic_txqueue_entry_t *txqInsert (u1_t priority) {
+    if (LMIC.txqCount == LMIC_TXQUEUE_DEPTH)
+        return NULL;
+
+    u1_t i = LMIC.txqCount;
+    while (i != 0 && LMIC.txq[LMIC.txqOrder[i - 1]].priority < priority)
+        --i;
+
+    u1_t const slot = LMIC.txqOrder[LMIC.txqCount];
+    for (u1_t j = LMIC.txqCount; j > i; --j)
+        LMIC.txqOrder[j] = LMIC.txqOrder[j - 1];
+    LMIC.txqOrder[i] = slot;
+    ++LMIC.txqCount;
+
+    lmic_txqueue_entry_t * const e = &LMIC.txq[slot];
+    e->priority = priority;
+    return e;
+}
+
+static void txqFail (lmic_txqueue_entry_t const *e) {
+#if LMIC_ENABLE_user_events
+    if (e->pCb != NULL)
+        e->pCb(e->pUserData, 0);
+#else
+    LMIC_API_PARAMETER(e);
+#endif
+}
+
+static void txqLoad (u1_t port, u1_t confirmed, u1_t len) {
+    LMIC.pendTxConf = confirmed;
+    LMIC.pendTxPort = port;
+    LMIC.pendTxLen  = len;
+    LMICOS_logEventUint32("txqLoad", ((u4_t)LMIC.pendTxPort << 24u) | ((u4_t)LMIC.pendTxConf << 16u) | (LMIC.pendTxLen << 0u));
+    LMIC.opmode |= OP_TXDATA;
+    if( (LMIC.opmode & OP_JOINING) == 0 ) {
+        LMIC.txCnt = 0;
+        LMIC.upRepeatCount = 0;
+    }
+}
+
+#if LMIC_ENABLE_tx_aggregation
+// Room for records in an uplink at the current data rate, after the
+// header, port, MIC and whatever FOpts buildDataFrame() may add. The
+// sticky answers are counted even on the uplink that skips them.
+static u1_t aggBudget (void) {
+    int n = LMICbandplan_maxFrameLen(LMIC.datarate) - OFF_DAT_OPTS - 5;
+
+    if (LMIC.pendMacPiggyback)
+        n -= LMIC.pendMacLen;
+#if !defined(DISABLE_MCMD_RXParamSetupReq)
+    if (LMIC.dn2Ans)
+        n -= 2;
+#endif
+#if !defined(DISABLE_MCMD_DlChannelReq)
+    if (LMIC.macDlChannelAns)
+        n -= 2;
+#endif
+#if !defined(DISABLE_MCMD_RXTimingSetupReq)
+    if (LMIC.macRxTimingSetupAns)
+        n -= 1;
+#endif
+#if LMIC_ENABLE_DeviceTimeReq
+    if (LMIC.txDeviceTimeReqState == lmic_RequestTimeState_tx)
+        n -= 1;
+#endif
+#if !defined(DISABLE_BEACONS) && defined(ENABLE_MCMD_BeaconTimingAns)
+    if (LMIC.bcninfoTries > 0)
+        n -= 1;
+#endif
+    if (n < 0)
+        return 0;
+    return n > (int) SIZEOFEXPR(LMIC.pendTxData) ? (u1_t) SIZEOFEXPR(LMIC.pendTxData) : (u1_t) n;
+}
+
+// the record at txqOrder[i] should go now: its deadline has passed, or
+// the records queued for its port would fill an uplink.
+static bit_t aggReady (u1_t i, ostime_t now, u1_t budget) {
+    lmic_txqueue_entry_t const * const e = &LMIC.txq[LMIC.txqOrder[i]];
+    unsigned total = 0;
+
+    if (e->deadline != 0 && (ostime_t)(now - e->deadline) >= 0)
+        return 1;
+    for (; i < LMIC.txqCount; ++i) {
+        lmic_txqueue_entry_t const * const r = &LMIC.txq[LMIC.txqOrder[i]];
+
+        if (! r->record || r->port != e->port)
+            continue;
+        total += 1 + r->len;
+        if (total > budget)
+            return 1;
+    }
+    // not even a one-byte record would fit.
+    return total + 2 > budget;
+}
+
+// pack the record at txqOrder[i], and those after it for the same port
+// that fit, into pendTxData.
+static void aggLoad (u1_t i, u1_t budget) {
+    u1_t const port = LMIC.txq[LMIC.txqOrder[i]].port;
+    u1_t len = 0;
+
+    while (i < LMIC.txqCount) {
+        lmic_txqueue_entry_t const * const r = &LMIC.txq[LMIC.txqOrder[i]];
+
+        if (! r->record || r->port != port) {
+            ++i;
+            continue;
+        }
+        // the first always goes, so that an oversized record can't block
+        // the queue; after that, stop rather than reorder.
+        if (len != 0 && len + 1 + r->len > budget)
+            break;
+        LMIC.pendTxData[len] = r->len;
+        os_copyMem(LMIC.pendTxData + len + 1, r->data, r->len);
+        len += 1 + r->len;
+        txqRemove(i);
+    }
+#if LMIC_ENABLE_user_events
+    LMIC.client.txMessageCb = NULL;
+#endif
+    adjustDrForFrameIfNotBusy(len);
+    txqLoad(port, 0, len);
+}
+
+static void runTxqJob (xref2osjob_t osjob) {
+    LMIC_API_PARAMETER(osjob);
+    engineUpdate();
+}
+#endif // LMIC_ENABLE_tx_aggregation
+
+// called from engineUpdate_inner() with no TX/RX in progress.
+static void txqPump (void) {
+    if ((LMIC.opmode & OP_TXDATA) != 0)
+        return;
+
+    ostime_t const now = os_getTime();
+#if LMIC_ENABLE_tx_aggregation
+    u1_t const budget = aggBudget();
+    ostime_t wake = 0;
+    bit_t fWake = 0;
+
+    os_clearCallback(&LMIC.txqJob);
+#endif
+    u1_t i = 0;
+
+    while (i < LMIC.txqCount) {
+        lmic_txqueue_entry_t * const e = &LMIC.txq[LMIC.txqOrder[i]];
+
+#if LMIC_ENABLE_tx_aggregation
+        if (e->record) {
+            if (aggReady(i, now, budget)) {
+                aggLoad(i, budget);
+                return;
+            }
+            // skip it for now, but come back at its deadline.
+            if (e->deadline != 0 && (! fWake || (ostime_t)(e->deadline - wake) < 0)) {
+                wake = e->deadline;
+                fWake = 1;
+            }
+            ++i;
+            continue;
+        }
+#endif
+
+        // the slot stays intact until the next txqInsert().
+        txqRemove(i);
+        if (e->deadline != 0 && (ostime_t)(now - e->deadline) >= 0) {
+            LMICOS_logEventUint32("txq expired", ((u4_t)e->port << 8u) | e->len);
+            txqFail(e);
+            continue;
+        }
+
+        adjustDrForFrameIfNotBusy(e->len);
+        os_copyMem(LMIC.pendTxData, e->data, e->len);
+#if LMIC_ENABLE_user_events
+        LMIC.client.txMessageCb = e->pCb;
+        LMIC.client.txMessageUserData = e->pUserData;
+#endif
+        txqLoad(e->port, e->confirmed, e->len);
+        return;
+    }
+
+#if LMIC_ENABLE_tx_aggregation
+    if (fWake)
+        os_setTimedCallback(&LMIC.txqJob, wake, FUNC_ADDR(runTxqJob));
+#endif
+}
+
+//! \brief queue an uplink, to be sent when the MAC is free.
+//! \param priority higher values are sent first.
+//! \param deadline drop the message if it hasn't been started by this time; 0 for never.
+//! \return 0, LMIC_ERROR_TX_BUSY if the queue is full, or LMIC_ERROR_TX_TOO_LARGE.
+lmic_tx_error_t LMIC_queueTxWithCallback (
+    u1_t port, xref2cu1_t data, u1_t dlen, u1_t confirmed,
+    u1_t priority, ostime_t deadline,
+    lmic_txmessage_cb_t *pCb, void *pUserData
+) {
+    if (dlen > LMIC_TXQUEUE_MAXLEN || dlen > SIZEOFEXPR(LMIC.pendTxData))
+        return LMIC_ERROR_TX_TOO_LARGE;
+
+    lmic_txqueue_entry_t * const e = txqInsert(priority);
+    if (e == NULL)
+        return LMIC_ERROR_TX_BUSY;
+
+    e->deadline = deadline;
+#if LMIC_ENABLE_user_events
+    e->pCb = pCb;
+    e->pUserData = pUserData;
+#else
+    LMIC_API_PARAMETER(pCb);
+    LMIC_API_PARAMETER(pUserData);
+#endif
+    e->port = port;
+    e->confirmed = confirmed;
+#if LMIC_ENABLE_tx_aggregation
+    e->record = 0;
+#endif
+    e->len = dlen;
+    if (data != NULL)
+        os_copyMem(e->data, data, dlen);
+
+    engineUpdate();
+    return 0;
+}
+
+lmic_tx_error_t LMIC_queueTx (u1_t port, xref2cu1_t data, u1_t dlen, u1_t confirmed, u1_t priority, ostime_t deadline) {
+    return LMIC_queueTxWithCallback(port, data, dlen, confirmed, priority, deadline, NULL, NULL);
+}
+
+#if LMIC_ENABLE_tx_aggregation
+//! \brief queue a record, to be sent unconfirmed with other records for the same port.
+//! \param deadline send no later than this (duty cycle permitting); 0 to wait for a full uplink.
+//! \return 0, LMIC_ERROR_TX_BUSY if the queue is full, or LMIC_ERROR_TX_TOO_LARGE.
+lmic_tx_error_t LMIC_queueRecord (u1_t port, xref2cu1_t data, u1_t dlen, u1_t priority, ostime_t deadline) {
+    if (dlen > LMIC_TXQUEUE_MAXLEN || dlen >= SIZEOFEXPR(LMIC.pendTxData))
+        return LMIC_ERROR_TX_TOO_LARGE;
+
+    lmic_txqueue_entry_t * const e = txqInsert(priority);
+    if (e == NULL)
+        return LMIC_ERROR_TX_BUSY;
+
+    e->deadline = deadline;
+#if LMIC_ENABLE_user_events
+    e->pCb = NULL;
+    e->pUserData = NULL;
+#endif
+    e->port = port;
+    e->confirmed = 0;
+    e->record = 1;
+    e->len = dlen;
+    if (data != NULL)
+        os_copyMem(e->data, data, dlen);
+
+    engineUpdate();
+    return 0;
+}
+#endif // LMIC_ENABLE_tx_aggregation
+
+u1_t LMIC_getTxQueueCount (void) {
+    return LMIC.txqCount;
+}
+
+// drop everything still queued; the message already in the MAC, if any,
+// is not affected (see LMIC_clrTxData()).
+void LMIC_clearTxQueue (void) {
+#if LMIC_ENABLE_tx_aggregation
+    os_clearCallback(&LMIC.txqJob);
+#endif
+    while (LMIC.txqCount != 0) {
+        lmic_txqueue_entry_t const * const e = &LMIC.txq[LMIC.txqOrder[0]];
+        txqRemove(0);
+        txqFail(e);
+    }
+}
+#endif // LMIC_TXQUEUE_DEPTH > 0
+
 
 // Send a payload-less message to signal device is alive
 void LMIC_sendAlive (void) {
@@ -3101,3 +3979,12 @@ int LMIC_getNetworkTimeReference(lmic_time_reference_t *pReference) {
 #endif // LMIC_ENABLE_DeviceTimeReq
     return 0;
 }
+
+#if LMIC_CSMA_LEVEL > 0
+// \brief return the expected delay that channel access adds to a TX.
+// This is a running average of the delays seen on recent uplinks, or 0 if
+// CSMA is off. Useful for scheduling uplinks around other deadlines.
+ostime_t LMIC_getExpectedAccessDelay(void) {
+    return LMIC.sysname_enable_cad ? LMIC.sysname_cad_access_avg : 0;
+}
+#endif
@@ -226,7 +226,7 @@ struct bcninfo_t {
 #endif // !DISABLE_BEACONS
 
 // purpose of receive window - lmic_t.rxState
-enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3, RADIO_TX_AT=4, };
+enum { RADIO_RST=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3, RADIO_TX_AT=4, RADIO_RXON_RING=5, };
 // Netid values /  lmic_t.netid
 enum { NETID_NONE=(int)~0U, NETID_MASK=(int)0xFFFFFF };
 // MAC operation modes (lmic_t.opmode).
@@ -258,6 +258,20 @@ enum { TXRX_ACK    = 0x80,   // confirmed UP frame was acked
        TXRX_DNW1   = 0x01,   // received in 1st DN slot
 };
 
+#if LMIC_CSMA_LEVEL > 0
+// What to do when CSMA runs out of time or attempts (LMIC.sysname_cad_fallback)
+enum { SYSNAME_CAD_FALLBACK_TX      = 0,    // transmit anyway
+       SYSNAME_CAD_FALLBACK_DROP    = 1,    // drop the uplink; txMessageCb() gets fSuccess == 0
+       SYSNAME_CAD_FALLBACK_REQUEUE = 2,    // retry after LMIC.sysname_cad_requeue
+};
+// Outcome of the last channel access (LMIC.sysname_cad_result)
+enum { SYSNAME_CAD_CLEAR    = 0,    // channel was clear
+       SYSNAME_CAD_FORCED   = 1,    // gave up, transmitted anyway
+       SYSNAME_CAD_DROPPED  = 2,    // gave up, uplink dropped
+       SYSNAME_CAD_REQUEUED = 3,    // gave up, uplink requeued
+};
+#endif
+
 // Event types for event callback
 enum _ev_t { EV_SCAN_TIMEOUT=1, EV_BEACON_FOUND,
              EV_BEACON_MISSED, EV_BEACON_TRACKED, EV_JOINING,
@@ -438,6 +452,45 @@ struct lmic_client_data_s {
     /* none at the moment */
 };
 
+#if LMIC_ENABLE_spi_stats
+/*
+
+Structure:  lmic_spi_stats_t
+
+Function:
+    SPI traffic charged to one phase of radio operation.
+
+Description:
+    hal_spi_write() and hal_spi_read() add each transaction to the entry
+    for LMIC.radio.spi_phase, which radio.c sets around the code that
+    makes up each phase. `bytes` includes the address byte; `us` is the
+    time the HAL held NSS low, so it includes its per-transaction
+    overhead. Retrieve with LMIC_getSpiStats().
+
+*/
+
+typedef struct lmic_spi_stats_s lmic_spi_stats_t;
+
+struct lmic_spi_stats_s {
+    u4_t    transactions;
+    u4_t    bytes;
+    u4_t    us;         // can overflow!
+};
+#endif // LMIC_ENABLE_spi_stats
+
+// phases for lmic_spi_stats_t; radio.c tags its code with these even
+// when the counters are compiled out.
+enum lmic_spi_phase_e {
+    LMIC_SPI_PHASE_OTHER,       // radio init, RX setup, anything untagged
+    LMIC_SPI_PHASE_TXSETUP,     // starttx() up to the FIFO download
+    LMIC_SPI_PHASE_TXFIFO,      // writing the frame to the FIFO
+    LMIC_SPI_PHASE_CAD,         // CAD rounds for channel access
+    LMIC_SPI_PHASE_RSSI,        // radio_monitor_rssi()
+    LMIC_SPI_PHASE_IRQ,         // radio_irq_handler_v2()
+    LMIC_SPI_PHASE_SLEEP,       // opmode(OPMODE_SLEEP)
+    LMIC_SPI_PHASE_COUNT
+};
+
 /*
 
 Structure:  lmic_radio_data_t
@@ -462,8 +515,176 @@ struct lmic_radio_data_s {
     ostime_t    txlate_ticks;
     // number of tx late launches.
     unsigned    txlate_count;
+    // number of timed tx launches where the HAL slept instead of spinning.
+    unsigned    txsleep_count;
+    // number of received frames dropped early because they were for another DevAddr.
+    unsigned    rxfilter_count;
+    // number of frames lost because the receive ring was full.
+    unsigned    rxring_overrun;
+    // total os ticks spent in radio_irq_handler_v2(). Can overflow!
+    ostime_t    irq_ticks;
+    // number of radio interrupts handled.
+    unsigned    irq_count;
+#if LMIC_ENABLE_spi_stats
+    // SPI traffic per phase, and the phase now being charged.
+    lmic_spi_stats_t spi[LMIC_SPI_PHASE_COUNT];
+    u1_t        spi_phase;
+#endif
 };
 
+#if LMIC_ENABLE_rx_calibration
+/*
+
+Structure:  lmic_rxcal_t
+
+Function:
+    Running estimate of Class A downlink arrival time for one SF/BW.
+
+Description:
+    `offset` is the smoothed difference between the observed start of a
+    received downlink and the nominal window time, both in our clock.
+    `spread` is the smoothed absolute deviation around that. Once `n`
+    reaches LMIC_RXCAL_MIN_SAMPLES, schedRx12() uses these in place of the
+    static margin and clock-error drift.
+
+*/
+
+typedef struct lmic_rxcal_s lmic_rxcal_t;
+
+struct lmic_rxcal_s {
+    s2_t    offset;     // ticks; negative means the frame came early
+    u2_t    spread;     // ticks
+    u1_t    n;          // samples taken, saturates
+};
+
+enum { LMIC_RXCAL_MIN_SAMPLES = 8 };
+#endif // LMIC_ENABLE_rx_calibration
+
+#if LMIC_ENABLE_tx_power_control
+// device-side TX power control; see tpcUpdate() in lmic.c.
+enum {
+    LMIC_TPC_TARGET_MARGIN_DB = 10, // uplink margin to keep, dB
+    LMIC_TPC_STEP_DB = 2,           // power change per step
+    LMIC_TPC_MAX_BACKOFF_DB = 16,   // never more than this below ADR power
+    LMIC_TPC_MIN_SAMPLES = 2,       // margin samples before stepping down
+    LMIC_TPC_DOWNLINK_BIAS_DB = 10, // gateway TX power above ours, roughly
+};
+#endif // LMIC_ENABLE_tx_power_control
+
+#if LMIC_ENABLE_tx_gather
+// one piece of an uplink for LMIC_sendSegments().
+typedef struct lmic_txseg_s lmic_txseg_t;
+
+struct lmic_txseg_s {
+    const u1_t  *pData;
+    u1_t        len;
+};
+#endif // LMIC_ENABLE_tx_gather
+
+#if LMIC_RXRING_DEPTH > 0
+/*
+
+Structure:  lmic_rxring_entry_t
+
+Function:
+    One frame captured by continuous receive (RADIO_RXON_RING).
+
+Description:
+    The metadata is what radio_irq_handler_v2() would have left in
+    LMIC.rxtime, LMIC.rssi, LMIC.snr and LMIC.sysname_crc_err for this
+    frame. `lost` counts frames dropped for lack of space just before this
+    one (saturating); LMIC.radio.rxring_overrun has the running total.
+
+*/
+
+typedef struct lmic_rxring_entry_s lmic_rxring_entry_t;
+
+struct lmic_rxring_entry_s {
+    ostime_t    rxtime;
+    s1_t        rssi;
+    s1_t        snr;
+    u1_t        crc_err;
+    u1_t        lost;
+    u1_t        len;
+    u1_t        frame[MAX_LEN_FRAME];
+};
+#endif // LMIC_RXRING_DEPTH > 0
+
+#if LMIC_RXQUEUE_DEPTH > 0
+/*
+
+Structure:  lmic_rxqueue_entry_t
+
+Function:
+    One application downlink held in the receive queue.
+
+Description:
+    Filled in when the MAC reports the downlink (EV_TXCOMPLETE or
+    EV_RXCOMPLETE), from the same state the rx-message callback sees.
+    `txrxFlags` tells the window (TXRX_DNW1, TXRX_DNW2 or TXRX_PING) and
+    whether there was a port (TXRX_PORT). `lost` counts downlinks dropped
+    just before this one because the queue was full or they were too long
+    (saturating).
+
+*/
+
+typedef struct lmic_rxqueue_entry_s lmic_rxqueue_entry_t;
+
+struct lmic_rxqueue_entry_s {
+    ostime_t    rxtime;     // end of reception
+    u4_t        seqnoDn;    // frame counter of the downlink
+    s2_t        rssi;       // dBm
+    s1_t        snr;        // in units of 0.25 dB
+    u1_t        txrxFlags;
+    u1_t        port;
+    u1_t        lost;
+    u1_t        len;
+    u1_t        data[LMIC_RXQUEUE_MAXLEN];
+};
+#endif // LMIC_RXQUEUE_DEPTH > 0
+
+#if LMIC_TXQUEUE_DEPTH > 0
+/*
+
+Structure:  lmic_txqueue_entry_t
+
+Function:
+    One uplink, or one record, waiting in the transmit queue; see
+    LMIC_queueTx() and LMIC_queueRecord().
+
+Description:
+    Entries go to the MAC highest `priority` first, and in order of
+    submission within a priority. A message still queued when `deadline`
+    passes is dropped, and its callback is called with fSuccess == 0.
+
+    Records wait until enough of them are queued for their port to fill
+    an uplink at the current data rate, or until the `deadline` of the
+    oldest passes. They are then sent together, each as a length byte
+    followed by the record.
+
+    `deadline` == 0 means no deadline.
+
+*/
+
+typedef struct lmic_txqueue_entry_s lmic_txqueue_entry_t;
+
+struct lmic_txqueue_entry_s {
+    ostime_t    deadline;
+#if LMIC_ENABLE_user_events
+    lmic_txmessage_cb_t *pCb;
+    void        *pUserData;
+#endif
+    u1_t        port;
+    u1_t        confirmed;
+    u1_t        priority;
+#if LMIC_ENABLE_tx_aggregation
+    u1_t        record;
+#endif
+    u1_t        len;
+    u1_t        data[LMIC_TXQUEUE_MAXLEN];
+};
+#endif // LMIC_TXQUEUE_DEPTH > 0
+
 /*
 
 Structure:  lmic_t
@@ -514,6 +735,12 @@ struct lmic_t {
     ostime_t    bcnRxtime;
 #endif
 
+#if LMIC_ENABLE_rx_calibration
+    ostime_t    rxcalNominal;   // nominal (uncorrected) time of the current RX1/RX2 window
+    unsigned    rxcalLate;      // radio.rxlate_count when that window was scheduled
+    lmic_rxcal_t rxcal[SF12][BW500+1];  // indexed by [sf-SF7][bw]
+#endif
+
 #if LMIC_ENABLE_DeviceTimeReq
     // put here for alignment, to reduce RAM use.
     ostime_t    localDeviceTime;    // the LMIC.txend value for last DeviceTimeAns
@@ -558,6 +785,39 @@ struct lmic_t {
     u4_t        sysname_cad_freq_vec[4];
 
     rps_t       sysname_cad_rps;
+
+// Virtual carrier sense: on CadDetected, capture the LoRa header and
+// defer until the overheard frame ends (+ up to sysname_vcs_jitter ms).
+    u1_t        sysname_use_vcs;
+    u1_t        sysname_vcs_jitter;
+    u4_t        sysname_vcs_counter;        // headers captured
+    ostime_t    sysname_vcs_defer;          // last deferral, in ticks
+
+// Per-SF CAD detector overrides, indexed by sf_t (0 == use the driver table),
+// the set of SFs to cycle through during a DIFS (bit 1<<sf; 0 == just
+// sysname_cad_rps), and the false-alarm counts from LMIC_calibrateCad().
+    u1_t        sysname_cad_detopt[SF12+1];
+    u1_t        sysname_cad_detthr[SF12+1];
+    u1_t        sysname_cad_sfmask;
+    u2_t        sysname_cad_fa[SF12+1];
+
+// Bounded channel access: give up after sysname_cad_maxdelay ticks or
+// sysname_cad_maxtries busy senses (0 == no limit), then apply
+// sysname_cad_fallback. The outcome is left in sysname_cad_result.
+    ostime_t    sysname_cad_maxdelay;
+    ostime_t    sysname_cad_requeue;
+    u1_t        sysname_cad_maxtries;
+    u1_t        sysname_cad_fallback;
+    u1_t        sysname_cad_result;
+    u1_t        sysname_cad_tries;
+
+// CSMA timing seen by the MAC: the latest time channel access may start
+// the TX (0 == none; set by the MAC for beacon and ping slots, and only
+// applied while its uplink is pending, OP_TXRXPEND), the delay
+// channel access added to the last TX, and its running average.
+    ostime_t    sysname_cad_deadline;
+    ostime_t    sysname_cad_access;
+    ostime_t    sysname_cad_access_avg;
 #endif
     rps_t       sysname_tx_rps;
     u1_t        sysname_crc_err;
@@ -571,6 +831,41 @@ struct lmic_t {
     u1_t sysname_btone_difs;
 #endif
 
+#if SYSNAME_BTONE_COORD == 1
+// Busy-tone coordinator; see LMIC_startBusyTone().
+    osjob_t     sysname_btone_job;          // schedules the next tone
+    ostime_t    sysname_btone_next;         // exact start of the next tone
+    ostime_t    sysname_btone_period;       // tone period in ticks
+    ostime_t    sysname_btone_dur;          // tone duration in ticks
+    u4_t        sysname_btone_coord_freq;   // tone frequency
+    u4_t        sysname_btone_sent;         // tones emitted
+    u4_t        sysname_btone_skipped;      // tones skipped because the radio was busy
+    rps_t       sysname_btone_coord_rps;    // tone SF/BW
+    u1_t        sysname_btone_coord_on;
+#endif
+
+#if SYSNAME_LPL == 1
+// Low-power listening; see LMIC_startSniff(). Radio-on and elapsed time
+// are halved together when elapsed gets large, so the duty cycle is a
+// long-run average that never overflows.
+    osjob_t     sysname_lpl_job;            // next wake-up, or RX completion
+    osjobcb_t   sysname_lpl_rxfn;           // called for each frame received
+    ostime_t    sysname_lpl_next;           // time of the next wake-up
+    ostime_t    sysname_lpl_interval;       // sniff interval in ticks
+    ostime_t    sysname_lpl_wake;           // start of the current wake-up
+    ostime_t    sysname_lpl_mark;           // last duty-cycle accounting time
+    u4_t        sysname_lpl_ontime;         // radio-on ticks
+    u4_t        sysname_lpl_elapsed;        // ticks accounted
+    u4_t        sysname_lpl_freq;           // sniff frequency
+    u4_t        sysname_lpl_wakeups;        // CADs run
+    u4_t        sysname_lpl_detects;        // CADs that saw a preamble
+    u4_t        sysname_lpl_frames;         // frames received
+    u4_t        sysname_lpl_skipped;        // wake-ups skipped because the radio was busy
+    rps_t       sysname_lpl_rps;            // sniff SF/BW
+    u1_t        sysname_lpl_rxsyms;         // RX symbol timeout after a detect
+    u1_t        sysname_lpl_on;
+#endif
+
     /* (u)int16_t things */
     rps_t       rps;            // radio parameter selections: SF, BW, CodingRate, NoCrc, implicit hdr
     u2_t        opmode;         // engineUpdate() operating mode flags
@@ -604,6 +899,11 @@ struct lmic_t {
 
     u1_t        upRepeat;     // configured up repeat
     s1_t        adrTxPow;     // ADR adjusted TX power
+#if LMIC_ENABLE_tx_power_control
+    s1_t        tpcOffset;    // dB the power controller adds to adrTxPow (<= 0)
+    s1_t        tpcHeadroom;  // smoothed uplink margin at ADR power, dB
+    u1_t        tpcSamples;   // margin samples since the last reset (saturates)
+#endif
     u1_t        datarate;     // current data rate
     u1_t        errcr;        // error coding rate (used for TX only)
     u1_t        rejoinCnt;    // adjustment for rejoin datarate
@@ -614,7 +914,35 @@ struct lmic_t {
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
     u1_t        pendTxLen;    // count of bytes in pendTxData.
+#if LMIC_PENDTXDATA_SIZE > 0
+    u1_t        pendTxData[LMIC_PENDTXDATA_SIZE];
+#else
     u1_t        pendTxData[MAX_LEN_PAYLOAD];
+#endif
+#if LMIC_RXQUEUE_DEPTH > 0
+    u1_t        rxqHead;        // next slot to fill
+    u1_t        rxqCount;       // slots in use
+    u1_t        rxqLost;        // downlinks dropped since the last push
+    lmic_rxqueue_entry_t rxq[LMIC_RXQUEUE_DEPTH];
+#endif
+#if LMIC_ENABLE_tx_gather
+    const lmic_txseg_t *pendTxSegs; // if pendTxNSegs != 0, the payload, instead of pendTxData
+    u1_t        pendTxNSegs;
+#endif
+#if LMIC_ENABLE_tx_zerocopy
+    bit_t       pendTxInFrame;  // payload is in LMIC.frame, not pendTxData, until the uplink is sent
+#endif
+
+#if LMIC_TXQUEUE_DEPTH > 0
+    // txqOrder[] is a permutation of the slots: the first txqCount are
+    // queued, next to send first; the rest are free.
+    u1_t        txqCount;
+    u1_t        txqOrder[LMIC_TXQUEUE_DEPTH];
+    lmic_txqueue_entry_t txq[LMIC_TXQUEUE_DEPTH];
+#if LMIC_ENABLE_tx_aggregation
+    osjob_t     txqJob;         // wakes the MAC at the next record deadline
+#endif
+#endif
 
     u1_t        pendMacLen;         // number of bytes of pending Mac response data
     bit_t       pendMacPiggyback;   // received on port 0 or piggyback?
@@ -737,6 +1065,62 @@ int LMIC_getNetworkTimeReference(lmic_time_reference_t *pReference);
 int LMIC_registerRxMessageCb(lmic_rxmessage_cb_t *pRxMessageCb, void *pUserData);
 int LMIC_registerEventCb(lmic_event_cb_t *pEventCb, void *pUserData);
 
+#if LMIC_CSMA_LEVEL > 0
+u2_t LMIC_calibrateCad(u2_t nCad);
+ostime_t LMIC_getExpectedAccessDelay(void);
+#endif
+
+bit_t LMIC_setRawImplicitHeader(u1_t len);
+
+#if LMIC_ENABLE_spi_stats
+void LMIC_getSpiStats(lmic_spi_stats_t pStats[LMIC_SPI_PHASE_COUNT]);
+void LMIC_clearSpiStats(void);
+#endif
+
+#if LMIC_RXQUEUE_DEPTH > 0
+lmic_rxqueue_entry_t const *LMIC_rxQueuePeek(void);
+void LMIC_rxQueuePop(void);
+#endif
+
+#if LMIC_ENABLE_tx_gather
+lmic_tx_error_t LMIC_sendSegments(u1_t port, const lmic_txseg_t *pSegs, u1_t nSegs, u1_t confirmed, lmic_txmessage_cb_t *pCb, void *pUserData);
+#endif
+
+#if LMIC_ENABLE_tx_zerocopy
+// the payload written through LMIC_getTxBuffer() starts here in LMIC.frame:
+// after the header, the largest FOpts buildDataFrame() allows, and FPort.
+enum { LMIC_TX_ZEROCOPY_OFFSET = OFF_DAT_OPTS + 16 + 1 };
+xref2u1_t LMIC_getTxBuffer(u1_t *pMaxLen);
+lmic_tx_error_t LMIC_commitTxBuffer(u1_t port, u1_t dlen, lmic_txmessage_cb_t *pCb, void *pUserData);
+#endif
+
+#if LMIC_TXQUEUE_DEPTH > 0
+lmic_tx_error_t LMIC_queueTx(u1_t port, xref2cu1_t data, u1_t dlen, u1_t confirmed, u1_t priority, ostime_t expires);
+lmic_tx_error_t LMIC_queueTxWithCallback(u1_t port, xref2cu1_t data, u1_t dlen, u1_t confirmed, u1_t priority, ostime_t expires, lmic_txmessage_cb_t *pCb, void *pUserData);
+u1_t LMIC_getTxQueueCount(void);
+void LMIC_clearTxQueue(void);
+#endif
+
+#if LMIC_ENABLE_tx_aggregation
+lmic_tx_error_t LMIC_queueRecord(u1_t port, xref2cu1_t data, u1_t dlen, u1_t priority, ostime_t deadline);
+#endif
+
+#if LMIC_RXRING_DEPTH > 0
+lmic_rxring_entry_t const *LMIC_rxRingPeek(void);
+void LMIC_rxRingPop(void);
+#endif
+
+#if SYSNAME_BTONE_COORD == 1
+void LMIC_startBusyTone(u4_t freq, rps_t rps, ostime_t start, ostime_t period, ostime_t duration);
+void LMIC_stopBusyTone(void);
+#endif
+
+#if SYSNAME_LPL == 1
+void LMIC_startSniff(u4_t freq, rps_t rps, ostime_t interval, osjobcb_t rxfn);
+void LMIC_stopSniff(void);
+u2_t LMIC_getSniffDutyCycle(void);
+#endif
+
 // APIs for client half of compliance.
 typedef u1_t lmic_compliance_rx_action_t;
 
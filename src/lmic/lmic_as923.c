@@ -192,7 +192,7 @@ void LMICas923_initDefaultChannels(bit_t join) {
 
         LMIC.bands[BAND_CENTI].txcap = AS923_TX_CAP;
         LMIC.bands[BAND_CENTI].txpow = AS923_TX_EIRP_MAX_DBM;
-        LMIC.bands[BAND_CENTI].lastchnl = os_getRndU1() % MAX_CHANNELS;
+        LMIC.bands[BAND_CENTI].lastchnl = os_getFastRndU1() % MAX_CHANNELS;
         LMIC.bands[BAND_CENTI].avail = os_getTime();
 }
 
@@ -222,7 +222,7 @@ bit_t LMIC_setupBand(u1_t bandidx, s1_t txpow, u2_t txcap) {
         b->txpow = txpow;
         b->txcap = txcap;
         b->avail = os_getTime();
-        b->lastchnl = os_getRndU1() % MAX_CHANNELS;
+        b->lastchnl = os_getFastRndU1() % MAX_CHANNELS;
         return 1;
 }
 
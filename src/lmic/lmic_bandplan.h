@@ -134,6 +134,10 @@
 # error "LMICbandplan_updateTx() not defined by bandplan"
 #endif
 
+#if !defined(LMICbandplan_delayTx)
+# error "LMICbandplan_delayTx() not defined by bandplan"
+#endif
+
 #if !defined(LMICbandplan_nextJoinState)
 # error "LMICbandplan_nextJoinState() not defined by bandplan"
 #endif
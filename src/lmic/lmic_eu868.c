@@ -126,7 +126,7 @@ bit_t LMIC_setupBand(u1_t bandidx, s1_t txpow, u2_t txcap) {
         b->txpow = txpow;
         b->txcap = txcap;
         b->avail = os_getTime();
-        b->lastchnl = os_getRndU1() % MAX_CHANNELS;
+        b->lastchnl = os_getFastRndU1() % MAX_CHANNELS;
         return 1;
 }
 
@@ -128,7 +128,7 @@ void LMICeulike_initJoinLoop(uint8_t nDefaultChannels, s1_t adrTxPow) {
 #if CFG_TxContinuousMode
         LMIC.txChnl = 0
 #else
-        LMIC.txChnl = os_getRndU1() % nDefaultChannels;
+        LMIC.txChnl = os_getFastRndU1() % nDefaultChannels;
 #endif
         LMIC.adrTxPow = adrTxPow;
         // TODO(tmm@mcci.com) don't use EU directly, use a table. That
@@ -153,6 +153,16 @@ void LMICeulike_updateTx(ostime_t txbeg) {
                 LMIC.globalDutyAvail = txbeg + (airtime << LMIC.globalDutyRate);
 }
 
+// the last TX started `delay` ticks after the time given to updateTx();
+// move the band and global availability back to match.
+void LMICeulike_delayTx(ostime_t delay) {
+        xref2band_t band = &LMIC.bands[LMIC.channelFreq[LMIC.txChnl] & 0x3];
+
+        band->avail += delay;
+        if (LMIC.globalDutyRate != 0)
+                LMIC.globalDutyAvail += delay;
+}
+
 #if !defined(DISABLE_JOIN)
 //
 // TODO(tmm@mcci.com):
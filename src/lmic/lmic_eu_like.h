@@ -86,6 +86,9 @@ void LMICeulike_initJoinLoop(u1_t nDefaultChannels, s1_t adrTxPow);
 void LMICeulike_updateTx(ostime_t txbeg);
 #define LMICbandplan_updateTx(t)        LMICeulike_updateTx(t)
 
+void LMICeulike_delayTx(ostime_t delay);
+#define LMICbandplan_delayTx(d)         LMICeulike_delayTx(d)
+
 ostime_t LMICeulike_nextJoinState(uint8_t nDefaultChannels);
 
 static inline ostime_t LMICeulike_nextJoinTime(ostime_t now) {
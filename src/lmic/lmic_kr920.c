@@ -115,7 +115,7 @@ void LMICkr920_initDefaultChannels(bit_t join) {
 
         LMIC.bands[BAND_MILLI].txcap = 1;  // no limit, in effect.
         LMIC.bands[BAND_MILLI].txpow = KR920_TX_EIRP_MAX_DBM;
-        LMIC.bands[BAND_MILLI].lastchnl = os_getRndU1() % MAX_CHANNELS;
+        LMIC.bands[BAND_MILLI].lastchnl = os_getFastRndU1() % MAX_CHANNELS;
         LMIC.bands[BAND_MILLI].avail = os_getTime();
 }
 
@@ -141,7 +141,7 @@ bit_t LMIC_setupBand(u1_t bandidx, s1_t txpow, u2_t txcap) {
         b->txpow = txpow;
         b->txcap = txcap;
         b->avail = os_getTime();
-        b->lastchnl = os_getRndU1() % MAX_CHANNELS;
+        b->lastchnl = os_getFastRndU1() % MAX_CHANNELS;
         return 1;
 }
 
@@ -57,7 +57,7 @@ static void setNextChannel(uint start, uint end, uint count) {
                 }
         }
 
-        uint nth = os_getRndU1() % count;
+        uint nth = os_getFastRndU1() % count;
         for (u1_t chnl = start; chnl<end; chnl++) {
                 // Scan for nth enabled channel that is not the last channel used
                 if (chnl != lastTxChan && ENABLED_CHANNEL(chnl) && (nth--) == 0) {
@@ -89,6 +89,10 @@ bit_t LMICuslike_mapChannels(u1_t chpage, u2_t chmap);
 ostime_t LMICuslike_nextTx(ostime_t now);
 #define LMICbandplan_nextTx(now)        LMICuslike_nextTx(now)
 
+// no sub-bands; only the global duty cycle depends on the TX start.
+#define LMICbandplan_delayTx(d)         \
+        do { if (LMIC.globalDutyRate != 0) LMIC.globalDutyAvail += (d); } while (0)
+
 ostime_t LMICuslike_nextJoinState(void);
 #define LMICbandplan_nextJoinState()    LMICuslike_nextJoinState();
 
@@ -657,6 +657,23 @@ static inline dr_t  lowerDR  (dr_t dr, u1_t n) { while(n--){dr=decDR(dr);} retur
 
 // Calculate airtime
 ostime_t calcAirTime (rps_t rps, u1_t plen);
+
+// LoRa time on air in microseconds, with the 8-symbol preamble
+// calcAirTime() assumes, as a constant expression for sizing schedules
+// at compile time. sf is 7..12, bwkhz 125/250/500, cr 1..4 (4/5..4/8),
+// ih and crc are 0 or 1, plen is the payload length.
+#define LMIC_LORA_DE_(sf, bwkhz)        (((sf) >= 11 && (bwkhz) == 125) ? 1 : 0)
+#define LMIC_LORA_PLNUM_(sf, ih, crc, plen) \
+        (8 * (plen) - 4 * (sf) + 28 + 16 * (crc) - 20 * (ih))
+#define LMIC_LORA_PLDEN_(sf, bwkhz)     (4 * ((sf) - 2 * LMIC_LORA_DE_(sf, bwkhz)))
+#define LMIC_LORA_PLSYMS_(sf, bwkhz, cr, ih, crc, plen)                   \
+        (LMIC_LORA_PLNUM_(sf, ih, crc, plen) > 0                          \
+            ? (LMIC_LORA_PLNUM_(sf, ih, crc, plen) + LMIC_LORA_PLDEN_(sf, bwkhz) - 1) \
+                / LMIC_LORA_PLDEN_(sf, bwkhz) * ((cr) + 4)                \
+            : 0)
+#define LMIC_LORA_AIRTIME_US(sf, bwkhz, cr, ih, crc, plen)                \
+        ((((u4_t)49 + 4 * (8 + LMIC_LORA_PLSYMS_(sf, bwkhz, cr, ih, crc, plen))) << (sf)) \
+            * 250 / (bwkhz))
 // Sensitivity at given SF/BW
 int getSensitivity (rps_t rps);
 
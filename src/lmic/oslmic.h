@@ -59,6 +59,7 @@ LMIC_BEGIN_DECLS
 
 #define os_clearMem(a,b)   memset(a,0,b)
 #define os_copyMem(a,b,c)  memcpy(a,b,c)
+#define os_moveMem(a,b,c)  memmove(a,b,c)
 
 typedef     struct osjob_t osjob_t;
 typedef      struct band_t band_t;
@@ -94,6 +95,8 @@ extern u4_t AESKEY[];
 
 u1_t radio_rand1 (void);
 #define os_getRndU1() radio_rand1()
+u1_t radio_fastrand1 (void);
+#define os_getFastRndU1() radio_fastrand1()
 
 #define DEFINE_LMIC  struct lmic_t LMIC
 #define DECLARE_LMIC extern struct lmic_t LMIC
@@ -116,6 +119,7 @@ void os_runloop (void);
 void os_runloop_once (void);
 u1_t radio_rssi (void);
 void radio_monitor_rssi(ostime_t n, oslmic_radio_rssi_t *pRssi);
+bit_t radio_frameBusy (void);
 
 //================================================================================
 
@@ -246,6 +250,11 @@ void os_wlsbf2 (xref2u1_t buf, u2_t value);
 #ifndef os_getRndU2
 #define os_getRndU2() ((u2_t)((os_getRndU1()<<8)|os_getRndU1()))
 #endif
+//! Get fast non-cryptographic random number, for back-off and channel draws.
+//! Use os_getRndU1()/os_getRndU2() for anything security-relevant.
+#ifndef os_getFastRndU2
+#define os_getFastRndU2() ((u2_t)((os_getFastRndU1()<<8)|os_getFastRndU1()))
+#endif
 #ifndef os_crc16
 u2_t os_crc16 (xref2cu1_t d, uint len);
 #endif
@@ -302,6 +311,10 @@ u2_t os_crc16 (xref2cu1_t d, uint len);
     typedef int check_sizeof_ostime_t[(sizeof(ostime_t) == 4) ? 0 : -1];
     TABLE_GETTER(_ostime, ostime_t, dword);
 
+    // copy a whole element, e.g. a struct, out of progmem.
+    #define TABLE_GET_STRUCT(table, index, pDest) \
+        memcpy_P((pDest), &RESOLVE_TABLE(table)[index], sizeof(*(pDest)))
+
     // For AVR, store constants in PROGMEM, saving on RAM usage
     #define CONST_TABLE(type, name) const type PROGMEM RESOLVE_TABLE(name)
 #else
@@ -312,6 +325,7 @@ u2_t os_crc16 (xref2cu1_t d, uint len);
     static inline u4_t table_get_u4(const u4_t *table, size_t index) { return table[index]; }
     static inline s4_t table_get_s4(const s4_t *table, size_t index) { return table[index]; }
     static inline ostime_t table_get_ostime(const ostime_t *table, size_t index) { return table[index]; }
+    #define TABLE_GET_STRUCT(table, index, pDest) (*(pDest) = RESOLVE_TABLE(table)[index])
 
     // Declare a table
     #define CONST_TABLE(type, name) const type RESOLVE_TABLE(name)
@@ -347,6 +347,7 @@
 #define MAP_DIO2_LORA_NOP      0x0C  // ----11--
 
 #define MAP_DIO0_FSK_READY     0x00  // 00------ (packet sent / payload ready)
+#define MAP_DIO1_FSK_FIFOLEVEL 0x00  // --00----
 #define MAP_DIO1_FSK_NOP       0x30  // --11----
 #define MAP_DIO2_FSK_TXNOP     0x04  // ----01--
 #define MAP_DIO2_FSK_TIMEOUT   0x08  // ----10--
@@ -377,6 +378,21 @@
 // (initialized by radio_init(), used by radio_rand1())
 static u1_t randbuf[16];
 
+// Fast, non-cryptographic generator (xoshiro128**) for back-off and
+// channel draws. Seeded from randbuf at init; once FASTRAND_RESEED_DRAWS
+// bytes have been drawn, the LSBs of the wideband RSSI are folded into the
+// state the next time the radio is idle in LoRa mode: after a receive
+// window times out, after LMIC_calibrateCad(), and during
+// radio_monitor_rssi().
+enum { FASTRAND_RESEED_DRAWS = 1024 };
+static u4_t fastrand_s[4];
+static u4_t fastrand_out;       // unused bytes of the last output
+static u1_t fastrand_left;      // number of those bytes
+static u2_t fastrand_draws;     // bytes drawn since the last reseed
+static u4_t fastrand_noise;     // noise bits being gathered
+static u1_t fastrand_nbits;     // number of those bits
+static void fastrand_listen (void);
+
 
 static void writeReg (u1_t addr, u1_t data ) {
     hal_spi_write(addr | 0x80, &data, 1);
@@ -396,6 +412,34 @@ static void readBuf (u1_t addr, xref2u1_t buf, u1_t len) {
     hal_spi_read(addr & 0x7f, buf, len);
 }
 
+// charge the HAL's SPI traffic to `phase` until the matching call that
+// restores the returned outer phase.
+static u1_t spiphase (u1_t phase) {
+#if LMIC_ENABLE_spi_stats
+    u1_t const outer = LMIC.radio.spi_phase;
+    LMIC.radio.spi_phase = phase;
+    return outer;
+#else
+    LMIC_API_PARAMETER(phase);
+    return 0;
+#endif
+}
+
+#if LMIC_ENABLE_spi_stats
+//! \brief copy the per-phase SPI counters, indexed by LMIC_SPI_PHASE_...
+void LMIC_getSpiStats(lmic_spi_stats_t pStats[LMIC_SPI_PHASE_COUNT]) {
+    hal_disableIRQs();
+    os_copyMem(pStats, LMIC.radio.spi, sizeof(LMIC.radio.spi));
+    hal_enableIRQs();
+}
+
+void LMIC_clearSpiStats(void) {
+    hal_disableIRQs();
+    os_clearMem(LMIC.radio.spi, sizeof(LMIC.radio.spi));
+    hal_enableIRQs();
+}
+#endif // LMIC_ENABLE_spi_stats
+
 static void requestModuleActive(bit_t state) {
     ostime_t const ticks = hal_setModuleActive(state);
 
@@ -403,17 +447,53 @@ static void requestModuleActive(bit_t state) {
         hal_waitUntil(os_getTime() + ticks);;
 }
 
+// RegOpMode as last written, so the driver needn't read it back. The
+// radio drops from LoRa TX, single RX and CAD to standby by itself, so
+// the mode bits may be stale in that direction only; it never leaves
+// sleep or standby on its own, and LongRangeMode/LowFrequencyModeOn
+// only change when we write them (LongRangeMode only from sleep).
+static u1_t opmode_shadow;
+
+// a MAC receive window (RADIO_RX) is open; only then does rxreadframe()
+// filter by DevAddr. Raw, RXON and ring receivers get every frame.
+static bit_t rxmacwindow;
+
+// datasheet TS_OSC: crystal oscillator start-up, i.e. the longest
+// sleep <-> standby switch. Entering sleep has no specified time; this
+// is the margin starttx() leaves before changing LongRangeMode.
+#define SX127X_TS_OSC           us2osticks(250)
+
+static void syncOpmode () {
+    opmode_shadow = readReg(RegOpMode);
+}
+
+static void writeOpmodeReg (u1_t mode) {
+    writeReg(RegOpMode, mode);
+    if ((opmode_shadow & OPMODE_MASK) != OPMODE_SLEEP)
+        mode = (mode & ~OPMODE_LORA) | (opmode_shadow & OPMODE_LORA);
+    opmode_shadow = mode;
+}
+
 static void writeOpmode(u1_t mode) {
     u1_t const maskedMode = mode & OPMODE_MASK;
     if (maskedMode != OPMODE_SLEEP)
         requestModuleActive(1);
-    writeReg(RegOpMode, mode);
+    writeOpmodeReg(mode);
     if (maskedMode == OPMODE_SLEEP)
         requestModuleActive(0);
 }
 
 static void opmode (u1_t mode) {
-    writeOpmode((readReg(RegOpMode) & ~OPMODE_MASK) | mode);
+    if (mode == OPMODE_SLEEP) {
+        // already there; the radio doesn't wake up by itself.
+        if ((opmode_shadow & OPMODE_MASK) == OPMODE_SLEEP)
+            return;
+        u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_SLEEP);
+        writeOpmode((opmode_shadow & ~OPMODE_MASK) | mode);
+        spiphase(spiOuter);
+        return;
+    }
+    writeOpmode((opmode_shadow & ~OPMODE_MASK) | mode);
 }
 
 static void opmodeLora() {
@@ -551,12 +631,45 @@ static void configLoraModem () {
 #endif /* CFG_sx1272_radio */
 }
 
+// FRF for the last few frequencies used. CSMA and busy-tone flows bounce
+// between the CAD and TX channels, and every rx/tx/cad setup goes through
+// configChannel(), so a handful of entries catches nearly all of them.
+enum { FRF_CACHE_SIZE = 4 };
+static u4_t frfcache_freq[FRF_CACHE_SIZE];
+static u4_t frfcache_frf[FRF_CACHE_SIZE];
+static u1_t frfcache_next;
+
+// FRF = freq * 2^19 / 32 MHz = freq * 256 / 15625, in 32-bit arithmetic
+// (the 64-bit division is very slow on AVR). Exact: the remainder term
+// is below 15625 * 256.
+static u4_t freq2frf (u4_t freq) {
+    u4_t const q = freq / 15625;
+    u4_t const r = freq - q * 15625;
+    return (q << 8) + (r << 8) / 15625;
+}
+
 static void configChannel () {
+    u4_t const freq = LMIC.freq;
+    u4_t frf;
+    u1_t i;
+
+    for (i = 0; i < FRF_CACHE_SIZE; ++i) {
+        if (frfcache_freq[i] == freq)
+            break;
+    }
+    if (i < FRF_CACHE_SIZE) {
+        frf = frfcache_frf[i];
+    } else {
+        frf = freq2frf(freq);
+        i = frfcache_next;
+        frfcache_next = (i + 1) % FRF_CACHE_SIZE;
+        frfcache_freq[i] = freq;
+        frfcache_frf[i] = frf;
+    }
+
     // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
-    uint64_t frf = ((uint64_t)LMIC.freq << 19) / 32000000;
-    writeReg(RegFrfMsb, (u1_t)(frf>>16));
-    writeReg(RegFrfMid, (u1_t)(frf>> 8));
-    writeReg(RegFrfLsb, (u1_t)(frf>> 0));
+    u1_t frfReg[3] = { (u1_t)(frf >> 16), (u1_t)(frf >> 8), (u1_t)frf };
+    writeBuf(RegFrfMsb, frfReg, sizeof(frfReg));
 }
 
 // On the SX1276, we have several possible configs.
@@ -751,7 +864,81 @@ static void setupFskRxTx(bit_t fDisableAutoClear) {
     writeReg(FSKRegSyncValue3, 0xC1);
 }
 
+//! \brief wait for an exact TX start time.
+//! \param time is the time at which the TX must start.
+//! \details Let the HAL sleep through most of the wait if it can, and
+//! spin for the rest. If we end up late, increment the count of events
+//! and totalize the number of ticks late.
+static void txwait (ostime_t time) {
+    if (hal_sleepUntil(time))
+        ++LMIC.radio.txsleep_count;
+
+    u4_t nLate = hal_waitUntil(time); // busy wait for the last stretch
+    if (nLate) {
+        LMIC.radio.txlate_ticks += nLate;
+        ++LMIC.radio.txlate_count;
+    }
+}
+
+// FSK frames longer than the 64-byte FIFO are streamed. On RX, DIO1 is
+// mapped to FifoLevel and the IRQ handler drains a chunk each time the
+// FIFO passes the threshold. On TX, FifoLevel *falls* when the FIFO needs
+// topping up, and the HAL only latches rising edges, so txfsk() polls
+// the flag for the (at most ~30 ms at 50 kbps) remainder of the frame.
+enum {
+    FSK_FIFO_SIZE = 64,
+    FSK_RX_FIFO_THRESH = 31,    // FifoLevel asserts at >= 32 bytes
+    FSK_TX_FIFO_THRESH = 15,    // top up once <= 15 bytes remain
+};
+#define FSK_FIFOTHRESH_TXSTART_NOTEMPTY 0x80
+
+static u1_t fsk_pos;            // bytes of LMIC.frame moved so far
+static u1_t fsk_len;            // frame length from the length byte
+static bit_t fsk_haslen;        // length byte has been read from the FIFO
+
+static void txfsktopup (u1_t pos) {
+    ostime_t const tstart = os_getTime();
+    // twice the time the remaining bytes take on air at 50 kbps
+    ostime_t const tmax = us2osticks((LMIC.dataLen - pos + FSK_FIFO_SIZE) * 320);
+
+    while (pos < LMIC.dataLen) {
+        if (readReg(FSKRegIrqFlags2) & IRQ_FSK2_FIFOLEVEL_MASK) {
+            if (os_getTime() - tstart > tmax) {
+                LMICOS_logEventUint32("txfsktopup: stalled", pos);
+                return;
+            }
+            continue;
+        }
+        u1_t n = FSK_FIFO_SIZE - FSK_TX_FIFO_THRESH - 1;
+        if (n > LMIC.dataLen - pos)
+            n = LMIC.dataLen - pos;
+        writeBuf(RegFifo, LMIC.frame + pos, n);
+        pos += n;
+    }
+}
+
+static void rxfskread (u1_t n) {
+    if (! fsk_haslen) {
+        fsk_len = readReg(RegFifo);
+#if ! LMIC_ENABLE_long_messages
+        // LMIC.frame[] is shorter than the largest FSK frame.
+        if (fsk_len > MAX_LEN_FRAME)
+            fsk_len = MAX_LEN_FRAME;
+#endif
+        fsk_haslen = 1;
+        --n;
+    }
+    if (n > fsk_len - fsk_pos)
+        n = fsk_len - fsk_pos;
+    readBuf(RegFifo, LMIC.frame + fsk_pos, n);
+    fsk_pos += n;
+}
+
 static void txfsk () {
+#if LMIC_CSMA_LEVEL > 0
+    // no channel access for FSK; don't leave a stale LoRa outcome behind.
+    LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
+#endif
     // select FSK modem (from sleep mode)
     opmodeFSK();
 
@@ -781,23 +968,31 @@ static void txfsk () {
     // TODO(tmm@mcci.com): datasheet says this is not used in variable packet length mode
     writeReg(FSKRegPayloadLength, LMIC.dataLen+1); // (insert length byte into payload))
 
-    // download length byte and buffer to the radio FIFO
+    writeReg(FSKRegFifoThresh, FSK_FIFOTHRESH_TXSTART_NOTEMPTY | FSK_TX_FIFO_THRESH);
+
+    // download length byte and as much of the buffer as fits to the radio FIFO
+    u1_t const nFirst = LMIC.dataLen < FSK_FIFO_SIZE - 1 ? LMIC.dataLen : FSK_FIFO_SIZE - 1;
+    u1_t spiOuter = spiphase(LMIC_SPI_PHASE_TXFIFO);
     writeReg(RegFifo, LMIC.dataLen);
-    writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+    writeBuf(RegFifo, LMIC.frame, nFirst);
+    spiphase(spiOuter);
 
     // enable antenna switch for TX
     hal_pin_rxtx(1);
 
     // now we actually start the transmission
     if (LMIC.txend) {
-        u4_t nLate = hal_waitUntil(LMIC.txend); // busy wait until exact tx time
-        if (nLate > 0) {
-            LMIC.radio.txlate_ticks += nLate;
-            ++LMIC.radio.txlate_count;
-        }
+        txwait(LMIC.txend); // wait until exact tx time
     }
     LMICOS_logEventUint32("+Tx FSK", LMIC.dataLen);
     opmode(OPMODE_TX);
+
+    // feed the rest as the FIFO drains
+    if (nFirst < LMIC.dataLen) {
+        spiOuter = spiphase(LMIC_SPI_PHASE_TXFIFO);
+        txfsktopup(nFirst);
+        spiphase(spiOuter);
+    }
 }
 
 #if SYSNAME_TX_BTONE == 1
@@ -806,15 +1001,15 @@ void configrevCAD () {
     writeReg(LORARegIrqFlagsMask, ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK) );
 
     // set radio to sleep mode
-    writeReg(RegOpMode, OPMODE_LORA | OPMODE_SLEEP);
-    //ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    writeOpmodeReg(OPMODE_LORA | OPMODE_SLEEP);
+    //ASSERT((opmode_shadow & OPMODE_LORA) != 0);
 
     // configure frequency
     configChannel();
 
 
     // set back to idle mode
-    writeReg(RegOpMode, OPMODE_LORA | OPMODE_STANDBY);
+    writeOpmodeReg(OPMODE_LORA | OPMODE_STANDBY);
     
     // Configure SF
     configLoraModem();
@@ -869,7 +1064,7 @@ uint8_t revcadlora (){
 			writeReg(LORARegIrqFlags, 0xFF);
 			// set radio to CAD mode.
 			// opmode(OPMODE_CAD);
-			writeReg(RegOpMode, OPMODE_CAD);
+			writeOpmodeReg(OPMODE_CAD);
 
 			u1_t flags = 0;
 			while ((flags & IRQ_LORA_CDDONE_MASK) == 0) {
@@ -906,6 +1101,103 @@ uint8_t revcadlora (){
 
 // save code space if CSMA level is 0
 #if LMIC_CSMA_LEVEL > 0
+// CAD detector settings per SF: low bits of RegDetectOptimize and
+// RegDetectionThreshold. Datasheet values; a non-zero entry in
+// LMIC.sysname_cad_detopt[] / LMIC.sysname_cad_detthr[] overrides them.
+static CONST_TABLE(u1_t, CAD_DETECT_OPTIMIZE)[] = {
+    [FSK]  = 0x00,
+    [SF7]  = 0x03,
+    [SF8]  = 0x03,
+    [SF9]  = 0x03,
+    [SF10] = 0x03,
+    [SF11] = 0x03,
+    [SF12] = 0x03,
+};
+
+static CONST_TABLE(u1_t, CAD_DETECTION_THRESHOLD)[] = {
+    [FSK]  = 0x00,
+    [SF7]  = 0x0A,
+    [SF8]  = 0x0A,
+    [SF9]  = 0x0A,
+    [SF10] = 0x0A,
+    [SF11] = 0x0A,
+    [SF12] = 0x0A,
+};
+
+static void configCadDetect (sf_t sf) {
+    u1_t opt = LMIC.sysname_cad_detopt[sf];
+    u1_t thr = LMIC.sysname_cad_detthr[sf];
+
+    if (opt == 0)
+        opt = TABLE_GET_U1(CAD_DETECT_OPTIMIZE, sf);
+    if (thr == 0)
+        thr = TABLE_GET_U1(CAD_DETECTION_THRESHOLD, sf);
+
+    writeReg(LORARegDetectOptimize, (readReg(LORARegDetectOptimize) & 0xF8) | (opt & 0x07));
+    writeReg(LORARegDetectionThreshold, thr);
+}
+
+// select the SF for CAD slot number `slot` when sensing several SFs; the
+// slots walk round-robin through LMIC.sysname_cad_sfmask, so a DIFS of at
+// least as many CADs as SFs in the set senses each of them.
+static void cadselectsf (u2_t slot) {
+    u1_t const mask = LMIC.sysname_cad_sfmask;
+    u1_t n = 0;
+    u1_t sf;
+
+    for (sf = SF7; sf <= SF12; ++sf) {
+        if (mask & (1 << sf))
+            ++n;
+    }
+    if (n == 0)
+        return;
+
+    slot %= n;
+    for (sf = SF7; sf <= SF12; ++sf) {
+        if ((mask & (1 << sf)) && slot-- == 0)
+            break;
+    }
+
+    if (getSf(LMIC.rps) != sf) {
+        LMIC.rps = setSf(LMIC.sysname_cad_rps, (sf_t)sf);
+        configLoraModem();
+        configCadDetect((sf_t)sf);
+    }
+}
+
+// non-zero if the current channel access has to stop: 1 if it ran out of
+// time or attempts, 2 if it ran into the MAC's deadline (beacon or ping slot).
+// The deadline belongs to the MAC's own uplink; a raw TX after it has
+// finished must not see it.
+static u1_t cadexpired (ostime_t tstart) {
+    ostime_t const now = os_getTime();
+
+    if ((LMIC.opmode & OP_TXRXPEND) != 0 &&
+        LMIC.sysname_cad_deadline != 0 &&
+        now - LMIC.sysname_cad_deadline >= 0)
+        return 2;
+    if (LMIC.sysname_cad_maxtries != 0 &&
+        LMIC.sysname_cad_tries >= LMIC.sysname_cad_maxtries)
+        return 1;
+    if (LMIC.sysname_cad_maxdelay != 0 &&
+        now - tstart >= LMIC.sysname_cad_maxdelay)
+        return 1;
+    return 0;
+}
+
+// one CAD; returns the IRQ flags.
+static u1_t runcad () {
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_CAD);
+    writeReg(LORARegIrqFlags, 0xFF);
+    opmode(OPMODE_CAD);
+    u1_t flags = 0;
+    while ((flags & IRQ_LORA_CDDONE_MASK) == 0) {
+        flags = readReg(LORARegIrqFlags);
+    }
+    spiphase(spiOuter);
+    return flags;
+}
+
 void configCAD () {
     // hal_disableIRQs();
 
@@ -923,29 +1215,99 @@ void configCAD () {
     hal_waitUntil(os_getTime()+ms2osticks(1)); // wait >100us
     hal_pin_rst(2); // configure RST pin as floating
     hal_waitUntil(os_getTime()+ms2osticks(5)); // wait 5ms
+    syncOpmode();
 	}
 
     // mask all IRQ bits except CAD completed & detected
     writeReg(LORARegIrqFlagsMask, ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK) );
 
     // set radio to sleep mode
-    writeReg(RegOpMode, OPMODE_LORA | OPMODE_SLEEP);
-    //ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    writeOpmodeReg(OPMODE_LORA | OPMODE_SLEEP);
+    //ASSERT((opmode_shadow & OPMODE_LORA) != 0);
 
     // configure frequency
     configChannel();
 
     // set back to idle mode
-    writeReg(RegOpMode, OPMODE_LORA | OPMODE_STANDBY);
+    writeOpmodeReg(OPMODE_LORA | OPMODE_STANDBY);
     
     // Configure SF
+    LMIC.rps = LMIC.sysname_cad_rps;
     configLoraModem();
+    configCadDetect(getSf(LMIC.rps));
 }
 
+// Virtual carrier sense. Called right after CAD detected activity, with the
+// radio in standby on the CAD channel and SF. Listen in single RX for the
+// explicit header of the frame on the air; if one arrives, compute the rest
+// of its airtime and wait until the channel is free again.
+//
+// Returns 1 if we deferred on a header, 0 if no header was seen (CAD hit
+// the payload, or implicit header) and the caller should back off as usual.
+static bit_t vcsdefer () {
+    // a preamble is 8 symbols; give it a little margin.
+    writeReg(LORARegModemConfig2, readReg(LORARegModemConfig2) & ~0x03);
+    writeReg(LORARegSymbTimeoutLsb, 16);
+    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+    writeReg(RegLna, LNA_RX_GAIN);
+    writeReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
+    // keep the DIO lines quiet; we poll.
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    writeReg(LORARegIrqFlags, 0xFF);
+    writeReg(LORARegIrqFlagsMask, (u1_t) ~(IRQ_LORA_HEADER_MASK | IRQ_LORA_RXTOUT_MASK));
+    hal_pin_rxtx(0);
+    opmode(OPMODE_RX_SINGLE);
+
+    u1_t flags = 0;
+    while ((flags & (IRQ_LORA_HEADER_MASK | IRQ_LORA_RXTOUT_MASK)) == 0) {
+        flags = readReg(LORARegIrqFlags);
+    }
+    ostime_t const now = os_getTime();
+
+    if ((flags & IRQ_LORA_HEADER_MASK) == 0) {
+        opmode(OPMODE_STANDBY);
+        writeReg(LORARegIrqFlags, 0xFF);
+        return 0;
+    }
+
+    // header info: length, coding rate (1..4 == 4/5..4/8), CRC on payload.
+    u1_t const plen = readReg(LORARegRxNbBytes);
+    u1_t const rxcr = readReg(LORARegModemStat) >> 5;
+    bit_t const crcon = (readReg(LORARegHopChannel) & 0x40) != 0;
+
+    opmode(OPMODE_STANDBY);
+    writeReg(LORARegIrqFlags, 0xFF);
+
+    rps_t rps = setIh(LMIC.rps, 0);
+    rps = setCr(rps, (cr_t)((rxcr >= 1 && rxcr <= 4) ? rxcr - 1 : CR_4_5));
+    rps = setNocrc(rps, !crcon);
+
+    // ValidHeader fires after preamble (12.25 symbols) plus header block (8 symbols).
+    u4_t const symUs = ((u4_t)1 << (getSf(rps) + 6)) * 8 >> getBw(rps);
+    ostime_t remaining = calcAirTime(rps, plen) - us2osticks(symUs * 81 / 4);
+    if (remaining < 0)
+        remaining = 0;
+    if (LMIC.sysname_vcs_jitter)
+        remaining += ms2osticks(os_getFastRndU1() % (LMIC.sysname_vcs_jitter + 1));
+
+    LMIC.sysname_vcs_counter = LMIC.sysname_vcs_counter + 1;
+    LMIC.sysname_vcs_defer = remaining;
+
+    #if LMIC_DEBUG_LEVEL > 0
+        LMIC_DEBUG_PRINTF("VCS: len=%d defer=%"LMIC_PRId_ostime_t"\n", plen, remaining);
+    #endif
+
+    hal_waitUntil(now + remaining);
+    return 1;
+}
+
+// returns 0 once the back-off completes, else the cadexpired() reason.
 uint8_t lmaccadlora (){
+    ostime_t const tstart = os_getTime();
 
     // Reset CAD Counter
     LMIC.sysname_cad_counter = 0;
+    LMIC.sysname_cad_tries = 0;
     LMIC.sysname_cad_detect_counter = 0;
     // Reset LBT Counter
     LMIC.sysname_lbt_counter = 0;
@@ -958,7 +1320,7 @@ uint8_t lmaccadlora (){
 	bit_t clear_bit = 0;
 
     // Number of DIFS to Count-down
-    cur_backoff = os_getRndU1() % LMIC.sysname_backoff_cfg2 + 1; 
+    cur_backoff = os_getFastRndU1() % LMIC.sysname_backoff_cfg2 + 1; 
 
     u2_t state_now = 1;
 
@@ -996,6 +1358,7 @@ uint8_t lmaccadlora (){
 			if(clear_bit || LMIC.sysname_use_fixed_difs){
 				// if RSSI is declared clear, do an extra CSMA with CAD
 				for(u2_t ind = 0;ind < LMIC.sysname_cad_difs;ind++){
+					cadselectsf(ind);
 					// clear all radio IRQ flags
 			        writeReg(LORARegIrqFlags, 0xFF);
 			        // set radio to CAD mode.
@@ -1013,6 +1376,8 @@ uint8_t lmaccadlora (){
 			        	#endif
 			            clear_bit=0;
 			            LMIC.sysname_cad_detect_counter = LMIC.sysname_cad_detect_counter + 1;
+			            if (LMIC.sysname_use_vcs)
+			                vcsdefer();
 			            break;
 			        }
 		        }
@@ -1048,6 +1413,7 @@ uint8_t lmaccadlora (){
 
 			// Perform CAD
 			configCAD();
+			cadselectsf(cur_backoff);
 
 			writeReg(LORARegIrqFlags, 0xFF);
 	        // set radio to CAD mode.
@@ -1065,6 +1431,8 @@ uint8_t lmaccadlora (){
 	        	#endif
 	            clear_bit=0;
 	            LMIC.sysname_cad_detect_counter = LMIC.sysname_cad_detect_counter + 1;
+	            if (LMIC.sysname_use_vcs)
+	                vcsdefer();
 	            break;
 	        }
 
@@ -1080,6 +1448,15 @@ uint8_t lmaccadlora (){
     		state_now = 1; // DIFS STATE
     }
 
+    if (!clear_bit) {
+        LMIC.sysname_cad_tries = LMIC.sysname_cad_tries + 1;
+        u1_t const expired = cadexpired(tstart);
+        if (expired) {
+            writeReg(LORARegIrqFlags, 0xFF);
+            return expired;
+        }
+    }
+
     }
 
 	writeReg(LORARegIrqFlags, 0xFF);
@@ -1089,6 +1466,7 @@ uint8_t lmaccadlora (){
 }
 
 
+// returns 0 once the channel is clear, else the cadexpired() reason.
 uint8_t cadlora (){ 
 
 	// TODO: Implement proper DCF  
@@ -1116,11 +1494,16 @@ uint8_t cadlora (){
 
 	u2_t cur_backoff = 0;
 	bit_t clear_bit = 0;
+	bit_t deferred = 0;
+	ostime_t const tstart = os_getTime();
+
+	LMIC.sysname_cad_tries = 0;
 
 	while(!clear_bit){
 
 		// Implement HAL Backoff
 		clear_bit = 1;
+		deferred = 0;
 
 		if (LMIC.lbt_ticks > 0) {
 	        oslmic_radio_rssi_t rssi;
@@ -1142,6 +1525,7 @@ uint8_t cadlora (){
 		if(clear_bit || LMIC.sysname_use_fixed_difs){
 			// if RSSI is declared clear, do an extra CSMA with CAD
 			for(u2_t ind = 0;ind < LMIC.sysname_cad_difs;ind++){
+				cadselectsf(ind);
 				// clear all radio IRQ flags
 		        writeReg(LORARegIrqFlags, 0xFF);
 		        // set radio to CAD mode.
@@ -1159,14 +1543,26 @@ uint8_t cadlora (){
 		        	#endif
 		        	LMIC.sysname_cad_detect_counter = LMIC.sysname_cad_detect_counter + 1;
 		            clear_bit=0;
+		            if (LMIC.sysname_use_vcs) {
+		                // the overheard frame tells us exactly how long to wait
+		                deferred = vcsdefer();
+		                break;
+		            }
 		        }
 	        }
 		}
 
 		writeReg(LORARegIrqFlags, 0xFF);
 
-        if(!clear_bit){
-        	cur_backoff = os_getRndU1() % LMIC.sysname_backoff_cfg2 + 1;
+        if (!clear_bit) {
+            LMIC.sysname_cad_tries = LMIC.sysname_cad_tries + 1;
+            u1_t const expired = cadexpired(tstart);
+            if (expired)
+                return expired;
+        }
+
+        if(!clear_bit && !deferred){
+        	cur_backoff = os_getFastRndU1() % LMIC.sysname_backoff_cfg2 + 1;
 			hal_waitUntil(os_getTime() + ms2osticks(cur_backoff*LMIC.sysname_backoff_cfg1));
         }
 
@@ -1177,8 +1573,97 @@ uint8_t cadlora (){
 	}
     return 0;
 }
+
+//! \brief measure the CAD false-alarm rate.
+//!
+//! \param nCad number of CADs to run per SF.
+//!
+//! Runs `nCad` CADs on `LMIC.sysname_cad_freq_vec[0]` for every SF in
+//! `LMIC.sysname_cad_sfmask` (or just the SF of `LMIC.sysname_cad_rps`),
+//! with the current detector settings, and records the detections per SF in
+//! `LMIC.sysname_cad_fa[]`. Only meaningful on an idle channel, and only
+//! while the LMIC is not using the radio.
+//!
+//! \returns the total number of detections.
+u2_t LMIC_calibrateCad (u2_t nCad) {
+    u4_t const freq = LMIC.freq;
+    rps_t const rps = LMIC.rps;
+    u1_t mask = LMIC.sysname_cad_sfmask;
+    u2_t total = 0;
+
+    if (mask == 0)
+        mask = 1 << getSf(LMIC.sysname_cad_rps);
+
+    LMIC.freq = LMIC.sysname_cad_freq_vec[0];
+    configCAD();
+
+    for (u1_t sf = SF7; sf <= SF12; ++sf) {
+        LMIC.sysname_cad_fa[sf] = 0;
+        if ((mask & (1 << sf)) == 0)
+            continue;
+
+        LMIC.rps = setSf(LMIC.sysname_cad_rps, (sf_t)sf);
+        configLoraModem();
+        configCadDetect((sf_t)sf);
+        for (u2_t i = 0; i < nCad; ++i) {
+            if (runcad() & IRQ_LORA_CDDETD_MASK)
+                ++LMIC.sysname_cad_fa[sf];
+        }
+        total += LMIC.sysname_cad_fa[sf];
+    }
+
+    writeReg(LORARegIrqFlags, 0xFF);
+    if (fastrand_draws >= FASTRAND_RESEED_DRAWS)
+        fastrand_listen();
+    opmode(OPMODE_SLEEP);
+    LMIC.freq = freq;
+    LMIC.rps = rps;
+    return total;
+}
 #endif
 
+// length of raw implicit-header frames, or 0 for explicit header. MAC
+// frames (OP_TXRXPEND) always use explicit header.
+static u1_t txrawlen () {
+    return (LMIC.opmode & OP_TXRXPEND) ? 0 : getIh(LMIC.sysname_tx_rps);
+}
+
+// select the LoRa TX parameters. In implicit-header mode the receiver takes
+// the length from its own configuration, so short frames are zero-padded
+// to it; starttx() has already refused longer ones.
+static void txsetrps () {
+    u1_t const len = txrawlen();
+
+    LMIC.rps = setIh(LMIC.sysname_tx_rps, len);
+    if (len == 0)
+        return;
+    if (LMIC.dataLen < len)
+        os_clearMem(LMIC.frame + LMIC.dataLen, len - LMIC.dataLen);
+    LMIC.dataLen = len;
+}
+
+//! \brief Select implicit-header frames of `len` bytes for raw TX and RX,
+//! or explicit header if `len` is zero.
+//!
+//! \details Applies to LMIC.rps and LMIC.sysname_tx_rps, so call it after
+//! setting those. With the length fixed in advance, neither side sends or
+//! decodes the header, and the IRQ handler needn't read the length back.
+//! The MAC's own frames always use explicit header; this is for raw mode
+//! links between our own nodes. See LMIC_LORA_AIRTIME_US() for the gain.
+//! Shorter raw frames are zero-padded to `len`. Longer ones aren't sent:
+//! the TX completes at once with LMIC.dataLen set to zero.
+//!
+//! \returns 1 on success, 0 if `len` exceeds MAX_LEN_FRAME.
+bit_t LMIC_setRawImplicitHeader(u1_t len) {
+#if ! LMIC_ENABLE_long_messages
+    if (len > MAX_LEN_FRAME)
+        return 0;
+#endif
+    LMIC.rps = setIh(LMIC.rps, len);
+    LMIC.sysname_tx_rps = setIh(LMIC.sysname_tx_rps, len);
+    return 1;
+}
+
 #if SYSNAME_TX_BTONE == 1
 static void txlora () {
 // Enable Reverse CSMA for busytone purpose
@@ -1186,10 +1671,12 @@ static void txlora () {
 	if(!LMIC.sysname_btone_txmode){
 		LMIC.freq = LMIC.sysname_btone_rx_freq;
 		LMIC.rps = LMIC.sysname_btone_rx_rps;
+		u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_CAD);
 		revcadlora();
+		spiphase(spiOuter);
 		LMIC.freq = LMIC.sysname_btone_tx_freq;
 
-		u1_t const rOpMode = readReg(RegOpMode);
+		u1_t const rOpMode = opmode_shadow;
 	    if ((rOpMode & OPMODE_MASK) != OPMODE_SLEEP) {
 	        opmode(OPMODE_SLEEP);
 	        // hal_waitUntil(os_getTime() + ms2osticks(1));
@@ -1201,18 +1688,22 @@ static void txlora () {
 	if(LMIC.sysname_enable_cad){
 		LMIC.freq = LMIC.sysname_cad_freq_vec[LMIC.sysname_enable_cad-1];
 		LMIC.rps = LMIC.sysname_cad_rps;
-    	cadlora();
+		// the busy-tone flow always transmits.
+		u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_CAD);
+    	LMIC.sysname_cad_result = cadlora() ? SYSNAME_CAD_FORCED : SYSNAME_CAD_CLEAR;
+		spiphase(spiOuter);
     	LMIC.freq = LMIC.sysname_cad_freq_vec[0];
 	} else{
 		LMIC.sysname_cad_counter = 0;
+		LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
 	}
 #endif
-	LMIC.rps = LMIC.sysname_tx_rps;
+	txsetrps();
 
     // select LoRa modem (from sleep mode)
 #if SYSNAME_TX_BTONE == 0
     opmodeLora();
-    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    ASSERT((opmode_shadow & OPMODE_LORA) != 0);
 #elif SYSNAME_TX_BTONE == 1
     // Burn through asap
     // writeReg(RegOpMode, OPMODE_LORA);
@@ -1264,17 +1755,15 @@ static void txlora () {
 
 #if SYSNAME_TX_BTONE == 0
     // download buffer to the radio FIFO
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_TXFIFO);
     writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+    spiphase(spiOuter);
     // enable antenna switch for TX
     hal_pin_rxtx(1);
 
     // now we actually start the transmission
     if (LMIC.txend) {
-        u4_t nLate = hal_waitUntil(LMIC.txend); // busy wait until exact tx time
-        if (nLate) {
-            LMIC.radio.txlate_ticks += nLate;
-            ++LMIC.radio.txlate_count;
-        }
+        txwait(LMIC.txend); // wait until exact tx time
     }
 
     LMICOS_logEventUint32("+Tx LoRa", LMIC.dataLen);
@@ -1284,7 +1773,7 @@ static void txlora () {
 	opmode(OPMODE_TX);
 #elif SYSNAME_TX_BTONE == 1
     // Burn through asap
-    writeReg(RegOpMode, OPMODE_TX);
+    writeOpmodeReg(OPMODE_TX);
 #endif
 
     
@@ -1314,25 +1803,57 @@ static void txlora () {
 static void txlora () {
 // enable CSMA only if level is above 0
 #if LMIC_CSMA_LEVEL > 0
+	ostime_t const taccess = os_getTime();
+
+	LMIC.sysname_cad_access = 0;
 	if(LMIC.sysname_enable_cad){
 		LMIC.freq = LMIC.sysname_cad_freq_vec[LMIC.sysname_enable_cad-1];
 		LMIC.rps = LMIC.sysname_cad_rps;
+		uint8_t busy;
+		u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_CAD);
 		if(LMIC.sysname_csma_algo){
-			lmaccadlora();
+			busy = lmaccadlora();
 		} else {
-    		cadlora();
+    		busy = cadlora();
     	}
+		spiphase(spiOuter);
     	LMIC.freq = LMIC.sysname_cad_freq_vec[0];
+    	LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
+
+    	// how long channel access held up the TX; the MAC uses this to
+    	// correct duty-cycle accounting and to estimate future delays.
+    	LMIC.sysname_cad_access = os_getTime() - taccess;
+    	LMIC.sysname_cad_access_avg +=
+    		(LMIC.sysname_cad_access - LMIC.sysname_cad_access_avg) / 8;
+
+    	if (busy) {
+    		if (busy == 1 && LMIC.sysname_cad_fallback == SYSNAME_CAD_FALLBACK_TX) {
+    			LMIC.sysname_cad_result = SYSNAME_CAD_FORCED;
+    		} else {
+    			// never drop or force because of the MAC deadline; just try later.
+    			LMIC.sysname_cad_result =
+    				busy == 1 && LMIC.sysname_cad_fallback == SYSNAME_CAD_FALLBACK_DROP ? SYSNAME_CAD_DROPPED
+    				                                                                     : SYSNAME_CAD_REQUEUED;
+    			LMIC.rps = LMIC.sysname_tx_rps;
+    			opmode(OPMODE_SLEEP);
+    			LMICOS_logEventUint32("+Tx LoRa abandoned", LMIC.sysname_cad_tries);
+    			// complete the request without transmitting; the MAC
+    			// sees sysname_cad_result and finishes the uplink.
+    			os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+    			return;
+    		}
+    	}
 	} else{
 		LMIC.sysname_cad_counter = 0;
 		LMIC.sysname_lbt_counter = 0;
+		LMIC.sysname_cad_result = SYSNAME_CAD_CLEAR;
 	}
 #endif
-	LMIC.rps = LMIC.sysname_tx_rps;
+	txsetrps();
 
     // select LoRa modem (from sleep mode)
     opmodeLora();
-    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    ASSERT((opmode_shadow & OPMODE_LORA) != 0);
 
     // enter standby mode (required for FIFO loading))
     opmode(OPMODE_STANDBY);
@@ -1367,17 +1888,15 @@ static void txlora () {
     writeReg(LORARegPayloadLength, LMIC.dataLen);
 
     // download buffer to the radio FIFO
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_TXFIFO);
     writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+    spiphase(spiOuter);
     // enable antenna switch for TX
     hal_pin_rxtx(1);
 
     // now we actually start the transmission
     if (LMIC.txend) {
-        u4_t nLate = hal_waitUntil(LMIC.txend); // busy wait until exact tx time
-        if (nLate) {
-            LMIC.radio.txlate_ticks += nLate;
-            ++LMIC.radio.txlate_count;
-        }
+        txwait(LMIC.txend); // wait until exact tx time
     }
 
     LMICOS_logEventUint32("+Tx LoRa", LMIC.dataLen);
@@ -1404,18 +1923,18 @@ static void txlora () {
 
 // start transmitter (buf=LMIC.frame, len=LMIC.dataLen)
 static void starttx () {
-    u1_t const rOpMode = readReg(RegOpMode);
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_TXSETUP);
 
     // originally, this code ASSERT()ed, but asserts are both bad and
-    // blunt instruments. If we see that we're not in sleep mode,
-    // force sleep (because we might have to switch modes)
-    if ((rOpMode & OPMODE_MASK) != OPMODE_SLEEP) {
+    // blunt instruments. If we're not in sleep mode, force sleep
+    // (because we might have to switch modes)
+    if ((opmode_shadow & OPMODE_MASK) != OPMODE_SLEEP) {
 #if LMIC_DEBUG_LEVEL > 0
-        LMIC_DEBUG_PRINTF("?%s: OPMODE != OPMODE_SLEEP: %#02x\n", __func__, rOpMode);
+        LMIC_DEBUG_PRINTF("?%s: OPMODE != OPMODE_SLEEP: %#02x\n", __func__, opmode_shadow);
 #endif
         opmode(OPMODE_SLEEP);
 #if SYSNAME_TX_BTONE == 0
-        hal_waitUntil(os_getTime() + ms2osticks(1));
+        hal_waitUntil(os_getTime() + SX127X_TS_OSC);
 #endif
     }
 
@@ -1430,16 +1949,28 @@ static void starttx () {
         if (rssi.max_rssi >= LMIC.lbt_dbmax) {
             // complete the request by scheduling the job
             os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+            spiphase(spiOuter);
             return;
         }
     }
 #endif
 
+    // a raw frame longer than the fixed implicit-header length can't be
+    // received; complete the request without sending it.
+    if (getSf(LMIC.rps) != FSK && txrawlen() != 0 && LMIC.dataLen > txrawlen()) {
+        LMICOS_logEventUint32("+Tx LoRa too long for implicit header", LMIC.dataLen);
+        LMIC.dataLen = 0;
+        os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+        spiphase(spiOuter);
+        return;
+    }
+
     if(getSf(LMIC.rps) == FSK) { // FSK modem
         txfsk();
     } else { // LoRa modem
         txlora();
     }
+    spiphase(spiOuter);
     // the radio will go back to STANDBY mode as soon as the TX is finished
     // the corresponding IRQ will inform us about completion.
 
@@ -1469,7 +2000,7 @@ static void rxlate (u4_t nLate) {
 static void rxlora (u1_t rxmode) {
     // select LoRa modem (from sleep mode)
     opmodeLora();
-    ASSERT((readReg(RegOpMode) & OPMODE_LORA) != 0);
+    ASSERT((opmode_shadow & OPMODE_LORA) != 0);
     // enter standby mode (warm up))
     opmode(OPMODE_STANDBY);
     // don't use MAC settings at startup
@@ -1507,6 +2038,10 @@ static void rxlora (u1_t rxmode) {
     } else {
         writeReg(LORARegDetectOptimize, rDetectOptimize | 0x80);
     }
+#if LMIC_CSMA_LEVEL > 0
+    // CAD may have left a tuned threshold behind; receive with the default.
+    writeReg(LORARegDetectionThreshold, 0x0A);
+#endif
 
     // set symbol timeout (for single rx)
     writeReg(LORARegSymbTimeoutLsb, (uint8_t) LMIC.rxsyms);
@@ -1574,7 +2109,7 @@ static void rxfsk (u1_t rxmode) {
     // select FSK modem (from sleep mode)
     //writeReg(RegOpMode, 0x00); // (not LoRa)
     opmodeFSK();
-    ASSERT((readReg(RegOpMode) & OPMODE_LORA) == 0);
+    ASSERT((opmode_shadow & OPMODE_LORA) == 0);
     // enter standby mode (warm up))
     opmode(OPMODE_STANDBY);
     // configure frequency
@@ -1593,9 +2128,14 @@ static void rxfsk (u1_t rxmode) {
     writeReg(FSKRegRxTimeout2, 0xFF);//(LMIC.rxsyms+1)/2);
     // set bitrate, autoclear CRC
     setupFskRxTx(1);
+    // accept anything that fits LMIC.frame; drain the FIFO in chunks
+    writeReg(FSKRegPayloadLength, MAX_LEN_FRAME);
+    writeReg(FSKRegFifoThresh, FSK_RX_FIFO_THRESH);
+    fsk_pos = 0;
+    fsk_haslen = 0;
 
-    // configure DIO mapping DIO0=PayloadReady DIO1=NOP DIO2=TimeOut
-    writeReg(RegDioMapping1, MAP_DIO0_FSK_READY|MAP_DIO1_FSK_NOP|MAP_DIO2_FSK_TIMEOUT);
+    // configure DIO mapping DIO0=PayloadReady DIO1=FifoLevel DIO2=TimeOut
+    writeReg(RegDioMapping1, MAP_DIO0_FSK_READY|MAP_DIO1_FSK_FIFOLEVEL|MAP_DIO2_FSK_TIMEOUT);
 
     // enable antenna switch for RX
     hal_pin_rxtx(0);
@@ -1613,7 +2153,7 @@ static void rxfsk (u1_t rxmode) {
 }
 
 static void startrx (u1_t rxmode) {
-    ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+    ASSERT( (opmode_shadow & OPMODE_MASK) == OPMODE_SLEEP );
     if(getSf(LMIC.rps) == FSK) { // FSK modem
         rxfsk(rxmode);
     } else { // LoRa modem
@@ -1623,6 +2163,513 @@ static void startrx (u1_t rxmode) {
     // or timed out, and the corresponding IRQ will inform us about completion.
 }
 
+#if SYSNAME_BTONE_COORD == 1
+// Busy-tone coordinator. The tone is a long-preamble LoRa frame started from
+// its own osjob, so it interleaves with whatever the MAC is doing: a
+// continuous receive is paused for the tone and resumed afterwards, and a
+// tone that would collide with a TX or single RX is skipped.
+static bit_t btone_active;      // a tone is on the air
+static bit_t btone_resume_rx;   // restart continuous RX when the tone ends
+
+static void btone_schedule (void);
+
+// start the tone at exactly LMIC.sysname_btone_next
+static void txtone () {
+    // symbol time in us for the tone SF/BW; 125 kHz is 8 us per chip.
+    u1_t const sf = getSf(LMIC.rps) + 6; // 1 == SF7
+    u4_t const symUs = ((u4_t)1 << sf) * 8 >> getBw(LMIC.rps);
+    // leave room for the sync word, SFD and the minimal payload.
+    s4_t nSyms = osticks2us(LMIC.sysname_btone_dur) / symUs - 12;
+
+    if (nSyms < 6)
+        nSyms = 6;
+    else if (nSyms > 0xFFFF)
+        nSyms = 0xFFFF;
+
+    opmodeLora();
+    opmode(OPMODE_STANDBY);
+    configLoraModem();
+    configChannel();
+#ifdef CFG_sx1272_radio
+    writeReg(RegPaRamp, (readReg(RegPaRamp) & 0xF0) | 0x08); // set PA ramp-up time 50 uSec
+#elif defined(CFG_sx1276_radio)
+    writeReg(RegPaRamp, 0x08);     // set PA ramp-up time 50 uSec, clear FSK bits
+#endif
+    configPower();
+    writeReg(LORARegSyncWord, LORA_MAC_PREAMBLE);
+    writeReg(LORARegPreambleMsb, (u1_t)(nSyms >> 8));
+    writeReg(LORARegPreambleLsb, (u1_t)nSyms);
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    writeReg(LORARegIrqFlags, 0xFF);
+    writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
+    writeReg(LORARegFifoTxBaseAddr, 0x00);
+    writeReg(LORARegFifoAddrPtr, 0x00);
+    writeReg(LORARegPayloadLength, 1);
+    writeReg(RegFifo, 0);
+    hal_pin_rxtx(1);
+
+    btone_active = 1;
+    txwait(LMIC.sysname_btone_next); // wait until exact tone time
+    opmode(OPMODE_TX);
+    LMICOS_logEventUint32("+Tx busy tone", (u4_t)nSyms);
+}
+
+// put the radio back the way the tone found it.
+static void btone_finish () {
+    btone_active = 0;
+    writeReg(LORARegIrqFlagsMask, 0xFF);
+    writeReg(LORARegIrqFlags, 0xFF);
+    writeReg(LORARegPreambleMsb, 0x00);
+    writeReg(LORARegPreambleLsb, 0x08);
+    opmode(OPMODE_SLEEP);
+}
+
+static void btone_func (osjob_t *job) {
+    LMIC_API_PARAMETER(job);
+
+    if (! LMIC.sysname_btone_coord_on)
+        return;
+
+    // a stale TX/RX/CAD here means the MAC's IRQ is still pending.
+    u1_t const rOpMode = opmode_shadow;
+    u1_t const mode = rOpMode & OPMODE_MASK;
+
+    btone_resume_rx = 0;
+    if (mode == OPMODE_RX && (rOpMode & OPMODE_LORA) != 0) {
+        btone_resume_rx = 1;
+    } else if (mode != OPMODE_SLEEP && mode != OPMODE_STANDBY) {
+        // the MAC owns the radio (TX, single RX, CAD); don't step on it.
+        ++LMIC.sysname_btone_skipped;
+        btone_schedule();
+        return;
+    }
+
+    if (LMIC.sysname_btone_next - os_getTime() < 0) {
+        // the scheduler ran us too late to hit the slot.
+        ++LMIC.sysname_btone_skipped;
+        btone_schedule();
+        return;
+    }
+
+    u4_t const freq = LMIC.freq;
+    rps_t const rps = LMIC.rps;
+
+    opmode(OPMODE_SLEEP);
+    LMIC.freq = LMIC.sysname_btone_coord_freq;
+    LMIC.rps = LMIC.sysname_btone_coord_rps;
+    txtone();
+    LMIC.freq = freq;
+    LMIC.rps = rps;
+}
+
+// arm the job for the next tone that can still be reached.
+static void btone_schedule () {
+    ostime_t const now = os_getTime();
+
+    do {
+        LMIC.sysname_btone_next += LMIC.sysname_btone_period;
+    } while (LMIC.sysname_btone_next - TX_RAMPUP - now < 0);
+
+    os_setTimedCallback(&LMIC.sysname_btone_job,
+                        LMIC.sysname_btone_next - TX_RAMPUP,
+                        btone_func);
+}
+
+// called from the IRQ handler when the tone's TxDone arrives.
+static void btone_done () {
+    btone_finish();
+    ++LMIC.sysname_btone_sent;
+    if (btone_resume_rx) {
+        btone_resume_rx = 0;
+        rxlora(RXMODE_SCAN);
+    }
+    if (LMIC.sysname_btone_coord_on)
+        btone_schedule();
+}
+
+// a MAC radio operation preempts a tone that's still on the air.
+static void btone_abort () {
+    if (btone_active) {
+        btone_finish();
+        btone_resume_rx = 0;
+        ++LMIC.sysname_btone_skipped;
+        if (LMIC.sysname_btone_coord_on)
+            btone_schedule();
+    }
+}
+
+//! \brief start emitting busy tones.
+//!
+//! \param freq tone frequency in Hz.
+//! \param rps tone SF/BW; only the LoRa parameters are used.
+//! \param start time of the first tone. Must be at least `TX_RAMPUP` in the future.
+//! \param period interval between tone starts.
+//! \param duration length of each tone; rounded to whole preamble symbols.
+//!
+//! Each tone is started with `hal_waitUntil()` at the exact slot time, so
+//! tone starts are as precise as TX starts; lateness is accounted in
+//! `LMIC.radio.txlate_ticks`.
+void LMIC_startBusyTone(u4_t freq, rps_t rps, ostime_t start, ostime_t period, ostime_t duration) {
+    LMIC_stopBusyTone();
+
+    LMIC.sysname_btone_coord_freq = freq;
+    LMIC.sysname_btone_coord_rps = rps;
+    LMIC.sysname_btone_period = period;
+    LMIC.sysname_btone_dur = duration;
+    LMIC.sysname_btone_next = start;
+    LMIC.sysname_btone_coord_on = 1;
+
+    os_setTimedCallback(&LMIC.sysname_btone_job, start - TX_RAMPUP, btone_func);
+}
+
+void LMIC_stopBusyTone(void) {
+    LMIC.sysname_btone_coord_on = 0;
+    os_clearCallback(&LMIC.sysname_btone_job);
+    if (btone_active) {
+        btone_finish();
+        btone_resume_rx = 0;
+    }
+}
+#endif // SYSNAME_BTONE_COORD
+
+#if SYSNAME_LPL == 1
+// Low-power listening. Every sysname_lpl_interval the radio wakes, runs one
+// CAD on the sniff channel and goes straight back to sleep unless it sees a
+// preamble, in which case it stays for a single RX. Senders must use a
+// preamble longer than the interval. Like the busy-tone coordinator this
+// runs from its own osjob and steps aside whenever the MAC has the radio
+// or is waiting for it (RX windows, beacon tracking). The MAC's receive
+// state is saved at each wake-up and put back once the sniff is over.
+static bit_t lpl_rxactive;      // our single RX is running
+static bit_t lpl_rxpending;     // rxtime and the results below are ours
+static u4_t lpl_savefreq;       // MAC radio settings, restored when the radio sleeps
+static rps_t lpl_saverps;
+static u1_t lpl_saverxsyms;
+static ostime_t lpl_saverxtime; // MAC RX results, restored once rxfn is done
+static u1_t lpl_savedatalen;
+static s1_t lpl_saverssi;
+static s1_t lpl_savesnr;
+
+static void lpl_func (osjob_t *job);
+
+// charge radio-on time from sysname_lpl_wake to now.
+static void lpl_account () {
+    ostime_t const now = os_getTime();
+
+    LMIC.sysname_lpl_ontime += (u4_t)(now - LMIC.sysname_lpl_wake);
+    LMIC.sysname_lpl_elapsed += (u4_t)(now - LMIC.sysname_lpl_mark);
+    LMIC.sysname_lpl_mark = now;
+    if (LMIC.sysname_lpl_elapsed > (1u << 30)) {
+        LMIC.sysname_lpl_elapsed >>= 1;
+        LMIC.sysname_lpl_ontime >>= 1;
+    }
+}
+
+static void lpl_schedule () {
+    ostime_t const now = os_getTime();
+
+    do {
+        LMIC.sysname_lpl_next += LMIC.sysname_lpl_interval;
+    } while (LMIC.sysname_lpl_next - now < 0);
+
+    os_setTimedCallback(&LMIC.sysname_lpl_job, LMIC.sysname_lpl_next, lpl_func);
+}
+
+// put the radio back to sleep.
+static void lpl_release () {
+    lpl_rxactive = 0;
+    writeReg(LORARegIrqFlagsMask, 0xFF);
+    writeReg(LORARegIrqFlags, 0xFF);
+    opmode(OPMODE_SLEEP);
+    lpl_account();
+}
+
+// put the radio to sleep and give the MAC its settings back.
+static void lpl_finish () {
+    lpl_release();
+    LMIC.freq = lpl_savefreq;
+    LMIC.rps = lpl_saverps;
+    LMIC.rxsyms = lpl_saverxsyms;
+}
+
+// give the MAC its RX results back.
+static void lpl_putback () {
+    if (lpl_rxpending) {
+        lpl_rxpending = 0;
+        LMIC.rxtime = lpl_saverxtime;
+        LMIC.dataLen = lpl_savedatalen;
+        LMIC.rssi = lpl_saverssi;
+        LMIC.snr = lpl_savesnr;
+    }
+}
+
+// the IRQ handler routes our RX completion here.
+static void lpl_rxdone (osjob_t *job) {
+    if (LMIC.sysname_lpl_on) {
+        lpl_schedule();
+        // the MAC may have taken the radio, and LMIC.frame, since.
+        if (lpl_rxpending && LMIC.dataLen != 0) {
+            ++LMIC.sysname_lpl_frames;
+            if (LMIC.sysname_lpl_rxfn != NULL)
+                LMIC.sysname_lpl_rxfn(job);
+        }
+    }
+    lpl_putback();
+}
+
+static void lpl_func (osjob_t *job) {
+    LMIC_API_PARAMETER(job);
+
+    if (! LMIC.sysname_lpl_on)
+        return;
+
+    // the MAC is between TX and its RX windows or tracking beacons, a
+    // zero-copy uplink is waiting in LMIC.frame, or the radio is in use.
+    if ((LMIC.opmode & (OP_TXRXPEND | OP_SCAN | OP_TRACK)) != 0 ||
+#if LMIC_ENABLE_tx_zerocopy
+        LMIC.pendTxInFrame ||
+#endif
+        (opmode_shadow & OPMODE_MASK) != OPMODE_SLEEP) {
+        ++LMIC.sysname_lpl_skipped;
+        lpl_schedule();
+        return;
+    }
+
+    LMIC.sysname_lpl_wake = os_getTime();
+    lpl_savefreq = LMIC.freq;
+    lpl_saverps = LMIC.rps;
+    lpl_saverxsyms = LMIC.rxsyms;
+    LMIC.freq = LMIC.sysname_lpl_freq;
+    LMIC.rps = LMIC.sysname_lpl_rps;
+
+    opmodeLora();
+    opmode(OPMODE_STANDBY);
+    configChannel();
+    configLoraModem();
+    configCadDetect(getSf(LMIC.rps));
+    // keep the DIO lines quiet; we poll.
+    writeReg(RegDioMapping1, MAP_DIO0_LORA_TXDONE|MAP_DIO1_LORA_NOP|MAP_DIO2_LORA_NOP);
+    writeReg(LORARegIrqFlagsMask, (u1_t) ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK));
+
+    ++LMIC.sysname_lpl_wakeups;
+    if ((runcad() & IRQ_LORA_CDDETD_MASK) == 0) {
+        lpl_finish();
+        lpl_schedule();
+        return;
+    }
+
+    // preamble on the air: receive it. The IRQ handler hands the result to
+    // lpl_rxdone() instead of the MAC's osjob.
+    ++LMIC.sysname_lpl_detects;
+    opmode(OPMODE_SLEEP);
+    lpl_saverxtime = LMIC.rxtime;
+    lpl_savedatalen = LMIC.dataLen;
+    lpl_saverssi = LMIC.rssi;
+    lpl_savesnr = LMIC.snr;
+    lpl_rxpending = 1;
+    LMIC.rxtime = os_getTime() + us2osticks(200);
+    LMIC.rxsyms = LMIC.sysname_lpl_rxsyms;
+    lpl_rxactive = 1;
+    rxmacwindow = 0;
+    rxlora(RXMODE_SINGLE);
+}
+
+// a MAC radio operation preempts a sniff RX that's still running. The
+// MAC has already set up the channel and timing it wants; leave them be.
+static void lpl_abort () {
+    lpl_rxpending = 0;
+    if (lpl_rxactive) {
+        lpl_release();
+        ++LMIC.sysname_lpl_skipped;
+        if (LMIC.sysname_lpl_on)
+            lpl_schedule();
+    }
+}
+
+//! \brief start low-power listening.
+//!
+//! \param freq sniff frequency in Hz.
+//! \param rps SF/BW to sniff for; only the LoRa parameters are used.
+//! \param interval time between wake-ups. Senders' preambles must be longer.
+//! \param rxfn called from the sniff osjob for each frame received; the
+//! frame is in `LMIC.frame`/`LMIC.dataLen`, with `LMIC.rssi`/`LMIC.snr`.
+//! These are only valid until rxfn returns; the MAC's values of
+//! `LMIC.dataLen`, `LMIC.rssi` and `LMIC.snr` are put back afterwards.
+//!
+//! The first wake-up is one interval from now. Use
+//! LMIC_getSniffDutyCycle() to see what the listening costs.
+void LMIC_startSniff(u4_t freq, rps_t rps, ostime_t interval, osjobcb_t rxfn) {
+    LMIC_stopSniff();
+
+    ostime_t const now = os_getTime();
+
+    LMIC.sysname_lpl_freq = freq;
+    LMIC.sysname_lpl_rps = rps;
+    LMIC.sysname_lpl_interval = interval;
+    LMIC.sysname_lpl_rxfn = rxfn;
+    if (LMIC.sysname_lpl_rxsyms == 0)
+        LMIC.sysname_lpl_rxsyms = 8;   // the rest of an ordinary preamble
+    LMIC.sysname_lpl_next = now;
+    LMIC.sysname_lpl_mark = now;
+    LMIC.sysname_lpl_ontime = 0;
+    LMIC.sysname_lpl_elapsed = 0;
+    LMIC.sysname_lpl_on = 1;
+    lpl_schedule();
+}
+
+void LMIC_stopSniff(void) {
+    LMIC.sysname_lpl_on = 0;
+    os_clearCallback(&LMIC.sysname_lpl_job);
+    if (lpl_rxactive)
+        lpl_finish();
+    lpl_putback();
+}
+
+//! \brief return the radio-on fraction since LMIC_startSniff(), in units of 0.01%.
+u2_t LMIC_getSniffDutyCycle(void) {
+    if (LMIC.sysname_lpl_elapsed == 0)
+        return 0;
+    return (u2_t) (((uint64_t) LMIC.sysname_lpl_ontime * 10000u) / LMIC.sysname_lpl_elapsed);
+}
+#endif // SYSNAME_LPL
+
+#if LMIC_RXRING_DEPTH > 0
+// Continuous receive into a ring: the radio stays in RX and each RxDone
+// is copied out here, so back-to-back frames survive while the app is
+// still busy with an earlier one. Producer is the IRQ handler, consumer
+// is LMIC_rxRingPeek()/LMIC_rxRingPop(); both run from the os loop.
+static lmic_rxring_entry_t rxring[LMIC_RXRING_DEPTH];
+static u1_t rxring_head;        // next slot to fill
+static u1_t rxring_count;       // slots in use
+static u1_t rxring_lost;        // frames dropped since the last push
+static bit_t rxring_active;     // RADIO_RXON_RING is running
+
+static void rxringpush () {
+    if (rxring_count == LMIC_RXRING_DEPTH) {
+        ++LMIC.radio.rxring_overrun;
+        if (rxring_lost != 0xFF)
+            ++rxring_lost;
+        return;
+    }
+
+    lmic_rxring_entry_t * const e = &rxring[rxring_head];
+    e->rxtime = LMIC.rxtime;
+    e->rssi = LMIC.rssi;
+    e->snr = LMIC.snr;
+    e->crc_err = LMIC.sysname_crc_err;
+    e->lost = rxring_lost;
+    e->len = LMIC.dataLen;
+    os_copyMem(e->frame, LMIC.frame, LMIC.dataLen);
+
+    rxring_lost = 0;
+    rxring_head = (rxring_head + 1) % LMIC_RXRING_DEPTH;
+    ++rxring_count;
+}
+
+//! \brief return the oldest frame in the receive ring, or NULL if empty.
+lmic_rxring_entry_t const *LMIC_rxRingPeek(void) {
+    if (rxring_count == 0)
+        return NULL;
+    return &rxring[(rxring_head + LMIC_RXRING_DEPTH - rxring_count) % LMIC_RXRING_DEPTH];
+}
+
+//! \brief release the frame returned by LMIC_rxRingPeek().
+void LMIC_rxRingPop(void) {
+    if (rxring_count != 0)
+        --rxring_count;
+}
+#endif // LMIC_RXRING_DEPTH > 0
+
+//! \brief true while the radio may write LMIC.frame on its own: a
+//! continuous or single RX is running, continuous RX is paused for a busy
+//! tone, or a low-power-listening frame hasn't been handed over yet.
+bit_t radio_frameBusy () {
+    u1_t const mode = opmode_shadow & OPMODE_MASK;
+
+    if (mode == OPMODE_RX || mode == OPMODE_RX_SINGLE)
+        return 1;
+#if SYSNAME_BTONE_COORD == 1
+    if (btone_resume_rx)
+        return 1;
+#endif
+#if SYSNAME_LPL == 1
+    if (lpl_rxactive || lpl_rxpending)
+        return 1;
+#endif
+    return 0;
+}
+
+static u4_t fastrand_rotl (u4_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+static u4_t fastrand_next () {
+    u4_t * const s = fastrand_s;
+    u4_t const result = fastrand_rotl(s[1] * 5, 7) * 9;
+    u4_t const t = s[1] << 9;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = fastrand_rotl(s[3], 11);
+    return result;
+}
+
+static void fastrand_seed () {
+    for (u1_t i = 0; i < 4; ++i)
+        fastrand_s[i] = ((u4_t)radio_rand1() << 24) | ((u4_t)radio_rand1() << 16) |
+                        ((u4_t)radio_rand1() << 8) | radio_rand1();
+    // xoshiro must never have an all-zero state
+    if ((fastrand_s[0] | fastrand_s[1] | fastrand_s[2] | fastrand_s[3]) == 0)
+        fastrand_s[0] = 1;
+    fastrand_left = 0;
+    fastrand_draws = 0;
+}
+
+// fold one noise bit in; every 32 bits, mix a word into the state.
+static void fastrand_stir (u1_t bit) {
+    fastrand_noise = (fastrand_noise << 1) | (bit & 1);
+    if (++fastrand_nbits < 32)
+        return;
+    fastrand_s[fastrand_noise & 3] ^= fastrand_noise;
+    if ((fastrand_s[0] | fastrand_s[1] | fastrand_s[2] | fastrand_s[3]) == 0)
+        fastrand_s[0] = 1;
+    (void) fastrand_next();
+    fastrand_nbits = 0;
+    fastrand_draws = 0;
+}
+
+// listen briefly in LoRa continuous RX and fold wideband-RSSI noise in
+// until one word has been mixed. The radio must be in LoRa standby with
+// its IRQs masked; it's left in standby.
+static void fastrand_listen () {
+    opmode(OPMODE_RX);
+    hal_waitUntil(os_getTime() + SX127X_RX_POWER_UP);
+    for (u2_t i = 0; i < 256 && fastrand_draws != 0; ++i) {
+        // keep only non-identical subsequent least-significant bits
+        u1_t const b = readReg(LORARegRssiWideband) & 0x01;
+        if (b != (readReg(LORARegRssiWideband) & 0x01))
+            fastrand_stir(b);
+    }
+    opmode(OPMODE_STANDBY);
+}
+
+// return next fast random byte
+u1_t radio_fastrand1 () {
+    if (fastrand_left == 0) {
+        fastrand_out = fastrand_next();
+        fastrand_left = 4;
+    }
+    u1_t const v = (u1_t) fastrand_out;
+    fastrand_out >>= 8;
+    --fastrand_left;
+    if (fastrand_draws < FASTRAND_RESEED_DRAWS)
+        ++fastrand_draws;
+    return v;
+}
+
 //! \brief Initialize radio at system startup.
 //!
 //! \details This procedure is called during initialization by the `os_init()`
@@ -1654,6 +2701,7 @@ int radio_init () {
     hal_waitUntil(os_getTime()+ms2osticks(1)); // wait >100us
     hal_pin_rst(2); // configure RST pin floating!
     hal_waitUntil(os_getTime()+ms2osticks(5)); // wait 5ms
+    syncOpmode();
 
     opmode(OPMODE_SLEEP);
 
@@ -1683,6 +2731,7 @@ int radio_init () {
         }
     }
     randbuf[0] = 16; // set initial index
+    fastrand_seed();
 
 #ifdef CFG_sx1276mb1_board
     // chain calibration
@@ -1748,6 +2797,7 @@ void radio_monitor_rssi(ostime_t nTicks, oslmic_radio_rssi_t *pRssi) {
     int rssiAdjust;
     ostime_t tBegin;
     int notDone;
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_RSSI);
 
     rxlora(RXMODE_SCAN);
 
@@ -1793,6 +2843,10 @@ void radio_monitor_rssi(ostime_t nTicks, oslmic_radio_rssi_t *pRssi) {
 
         u1_t rssiNow = readReg(LORARegRssiValue);
 
+        // we're listening anyway; top up the fast generator's entropy.
+        if (fastrand_draws >= FASTRAND_RESEED_DRAWS)
+            fastrand_stir(readReg(LORARegRssiWideband));
+
         if (rssiMax < rssiNow)
                 rssiMax = rssiNow;
         if (rssiNow < rssiMin)
@@ -1811,6 +2865,39 @@ void radio_monitor_rssi(ostime_t nTicks, oslmic_radio_rssi_t *pRssi) {
     pRssi->min_rssi = (s2_t) (rssiMin + rssiAdjust);
     pRssi->mean_rssi = (s2_t) (rssiAdjust + ((rssiSum + (rssiN >> 1)) / rssiN));
     pRssi->n_rssi = rssiN;
+    spiphase(spiOuter);
+}
+
+// the LoRa status registers the IRQ handler reads in one burst.
+#define LORA_RXSTAT_FIRST       LORARegFifoRxCurrentAddr
+#define LORA_RXSTAT_LAST        LORARegModemConfig1
+#define LORA_RXSTAT(buf, reg)   ((buf)[(reg) - LORA_RXSTAT_FIRST])
+
+// Read the received frame (LMIC.dataLen bytes) from the FIFO. Data
+// downlinks for another DevAddr are dropped after reading only MHDR and
+// DevAddr; decodeFrame() would reject them anyway, so don't spend SPI time
+// on their payload. Beacons (implicit header) and frames received before
+// joining are always read in full, as is anything outside a MAC receive
+// window.
+static void rxreadframe () {
+    u1_t const len = LMIC.dataLen;
+
+    if (rxmacwindow && len > OFF_DAT_OPTS && LMIC.devaddr != 0 && getIh(LMIC.rps) == 0) {
+        readBuf(RegFifo, LMIC.frame, OFF_DAT_FCT);
+
+        u1_t const ftype = LMIC.frame[0] & HDR_FTYPE;
+        if ((ftype == HDR_FTYPE_DADN || ftype == HDR_FTYPE_DCDN) &&
+            os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]) != LMIC.devaddr) {
+            LMICOS_logEventUint32("rxreadframe: wrong address", os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]));
+            LMIC.dataLen = 0;
+            ++LMIC.radio.rxfilter_count;
+            return;
+        }
+        // the FIFO pointer has advanced; read the rest.
+        readBuf(RegFifo, LMIC.frame + OFF_DAT_FCT, len - OFF_DAT_FCT);
+    } else {
+        readBuf(RegFifo, LMIC.frame, len);
+    }
 }
 
 static CONST_TABLE(u2_t, LORA_RXDONE_FIXUP)[] = {
@@ -1829,7 +2916,15 @@ void radio_irq_handler (u1_t dio) {
     radio_irq_handler_v2(dio, os_getTime());
 }
 
+static void irqhandler (u1_t dio, ostime_t now);
+
 void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
+    u1_t const spiOuter = spiphase(LMIC_SPI_PHASE_IRQ);
+    irqhandler(dio, now);
+    spiphase(spiOuter);
+}
+
+static void irqhandler (u1_t dio, ostime_t now) {
     LMIC_API_PARAMETER(dio);
 
 #if CFG_TxContinuousMode
@@ -1850,7 +2945,15 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
 #if LMIC_DEBUG_LEVEL > 0
     ostime_t const entry = now;
 #endif
-    if( (readReg(RegOpMode) & OPMODE_LORA) != 0) { // LORA modem
+    ostime_t const tIrq = os_getTime();
+#if SYSNAME_BTONE_COORD == 1
+    if (btone_active) {
+        // the tone's TxDone is ours; don't disturb the MAC's osjob.
+        btone_done();
+        return;
+    }
+#endif
+    if( (opmode_shadow & OPMODE_LORA) != 0) { // LORA modem
         u1_t flags = readReg(LORARegIrqFlags);
         LMIC.saveIrqFlags = flags;
         LMICOS_logEventUint32("radio_irq_handler_v2: LoRa", flags);
@@ -1859,21 +2962,28 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
             // save exact tx time
             LMIC.txend = now - us2osticks(43); // TXDONE FIXUP
         } else if( flags & IRQ_LORA_RXDONE_MASK ) {
+            // one burst for FifoRxCurrentAddr .. ModemConfig1; only RxDone
+            // needs these.
+            u1_t stat[LORA_RXSTAT_LAST - LORA_RXSTAT_FIRST + 1];
+            readBuf(LORA_RXSTAT_FIRST, stat, sizeof(stat));
             // save exact rx time
             if(getBw(LMIC.rps) == BW125) {
                 now -= TABLE_GET_U2(LORA_RXDONE_FIXUP, getSf(LMIC.rps));
             }
             LMIC.rxtime = now;
             // read the PDU and inform the MAC that we received something
-            LMIC.dataLen = (readReg(LORARegModemConfig1) & SX127X_MC1_IMPLICIT_HEADER_MODE_ON) ?
-                readReg(LORARegPayloadLength) : readReg(LORARegRxNbBytes);
+            // in implicit-header mode, configLoraModem() preset
+            // PayloadLength from the rps, so there's no need to read it back.
+            LMIC.dataLen = (LORA_RXSTAT(stat, LORARegModemConfig1) & SX127X_MC1_IMPLICIT_HEADER_MODE_ON) ?
+                (getIh(LMIC.rps) ? getIh(LMIC.rps) : readReg(LORARegPayloadLength)) :
+                LORA_RXSTAT(stat, LORARegRxNbBytes);
             // set FIFO read address pointer
-            writeReg(LORARegFifoAddrPtr, readReg(LORARegFifoRxCurrentAddr));
+            writeReg(LORARegFifoAddrPtr, LORA_RXSTAT(stat, LORARegFifoRxCurrentAddr));
             // now read the FIFO
-            readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
-            // read rx quality parameters
-            LMIC.snr  = readReg(LORARegPktSnrValue); // SNR [dB] * 4
-            u1_t const rRssi = readReg(LORARegPktRssiValue);
+            rxreadframe();
+            // rx quality parameters
+            LMIC.snr  = (s1_t) LORA_RXSTAT(stat, LORARegPktSnrValue); // SNR [dB] * 4
+            u1_t const rRssi = LORA_RXSTAT(stat, LORARegPktRssiValue);
             s2_t rssi = rRssi;
             if (LMIC.freq > SX127X_FREQ_LF_MAX)
                 rssi += SX127X_RSSI_ADJUST_HF;
@@ -1897,6 +3007,18 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
             // ugh compatibility requires a biased range. RSSI
             // WCSNG: We changed the -196 number to -192 to prevent int8_t underflow
             LMIC.rssi = (s1_t) (RSSI_OFF + (rssi < -192 ? -192 : rssi > 63 ? 63 : rssi)); // RSSI [dBm] (-196...+63)
+#if LMIC_RXRING_DEPTH > 0
+            if (rxring_active) {
+                // keep receiving: clear the flags but leave the mask and
+                // the opmode alone, and let the app know there's data.
+                rxringpush();
+                writeReg(LORARegIrqFlags, 0xFF);
+                os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+                LMIC.radio.irq_ticks += os_getTime() - tIrq;
+                ++LMIC.radio.irq_count;
+                return;
+            }
+#endif
         } else if( flags & IRQ_LORA_RXTOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
@@ -1906,10 +3028,13 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
                 LMIC.rxtime, entry - LMIC.rxtime, now2 - entry, LMIC.rxtime-LMIC.txend);
 #endif
         }
-        // mask all radio IRQs
-        writeReg(LORARegIrqFlagsMask, 0xFF);
-        // clear radio IRQ flags
-        writeReg(LORARegIrqFlags, 0xFF);
+        // mask all radio IRQs and clear radio IRQ flags (adjacent registers)
+        u1_t maskAndClear[2] = { 0xFF, 0xFF };
+        writeBuf(LORARegIrqFlagsMask, maskAndClear, 2);
+        // nothing heard and the receiver is still tuned: a good moment to
+        // top up the fast generator.
+        if ((flags & IRQ_LORA_RXTOUT_MASK) && fastrand_draws >= FASTRAND_RESEED_DRAWS)
+            fastrand_listen();
     } else { // FSK modem
         u1_t flags1 = readReg(FSKRegIrqFlags1);
         u1_t flags2 = readReg(FSKRegIrqFlags2);
@@ -1922,10 +3047,10 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
         } else if( flags2 & IRQ_FSK2_PAYLOADREADY_MASK ) {
             // save exact rx time
             LMIC.rxtime = now;
-            // read the PDU and inform the MAC that we received something
-            LMIC.dataLen = readReg(FSKRegPayloadLength);
-            // now read the FIFO
-            readBuf(RegFifo, LMIC.frame, LMIC.dataLen);
+            // read what's left of the PDU (the length byte leads, in
+            // variable-length mode) and inform the MAC that we received something
+            rxfskread(FSK_FIFO_SIZE);
+            LMIC.dataLen = fsk_len;
             // read rx quality parameters
             LMIC.snr  = 0;              // SX127x doesn't give SNR for FSK.
             LMIC.rssi = -64 + RSSI_OFF; // SX127x doesn't give packet RSSI for FSK,
@@ -1933,6 +3058,17 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
         } else if( flags1 & IRQ_FSK1_TIMEOUT_MASK ) {
             // indicate timeout
             LMIC.dataLen = 0;
+        } else if( (flags2 & IRQ_FSK2_FIFOLEVEL_MASK) ||
+                   (fsk_haslen && (opmode_shadow & OPMODE_MASK) == OPMODE_RX) ) {
+            // long frame in progress: make room and keep receiving. With
+            // a slow SPI, the FIFO can refill past the threshold while a
+            // chunk is being drained; the edge that latches is stale by
+            // the time we get here, and there's nothing to do.
+            if (flags2 & IRQ_FSK2_FIFOLEVEL_MASK)
+                rxfskread(FSK_RX_FIFO_THRESH + 1);
+            LMIC.radio.irq_ticks += os_getTime() - tIrq;
+            ++LMIC.radio.irq_count;
+            return;
         } else {
             // ASSERT(0);
             // we're not sure why we're here... treat as timeout.
@@ -1944,8 +3080,16 @@ void radio_irq_handler_v2 (u1_t dio, ostime_t now) {
     }
     // go from standby to sleep
     opmode(OPMODE_SLEEP);
+#if SYSNAME_LPL == 1
+    if (lpl_rxactive) {
+        lpl_finish();
+        os_setCallback(&LMIC.sysname_lpl_job, lpl_rxdone);
+    } else
+#endif
     // run os job (use preset func ptr)
     os_setCallback(&LMIC.osjob, LMIC.osjob.func);
+    LMIC.radio.irq_ticks += os_getTime() - tIrq;
+    ++LMIC.radio.irq_count;
 #endif /* ! CFG_TxContinuousMode */
 }
 
@@ -1972,9 +3116,24 @@ function.
 An interrupt will occur when a packet is recieved or the receive times out,
 which will cause `LMIC.osjob` to be scheduled with its current function.
 
+- `RADIO_RXON_RING` (LoRa only, with `LMIC_RXRING_DEPTH` > 0) receives
+continuously without stopping at each frame. Every frame is copied into
+the receive ring and `LMIC.osjob` is scheduled; drain it with
+`LMIC_rxRingPeek()` and `LMIC_rxRingPop()`. `RADIO_RST` stops it.
+
 */
 
 void os_radio (u1_t mode) {
+#if SYSNAME_BTONE_COORD == 1
+    btone_abort();
+#endif
+#if SYSNAME_LPL == 1
+    lpl_abort();
+#endif
+#if LMIC_RXRING_DEPTH > 0
+    rxring_active = 0;
+#endif
+    rxmacwindow = 0;
     switch (mode) {
       case RADIO_RST:
         // put radio to sleep
@@ -1995,6 +3154,7 @@ void os_radio (u1_t mode) {
 
       case RADIO_RX:
         // receive frame now (exactly at rxtime)
+        rxmacwindow = 1;
         startrx(RXMODE_SINGLE); // buf=LMIC.frame, time=LMIC.rxtime, timeout=LMIC.rxsyms
         break;
 
@@ -2002,6 +3162,14 @@ void os_radio (u1_t mode) {
         // start scanning for beacon now
         startrx(RXMODE_SCAN); // buf=LMIC.frame
         break;
+
+#if LMIC_RXRING_DEPTH > 0
+      case RADIO_RXON_RING:
+        // continuous LoRa receive into the ring; stop with RADIO_RST
+        rxring_active = (getSf(LMIC.rps) != FSK);
+        startrx(RXMODE_SCAN);
+        break;
+#endif
     }
 }
 
@@ -0,0 +1,187 @@
+/*
+
+Module:  aggregate.c
+
+Function:
+        Record aggregation (LMIC_queueRecord()): the uplink is decoded
+        from the model and checked for record order across mixed ports,
+        for a length-prefixed payload that still fits the frame limit
+        with an answer pending in FOpts, and for records with deadlines
+        going out when the earliest one passes.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_TXQUEUE_DEPTH=8 -DLMIC_ENABLE_tx_aggregation=1
+
+*/
+
+#include "simnet.h"
+#include "lmic/lmic_bandplan.h"
+
+// 64-byte frames, short enough airtime to keep the duty cycle waits sane.
+enum { TEST_DR = EU868_DR_SF10 };
+
+static volatile int done;
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE)
+                done = 1;
+}
+
+static ostime_t txStart;        // os time the latest uplink started
+
+static void onTx(const sx127x_sim_frame_t *pFrame) {
+        uint64_t const us = sx127x_sim_now_us() - pFrame->start_us;
+
+        txStart = os_getTime() - us2osticks(us);
+        simnet_onTx(pFrame);
+}
+
+static bit_t fRxTimingSetup;
+
+// answer the first uplink with an RXTimingSetupReq, then stay quiet so
+// that the device keeps repeating the answer in FOpts.
+static void reply(const simnet_uplink_t *pUp, simnet_downlink_t *pDown) {
+        LMIC_API_PARAMETER(pUp);
+        if (! fRxTimingSetup)
+                return;
+        fRxTimingSetup = 0;
+        pDown->window = 1;
+        pDown->fopts[0] = MCMD_RXTimingSetupReq;
+        pDown->fopts[1] = 1;
+        pDown->foptsLen = 2;
+}
+
+static void record(u1_t port, u1_t tag, u1_t len, ostime_t deadline) {
+        u1_t data[LMIC_TXQUEUE_MAXLEN];
+
+        for (unsigned i = 0; i < len; ++i)
+                data[i] = (u1_t) (tag + i);
+        SIMTEST_CHECK(LMIC_queueRecord(port, data, len, 0, deadline) == 0,
+                "record %02x refused", tag);
+}
+
+// checks that `pUp` holds exactly the records `tags`/`lens`, in order.
+static void checkRecords(const simnet_uplink_t *pUp, const u1_t *tags, const u1_t *lens,
+                         unsigned n, const char *what) {
+        unsigned off = 0;
+
+        for (unsigned i = 0; i < n; ++i) {
+                SIMTEST_CHECK(off < pUp->len && pUp->data[off] == lens[i],
+                        "%s: record %u: length byte %u, want %u", what, i,
+                        off < pUp->len ? pUp->data[off] : 0, lens[i]);
+                if (off >= pUp->len || pUp->data[off] != lens[i])
+                        return;
+                SIMTEST_CHECK(off + 1 + lens[i] <= pUp->len, "%s: record %u truncated", what, i);
+                SIMTEST_CHECK(pUp->data[off + 1] == tags[i],
+                        "%s: record %u is %02x, want %02x", what, i, pUp->data[off + 1], tags[i]);
+                off += 1 + lens[i];
+        }
+        SIMTEST_CHECK(off == pUp->len, "%s: %u payload bytes, records account for %u",
+                what, pUp->len, off);
+}
+
+static void sendFirst(void) {
+        u1_t payload[1] = { 0 };
+
+        fRxTimingSetup = 1;
+        done = 0;
+        LMIC_setTxData2(1, payload, sizeof(payload), 0);
+        simtest_run_until(&done, 600000000);
+        SIMTEST_CHECK(done && LMIC.macRxTimingSetupAns != 0, "no RXTimingSetupAns pending");
+}
+
+// port 10 records, with port 20 records between them. The fifth port 10
+// record overflows the room left by the pending RXTimingSetupAns, and
+// must wait even though it would fit if FOpts were ignored.
+static void testMixed(void) {
+        static const u1_t tags[] = { 0x10, 0x20, 0x30, 0x40 };
+        static const u1_t lens[] = { 9, 9, 9, 9 };
+
+        // clear of the duty cycle, and of the empty uplink the MAC sends
+        // on its own to carry the answer.
+        simtest_run_for(120000000);
+        unsigned const first = simnet.nUp;
+        done = 0;
+        record(10, 0x10, 9, 0);
+        record(20, 0xB0, 4, 0);
+        record(10, 0x20, 9, 0);
+        record(10, 0x30, 9, 0);
+        record(20, 0xC0, 4, 0);
+        record(10, 0x40, 9, 0);
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 6 && ! done, "sent before the uplink was full");
+        record(10, 0x50, 10, 0);
+        simtest_run_until(&done, 600000000);
+
+        SIMTEST_CHECK(simnet.nUp == first + 1, "%u uplinks", simnet.nUp - first);
+        simnet_uplink_t const * const pUp = simnet_last();
+        if (pUp == NULL)
+                return;
+        u1_t const maxLen = LMICbandplan_maxFrameLen(TEST_DR);
+        printf("  port %d, %u payload bytes, %u FOpts bytes, frame %u of %u\n",
+                pUp->port, pUp->len, pUp->foptsLen, pUp->frame.len, maxLen);
+        SIMTEST_CHECK(pUp->port == 10, "sent on port %d", pUp->port);
+        SIMTEST_CHECK(pUp->foptsLen == 1 && pUp->fopts[0] == MCMD_RXTimingSetupAns,
+                "FOpts %u bytes, first %02x", pUp->foptsLen, pUp->fopts[0]);
+        SIMTEST_CHECK(pUp->frame.len <= maxLen, "frame %u bytes, limit %u", pUp->frame.len, maxLen);
+        checkRecords(pUp, tags, lens, 4, "mixed");
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 3, "%u left queued", LMIC_getTxQueueCount());
+        LMIC_clearTxQueue();
+}
+
+// two ports, neither full; each goes when its deadline passes, the
+// earlier one first.
+static void testDeadline(void) {
+        static const u1_t tagA[] = { 0x60 }, lenA[] = { 3 };
+        static const u1_t tagB[] = { 0x70 }, lenB[] = { 5 };
+        unsigned const first = simnet.nUp;
+
+        simtest_run_for(120000000);
+        ostime_t const now = os_getTime();
+        ostime_t const dlB = now + sec2osticks(90);
+        ostime_t const dlA = now + sec2osticks(10);
+
+        record(31, 0x70, 5, dlB);
+        record(30, 0x60, 3, dlA);
+        simtest_run_for(5000000);
+        SIMTEST_CHECK(simnet.nUp == first, "sent before any deadline");
+
+        done = 0;
+        simtest_run_until(&done, 60000000);
+        SIMTEST_CHECK(simnet.nUp == first + 1, "%u uplinks by the first deadline", simnet.nUp - first);
+        if (simnet.nUp != first + 1)
+                return;
+        s4_t const lateA = osticks2us(txStart - dlA);
+        checkRecords(&simnet.up[first], tagA, lenA, 1, "first deadline");
+        SIMTEST_CHECK(simnet.up[first].port == 30, "first deadline: port %d", simnet.up[first].port);
+
+        done = 0;
+        simtest_run_until(&done, 120000000);
+        SIMTEST_CHECK(simnet.nUp == first + 2, "%u uplinks by the second deadline", simnet.nUp - first);
+        if (simnet.nUp != first + 2)
+                return;
+        s4_t const lateB = osticks2us(txStart - dlB);
+        checkRecords(&simnet.up[first + 1], tagB, lenB, 1, "second deadline");
+
+        printf("  sent %d us and %d us after the deadlines\n", (int) lateA, (int) lateB);
+        SIMTEST_CHECK(lateA >= 0 && lateA < 50000, "first record sent %d us after its deadline", (int) lateA);
+        SIMTEST_CHECK(lateB >= 0 && lateB < 50000, "second record sent %d us after its deadline", (int) lateB);
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 0, "%u left queued", LMIC_getTxQueueCount());
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+        LMIC_setDrTxpow(TEST_DR, 14);
+        LMIC.sysname_tx_rps = makeRps(SF10, BW125, CR_4_5, 0, 0);
+        sx127x_sim_set_tx_hook(onTx);
+        simnet.reply = reply;
+
+        sendFirst();
+        printf("mixed ports\n");
+        testMixed();
+        printf("deadlines\n");
+        testDeadline();
+        return simtest_exit();
+}
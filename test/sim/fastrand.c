@@ -0,0 +1,169 @@
+/*
+
+Module:  fastrand.c
+
+Function:
+        Speed and quality of the fast generator behind os_getFastRndU1(),
+        and a check that it's reseeded from wideband noise when a receive
+        window times out.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_us915=1
+
+*/
+
+#include "simtest.h"
+
+#include <math.h>
+
+enum { N_BYTES = 1 << 20 };
+
+static volatile int done;
+
+static void onDone(osjob_t *j) {
+        LMIC_API_PARAMETER(j);
+        done = 1;
+}
+
+static volatile u1_t sink;
+
+static double drawsPerSecond(u1_t (*pDraw)(void), unsigned n) {
+        u1_t acc = 0;
+        double const t0 = simtest_cpu_seconds();
+
+        for (unsigned i = 0; i < n; ++i)
+                acc ^= pDraw();
+        sink = acc;
+        return n / (simtest_cpu_seconds() - t0);
+}
+
+static u1_t fastDraw(void) { return os_getFastRndU1(); }
+static u1_t aesDraw(void) { return os_getRndU1(); }
+
+static void testSpeed(void) {
+        double const fast = drawsPerSecond(fastDraw, 16 * N_BYTES);
+        double const aes = drawsPerSecond(aesDraw, N_BYTES);
+
+        printf("  os_getFastRndU1: %.1f Mdraws/s\n", fast / 1e6);
+        printf("  os_getRndU1:     %.1f Mdraws/s (%.1fx slower)\n", aes / 1e6, fast / aes);
+        SIMTEST_CHECK(fast > aes, "the fast generator is slower than AES");
+}
+
+// The limits below are about 4 standard deviations out; a good generator
+// fails one of them a few times in 100000 runs.
+static void testQuality(void) {
+        static u1_t buf[N_BYTES];
+        unsigned bytes[256] = { 0 };
+        unsigned pairs[256] = { 0 };
+        unsigned bits[8] = { 0 };
+        unsigned runs = 1;
+        double sxy = 0, sx = 0, sxx = 0;
+
+        for (unsigned i = 0; i < N_BYTES; ++i)
+                buf[i] = os_getFastRndU1();
+
+        for (unsigned i = 0; i < N_BYTES; ++i) {
+                u1_t const v = buf[i];
+
+                ++bytes[v];
+                for (unsigned b = 0; b < 8; ++b)
+                        bits[b] += (v >> b) & 1;
+                if (i != 0) {
+                        // high nibbles of adjacent bytes
+                        ++pairs[(buf[i - 1] & 0xF0) | (v >> 4)];
+                        sxy += (double) buf[i - 1] * v;
+                        if ((buf[i - 1] & 1) != (v & 1))
+                                ++runs;
+                }
+                sx += v;
+                sxx += (double) v * v;
+        }
+
+        // byte frequencies: chi-square with 255 degrees of freedom
+        double chi = 0, chiPairs = 0;
+        double const eBytes = N_BYTES / 256.0;
+        double const ePairs = (N_BYTES - 1) / 256.0;
+        for (unsigned i = 0; i < 256; ++i) {
+                chi += (bytes[i] - eBytes) * (bytes[i] - eBytes) / eBytes;
+                chiPairs += (pairs[i] - ePairs) * (pairs[i] - ePairs) / ePairs;
+        }
+        printf("  chi-square: bytes %.1f, nibble pairs %.1f (255 dof)\n", chi, chiPairs);
+        SIMTEST_CHECK(chi < 350, "byte chi-square %.1f", chi);
+        SIMTEST_CHECK(chiPairs < 350, "pair chi-square %.1f", chiPairs);
+
+        // each bit position set half the time
+        double const sdBit = sqrt(N_BYTES / 4.0);
+        for (unsigned b = 0; b < 8; ++b) {
+                double const z = (bits[b] - N_BYTES / 2.0) / sdBit;
+                SIMTEST_CHECK(fabs(z) < 4.5, "bit %u set %u times (z %.2f)", b, bits[b], z);
+        }
+
+        // runs of equal LSBs
+        double const zRuns = (runs - N_BYTES / 2.0) / sdBit;
+        SIMTEST_CHECK(fabs(zRuns) < 4.5, "%u LSB runs (z %.2f)", runs, zRuns);
+
+        // lag-1 serial correlation of the byte values
+        double const n = N_BYTES;
+        double const mean = sx / n;
+        double const r = (sxy / (n - 1) - mean * mean) / (sxx / n - mean * mean);
+        printf("  lag-1 correlation %.5f, LSB runs z %.2f\n", r, zRuns);
+        SIMTEST_CHECK(fabs(r) < 4.5 / sqrt(n), "lag-1 correlation %.5f", r);
+}
+
+// let a receive window open and time out with nothing on the air.
+static void emptyWindow(void) {
+        LMIC.freq = 923300000;
+        LMIC.rps = makeRps(SF7, BW500, CR_4_5, 0, 0);
+        LMIC.rxsyms = 8;
+        LMIC.rxtime = os_getTime() + ms2osticks(5);
+        done = 0;
+        LMIC.osjob.func = onDone;
+        os_radio(RADIO_RX);
+        simtest_run_until(&done, 1000000);
+        SIMTEST_CHECK(done && LMIC.dataLen == 0, "the window didn't time out");
+}
+
+// power up, draw `nDraws` bytes, optionally let a window time out, and
+// return the next 16 bytes.
+static void drawAfter(unsigned nDraws, int window, u1_t out[16]) {
+        simtest_init();
+        for (unsigned i = 0; i < nDraws; ++i)
+                (void) os_getFastRndU1();
+        if (window)
+                emptyWindow();
+        for (unsigned i = 0; i < 16; ++i)
+                out[i] = os_getFastRndU1();
+}
+
+static void testReseed(void) {
+        u1_t plain[16], again[16], early[16], reseeded[16];
+
+        // the model's noise is repeatable, so the same history gives the
+        // same output...
+        drawAfter(2000, 0, plain);
+        drawAfter(2000, 0, again);
+        SIMTEST_CHECK(memcmp(plain, again, 16) == 0, "the model isn't repeatable");
+
+        // ...and a window before the reseed is due changes nothing...
+        drawAfter(500, 1, early);
+        drawAfter(500, 0, again);
+        SIMTEST_CHECK(memcmp(early, again, 16) == 0, "reseeded before it was due");
+
+        // ...but once it's due, an empty window folds in fresh noise.
+        drawAfter(2000, 1, reseeded);
+        SIMTEST_CHECK(memcmp(plain, reseeded, 16) != 0, "not reseeded after an empty window");
+}
+
+int main(void) {
+        simtest_init();
+
+        printf("speed\n");
+        testSpeed();
+        printf("quality\n");
+        testQuality();
+        printf("reseed\n");
+        testReseed();
+        return simtest_exit();
+}
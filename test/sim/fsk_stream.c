@@ -0,0 +1,157 @@
+/*
+
+Module:  fsk_stream.c
+
+Function:
+        Timing validation for FSK frames longer than the 64-byte FIFO:
+        255-byte frames at 50 kbps, sent and received through the
+        FifoLevel-driven refill and drain in radio.c.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1
+
+*/
+
+#include "simtest.h"
+
+enum { FRAME_LEN = 255 };
+
+// preamble (5) + sync word (3) + length byte + payload + CRC (2), at
+// 160 us per byte.
+static uint64_t fskAirUs(u1_t len) {
+        return (uint64_t)(5 + 3 + 1 + len + 2) * 160;
+}
+
+static volatile int done;
+static uint64_t tDone;
+
+static void onDone(osjob_t *j) {
+        LMIC_API_PARAMETER(j);
+        tDone = sx127x_sim_now_us();
+        done = 1;
+}
+
+static sx127x_sim_frame_t txSeen;
+static int nTx;
+
+static void onTx(const sx127x_sim_frame_t *pFrame) {
+        txSeen = *pFrame;
+        ++nTx;
+}
+
+static u1_t pattern(unsigned i, u1_t seed) {
+        return (u1_t)(i * 7 + seed);
+}
+
+static void setupFsk(void) {
+        LMIC.freq = 868800000;
+        LMIC.rps = LMIC.sysname_tx_rps = makeRps(FSK, BW125, CR_4_5, 0, 0);
+        LMIC.txpow = 14;
+}
+
+static void testTx(u1_t seed) {
+        setupFsk();
+        for (unsigned i = 0; i < FRAME_LEN; ++i)
+                LMIC.frame[i] = pattern(i, seed);
+        LMIC.dataLen = FRAME_LEN;
+
+        sx127x_sim_clear_stats();
+        nTx = 0;
+        done = 0;
+        LMIC.osjob.func = onDone;
+        os_radio(RADIO_TX);
+        simtest_run_until(&done, 1000000);
+
+        SIMTEST_CHECK(done, "TX didn't complete");
+        SIMTEST_CHECK(nTx == 1, "%d frames on the air", nTx);
+        SIMTEST_CHECK(sx127x_sim_get_stats()->fsk_underruns == 0,
+                "%u underruns", sx127x_sim_get_stats()->fsk_underruns);
+        SIMTEST_CHECK(txSeen.len == FRAME_LEN, "sent %u bytes", txSeen.len);
+
+        unsigned nBad = 0;
+        for (unsigned i = 0; i < txSeen.len; ++i)
+                if (txSeen.data[i] != pattern(i, seed))
+                        ++nBad;
+        SIMTEST_CHECK(nBad == 0, "%u bytes differ", nBad);
+
+        // PacketSent comes at the end of the CRC; the job runs right after.
+        uint64_t const tEnd = txSeen.start_us + fskAirUs(FRAME_LEN);
+        ostime_t const dt = LMIC.txend - us2osticks(tEnd);
+        SIMTEST_CHECK(dt >= -1 && dt <= 1, "txend is %d ticks off", (int) dt);
+        SIMTEST_CHECK(tDone >= tEnd && tDone - tEnd < 1000,
+                "done %llu us after the frame end", (unsigned long long)(tDone - tEnd));
+        printf("  TX: %u bytes in %llu us on air, done +%llu us\n",
+                txSeen.len, (unsigned long long)(tEnd - txSeen.start_us),
+                (unsigned long long)(tDone - tEnd));
+}
+
+static void testRx(u1_t seed) {
+        sx127x_sim_frame_t f;
+
+        setupFsk();
+        memset(&f, 0, sizeof(f));
+        // late enough for the slowest SPI to finish setting up the receiver
+        f.start_us = sx127x_sim_now_us() + 5000;
+        f.freq = LMIC.freq;
+        f.rps = FSK;
+        f.rssi = -70;
+        f.len = FRAME_LEN;
+        for (unsigned i = 0; i < FRAME_LEN; ++i)
+                f.data[i] = pattern(i, seed);
+        SIMTEST_CHECK(sx127x_sim_inject(&f) == 0, "inject failed");
+
+        sx127x_sim_clear_stats();
+        done = 0;
+        LMIC.osjob.func = onDone;
+        LMIC.rxtime = os_getTime();
+        os_radio(RADIO_RX);
+        simtest_run_until(&done, 1000000);
+
+        SIMTEST_CHECK(done, "RX didn't complete");
+        SIMTEST_CHECK(sx127x_sim_get_stats()->fsk_overruns == 0,
+                "%u overruns", sx127x_sim_get_stats()->fsk_overruns);
+        SIMTEST_CHECK(LMIC.dataLen == FRAME_LEN, "received %u bytes", LMIC.dataLen);
+
+        unsigned nBad = 0;
+        for (unsigned i = 0; i < LMIC.dataLen; ++i)
+                if (LMIC.frame[i] != pattern(i, seed))
+                        ++nBad;
+        SIMTEST_CHECK(nBad == 0, "%u bytes differ", nBad);
+
+        // the timestamp comes from the PayloadReady edge, however long the
+        // SPI then takes to drain the FIFO.
+        uint64_t const tEnd = f.start_us + fskAirUs(FRAME_LEN);
+        ostime_t const dt = LMIC.rxtime - us2osticks(tEnd);
+        SIMTEST_CHECK(dt >= -1 && dt <= 1, "rxtime is %d ticks off", (int) dt);
+        SIMTEST_CHECK(tDone >= tEnd && tDone - tEnd < 5000,
+                "done %llu us after the frame end", (unsigned long long)(tDone - tEnd));
+        printf("  RX: %u bytes, rxtime %+d ticks, done +%llu us after the frame end\n",
+                LMIC.dataLen, (int) dt, (unsigned long long)(tDone - tEnd));
+}
+
+int main(void) {
+        // SPI clock and per-transaction overhead: the model's default, and
+        // two slower hosts. The FIFO has to keep up with all of them.
+        static const struct { u4_t hz; u2_t overheadUs; } spi[] = {
+                { 0, 0 },
+                { 1000000, 20 },
+                { 250000, 50 },
+        };
+
+        simtest_init();
+        sx127x_sim_set_tx_hook(onTx);
+
+        for (unsigned i = 0; i < sizeof(spi) / sizeof(spi[0]); ++i) {
+                if (spi[i].hz != 0) {
+                        sx127x_sim_set_spi_timing(spi[i].hz, spi[i].overheadUs);
+                        printf("SPI %u Hz, %u us per transaction\n", spi[i].hz, spi[i].overheadUs);
+                } else {
+                        printf("SPI at the model's default timing\n");
+                }
+                testTx((u1_t) i);
+                testRx((u1_t) (i + 0x40));
+        }
+        return simtest_exit();
+}
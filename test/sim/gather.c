@@ -0,0 +1,180 @@
+/*
+
+Module:  gather.c
+
+Function:
+        Gathered uplinks (LMIC_sendSegments()): a confirmed uplink whose
+        first attempt goes unanswered has to carry the same plaintext on
+        the retry, and the segments have to be handed back (pendTxNSegs
+        cleared) however the uplink ends: sent, length error, dropped by
+        channel access, or LMIC_clrTxData().
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_ENABLE_tx_gather=1
+
+*/
+
+#include "simnet.h"
+
+static volatile int done;
+static u1_t cadResult;          // cleared again right after the event
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE || ev == EV_TXCANCELED) {
+                cadResult = LMIC.sysname_cad_result;
+                done = 1;
+        }
+}
+
+static int fSuccess;
+
+static void LMIC_ABI_STD onTxMessage(void *pUserData, int fOk) {
+        LMIC_API_PARAMETER(pUserData);
+        fSuccess = fOk;
+}
+
+static unsigned nToMiss;
+
+static void reply(const simnet_uplink_t *pUp, simnet_downlink_t *pDown) {
+        if ((pUp->mhdr & HDR_FTYPE) != HDR_FTYPE_DCUP)
+                return;
+        if (nToMiss != 0) {
+                --nToMiss;
+                return;
+        }
+        pDown->window = 1;
+        pDown->fctrl = FCT_ACK;
+}
+
+static u1_t hdr[3] = { 0x01, 0x02, 0x03 };
+static u1_t body[20];
+static u1_t crc[2] = { 0xC0, 0xFE };
+static lmic_txseg_t const segs[] = {
+        { hdr, sizeof(hdr) }, { body, sizeof(body) }, { crc, sizeof(crc) },
+};
+enum { NSEGS = sizeof(segs) / sizeof(segs[0]) };
+enum { PLEN = sizeof(hdr) + sizeof(body) + sizeof(crc) };
+
+static lmic_tx_error_t send(u1_t confirmed) {
+        done = 0;
+        fSuccess = -1;
+        return LMIC_sendSegments(5, segs, NSEGS, confirmed, onTxMessage, NULL);
+}
+
+static unsigned nWrong(const simnet_uplink_t *pUp) {
+        u1_t want[PLEN];
+        unsigned n = 0;
+
+        memcpy(want, hdr, sizeof(hdr));
+        memcpy(want + sizeof(hdr), body, sizeof(body));
+        memcpy(want + sizeof(hdr) + sizeof(body), crc, sizeof(crc));
+        if (pUp->len != PLEN)
+                return PLEN;
+        for (unsigned i = 0; i < PLEN; ++i)
+                n += pUp->data[i] != want[i];
+        return n;
+}
+
+static void testRetry(void) {
+        unsigned const first = simnet.nUp;
+
+        nToMiss = 1;
+        SIMTEST_CHECK(send(1) == 0, "uplink refused");
+        simtest_run_until(&done, 600000000);
+
+        SIMTEST_CHECK(done && fSuccess == 1, "callback %d", fSuccess);
+        SIMTEST_CHECK(simnet.nUp == first + 2, "%u attempts", simnet.nUp - first);
+        if (simnet.nUp != first + 2)
+                return;
+        simnet_uplink_t const * const a = &simnet.up[first];
+        simnet_uplink_t const * const b = &simnet.up[first + 1];
+        SIMTEST_CHECK(a->fcnt == b->fcnt, "retry has FCnt %u, first attempt %u", b->fcnt, a->fcnt);
+        SIMTEST_CHECK(a->port == 5 && nWrong(a) == 0, "first attempt: port %d, %u bytes wrong", a->port, nWrong(a));
+        SIMTEST_CHECK(b->port == 5 && nWrong(b) == 0, "retry: port %d, %u bytes wrong", b->port, nWrong(b));
+        SIMTEST_CHECK(hdr[0] == 0x01 && crc[1] == 0xFE && body[19] == 19, "segments changed");
+        SIMTEST_CHECK(LMIC.pendTxNSegs == 0, "sent: %u segments still held", LMIC.pendTxNSegs);
+        printf("  %u segments, %u bytes, FCnt %u sent twice\n", NSEGS, PLEN, a->fcnt);
+}
+
+// queued behind the duty cycle, then cancelled.
+static void testClear(void) {
+        SIMTEST_CHECK(send(0) == 0, "uplink refused");
+        SIMTEST_CHECK((LMIC.opmode & OP_TXDATA) != 0 && (LMIC.opmode & OP_TXRXPEND) == 0,
+                "not waiting for the duty cycle");
+        LMIC_clrTxData();
+        SIMTEST_CHECK(done && fSuccess == 0, "cancel: event %d, callback %d", done, fSuccess);
+        SIMTEST_CHECK(LMIC.pendTxNSegs == 0, "cancelled: %u segments still held", LMIC.pendTxNSegs);
+}
+
+// queued behind the duty cycle at SF7; by the time it is built, the data
+// rate only allows 64-byte frames.
+static void testLength(void) {
+        static u1_t big[100];
+        static lmic_txseg_t const bigSegs[] = { { big, 50 }, { big + 50, 50 } };
+        unsigned const first = simnet.nUp;
+
+        done = 0;
+        fSuccess = -1;
+        SIMTEST_CHECK(LMIC_sendSegments(5, bigSegs, 2, 0, onTxMessage, NULL) == 0, "uplink refused");
+        SIMTEST_CHECK((LMIC.opmode & OP_TXRXPEND) == 0, "already sending");
+        LMIC_setDrTxpow(EU868_DR_SF12, 14);
+        simtest_run_until(&done, 60000000);
+
+        SIMTEST_CHECK(done && fSuccess == 0, "length error: event %d, callback %d", done, fSuccess);
+        SIMTEST_CHECK((LMIC.txrxFlags & TXRX_LENERR) != 0, "flags %02x", LMIC.txrxFlags);
+        SIMTEST_CHECK(simnet.nUp == first, "sent anyway");
+        SIMTEST_CHECK(LMIC.pendTxNSegs == 0, "length error: %u segments still held", LMIC.pendTxNSegs);
+        LMIC_setDrTxpow(EU868_DR_SF7, 14);
+}
+
+// another node's SF12 frame holds the channel; one busy CAD and the
+// uplink is dropped.
+static void testDropped(void) {
+        sx127x_sim_frame_t f;
+        unsigned const first = simnet.nUp;
+
+        simtest_run_for(30000000);
+        LMIC.sysname_enable_cad = 1;
+        LMIC.sysname_csma_algo = 0;
+        LMIC.sysname_cad_difs = 1;
+        LMIC.sysname_cad_freq_vec[0] = 868100000;
+        LMIC.sysname_cad_rps = makeRps(SF12, BW125, CR_4_5, 0, 0);
+        LMIC.sysname_cad_maxtries = 1;
+        LMIC.sysname_cad_fallback = SYSNAME_CAD_FALLBACK_DROP;
+
+        memset(&f, 0, sizeof(f));
+        f.freq = 868100000;
+        f.rps = makeRps(SF12, BW125, CR_4_5, 0, 0);
+        f.len = 200;
+        f.start_us = sx127x_sim_now_us();
+        f.rssi = -60;
+        SIMTEST_CHECK(sx127x_sim_inject(&f) == 0, "no room to inject");
+
+        SIMTEST_CHECK(send(0) == 0, "uplink refused");
+        simtest_run_until(&done, 10000000);
+        SIMTEST_CHECK(done && fSuccess == 0, "dropped: event %d, callback %d", done, fSuccess);
+        SIMTEST_CHECK(cadResult == SYSNAME_CAD_DROPPED, "channel access result %u", cadResult);
+        SIMTEST_CHECK(simnet.nUp == first, "sent anyway");
+        SIMTEST_CHECK(LMIC.pendTxNSegs == 0, "dropped: %u segments still held", LMIC.pendTxNSegs);
+        LMIC.sysname_enable_cad = 0;
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+        simnet.reply = reply;
+        for (unsigned i = 0; i < sizeof(body); ++i)
+                body[i] = (u1_t) i;
+
+        printf("confirmed, one retry\n");
+        testRetry();
+        printf("LMIC_clrTxData\n");
+        testClear();
+        printf("length error\n");
+        testLength();
+        printf("channel access drop\n");
+        testDropped();
+        return simtest_exit();
+}
@@ -0,0 +1,148 @@
+/*
+
+Module:  implicit.c
+
+Function:
+        Raw-mode implicit header (LMIC_setRawImplicitHeader()): airtime
+        and throughput against explicit header for the same payloads, as
+        measured on the model, and the length rules: short raw frames are
+        padded, long ones refused, and MAC frames keep the explicit header.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1
+
+*/
+
+#include "simnet.h"
+
+static volatile int done;
+
+static void onDone(osjob_t *j) {
+        LMIC_API_PARAMETER(j);
+        done = 1;
+}
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE)
+                done = 1;
+}
+
+static sx127x_sim_frame_t txSeen;
+static uint64_t txEnd;
+static int nTx;
+
+static void onTx(const sx127x_sim_frame_t *pFrame) {
+        txSeen = *pFrame;
+        txEnd = sx127x_sim_now_us();
+        ++nTx;
+}
+
+// send `len` raw bytes at `sf`, implicit header of `ihLen` bytes if
+// non-zero; returns the number of frames that went on the air.
+static int rawTx(sf_t sf, u1_t len, u1_t ihLen) {
+        LMIC.freq = 868100000;
+        LMIC.rps = LMIC.sysname_tx_rps = makeRps(sf, BW125, CR_4_5, 0, 0);
+        LMIC.txpow = 14;
+        SIMTEST_CHECK(LMIC_setRawImplicitHeader(ihLen), "length %u refused", ihLen);
+        for (unsigned i = 0; i < len; ++i)
+                LMIC.frame[i] = (u1_t) (0xA0 + i);
+        LMIC.dataLen = len;
+
+        int const n0 = nTx;
+        done = 0;
+        LMIC.osjob.func = onDone;
+        os_radio(RADIO_TX);
+        simtest_run_until(&done, 5000000);
+        SIMTEST_CHECK(done, "TX didn't complete");
+        return nTx - n0;
+}
+
+static void testAirtime(void) {
+        static const struct { sf_t sf; u1_t sfn; u1_t len; } cases[] = {
+                { SF7, 7, 4 }, { SF7, 7, 10 }, { SF7, 7, 32 },
+                { SF9, 9, 10 }, { SF12, 12, 51 },
+        };
+
+        sx127x_sim_set_tx_hook(onTx);
+        for (unsigned i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+                u1_t const len = cases[i].len;
+                uint64_t t[2];
+
+                for (unsigned ih = 0; ih < 2; ++ih) {
+                        rawTx(cases[i].sf, len, ih ? len : 0);
+                        t[ih] = txEnd - txSeen.start_us;
+
+                        u4_t const want = LMIC_LORA_AIRTIME_US(cases[i].sfn, 125, 1, ih, 1, len);
+                        // the model reports the header mode, not the length
+                        SIMTEST_CHECK((getIh(txSeen.rps) != 0) == ih, "sent with IH %u", getIh(txSeen.rps));
+                        SIMTEST_CHECK(t[ih] + 1 >= want && t[ih] <= want + 1,
+                                "SF%u %u bytes ih %u: %llu us on air, macro says %u",
+                                cases[i].sfn, len, ih, (unsigned long long) t[ih], want);
+                }
+                SIMTEST_CHECK(t[1] <= t[0], "implicit header took longer");
+                printf("  SF%-2u %2u bytes: explicit %6.1f ms %6.0f bit/s, implicit %6.1f ms %6.0f bit/s throughput %+.0f%%\n",
+                        cases[i].sfn, len,
+                        t[0] / 1e3, len * 8e6 / t[0],
+                        t[1] / 1e3, len * 8e6 / t[1],
+                        100.0 * ((double) t[0] / t[1] - 1));
+        }
+        LMIC_setRawImplicitHeader(0);
+}
+
+static void testRawLength(void) {
+        sx127x_sim_set_tx_hook(onTx);
+
+        // short: padded with zeros to the fixed length
+        SIMTEST_CHECK(rawTx(SF7, 6, 10) == 1, "short frame not sent");
+        SIMTEST_CHECK(txSeen.len == 10 && getIh(txSeen.rps) != 0,
+                "short frame sent as %u bytes, IH %u", txSeen.len, getIh(txSeen.rps));
+        unsigned nBad = 0;
+        for (unsigned i = 0; i < txSeen.len; ++i)
+                if (txSeen.data[i] != (i < 6 ? 0xA0 + i : 0))
+                        ++nBad;
+        SIMTEST_CHECK(nBad == 0, "%u bytes of the padded frame are wrong", nBad);
+
+        // long: refused, and the TX completes with nothing sent
+        SIMTEST_CHECK(rawTx(SF7, 12, 10) == 0, "long frame went on the air");
+        SIMTEST_CHECK(LMIC.dataLen == 0, "long frame: dataLen %u", LMIC.dataLen);
+
+        printf("  6 bytes at length 10: sent as %u; 12 bytes: refused\n", txSeen.len);
+        LMIC_setRawImplicitHeader(0);
+}
+
+// the raw setting stays in sysname_tx_rps, but MAC uplinks must still go
+// out with an explicit header, unpadded.
+static void testMacExplicit(void) {
+        u1_t payload[3] = { 1, 2, 3 };
+
+        simnet_session();
+        LMIC_setRawImplicitHeader(10);
+
+        done = 0;
+        LMIC_setTxData2(1, payload, sizeof(payload), 0);
+        simtest_run_until(&done, 10000000);
+
+        simnet_uplink_t const * const pUp = simnet_last();
+        SIMTEST_CHECK(done && pUp != NULL, "no MAC uplink");
+        if (pUp == NULL)
+                return;
+        SIMTEST_CHECK(getIh(pUp->frame.rps) == 0, "MAC uplink sent with IH %u", getIh(pUp->frame.rps));
+        SIMTEST_CHECK(pUp->micOk && pUp->len == sizeof(payload),
+                "MAC uplink: MIC %s, %u payload bytes", pUp->micOk ? "ok" : "bad", pUp->len);
+        SIMTEST_CHECK(getIh(LMIC.sysname_tx_rps) == 10, "raw setting lost: IH %u", getIh(LMIC.sysname_tx_rps));
+        printf("  MAC uplink with raw length 10 set: %u bytes, explicit header\n", pUp->frame.len);
+}
+
+int main(void) {
+        simtest_init();
+
+        printf("airtime\n");
+        testAirtime();
+        printf("raw length\n");
+        testRawLength();
+        printf("MAC frames\n");
+        testMacExplicit();
+        return simtest_exit();
+}
@@ -0,0 +1,171 @@
+/*
+
+Module:  mcmd_bench.c
+
+Function:
+        Host benchmark of MAC command decoding through scan_mac_cmds():
+        FOpts and port-0 payloads carrying batches of LinkADRReq,
+        NewChannelReq and DlChannelReq. Also checks the answers, and that
+        a LinkADRReq block whose answers don't all fit is left unapplied.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1
+
+*/
+
+// scan_mac_cmds() is static. lmic.c must come first: it sets up
+// LMIC_DR_LEGACY before lmic.h is seen.
+#include "lmic/lmic.c"
+#include "simtest.h"
+
+enum { N_DECODES = 200000 };
+
+typedef struct {
+        const char *name;
+        int port;               // -1 for FOpts
+        u1_t len;
+        u1_t nCmds;
+        u1_t ansLen;            // expected answer bytes
+        u1_t cmds[MAX_LEN_PAYLOAD];
+} batch_t;
+
+static u1_t putNewChannel(u1_t *p, u1_t ch, u4_t hz) {
+        p[0] = MCMD_NewChannelReq;
+        p[1] = ch;
+        p[2] = (u1_t) (hz / 100);
+        p[3] = (u1_t) (hz / 100 >> 8);
+        p[4] = (u1_t) (hz / 100 >> 16);
+        p[5] = (EU868_DR_SF7 << 4) | EU868_DR_SF12;
+        return 6;
+}
+
+static u1_t putDlChannel(u1_t *p, u1_t ch, u4_t hz) {
+        p[0] = MCMD_DlChannelReq;
+        p[1] = ch;
+        p[2] = (u1_t) (hz / 100);
+        p[3] = (u1_t) (hz / 100 >> 8);
+        p[4] = (u1_t) (hz / 100 >> 16);
+        return 5;
+}
+
+static u1_t putLinkAdr(u1_t *p, u2_t chMask) {
+        p[0] = MCMD_LinkADRReq;
+        p[1] = (EU868_DR_SF9 << MCMD_LinkADRReq_DR_SHIFT) | 1;
+        p[2] = (u1_t) chMask;
+        p[3] = (u1_t) (chMask >> 8);
+        p[4] = 0x01;            // ChMaskCntl 0, NbTrans 1
+        return 5;
+}
+
+static void add(batch_t *b, u1_t n, u1_t ansLen) {
+        b->len += n;
+        ++b->nCmds;
+        b->ansLen += ansLen;
+}
+
+static void makeBatches(batch_t *b) {
+        u4_t const hz[] = { 867100000, 867300000, 867500000, 867700000, 867900000 };
+
+        memset(b, 0, 3 * sizeof(*b));
+
+        // a full FOpts field of LinkADRReq, on the default channels
+        b[0].name = "FOpts, 3 x LinkADRReq";
+        b[0].port = -1;
+        for (unsigned i = 0; i < 3; ++i)
+                add(&b[0], putLinkAdr(b[0].cmds + b[0].len, 0x0007), 2);
+
+        // FOpts defining a channel and its downlink frequency
+        b[1].name = "FOpts, NewChannelReq + DlChannelReq";
+        b[1].port = -1;
+        add(&b[1], putNewChannel(b[1].cmds + b[1].len, 3, hz[0]), 2);
+        add(&b[1], putDlChannel(b[1].cmds + b[1].len, 3, hz[1]), 2);
+
+        // a port-0 plan update: channels, then a mask block, then
+        // downlink frequencies.
+        b[2].name = "port 0, 5 x NewChannelReq + 4 x LinkADRReq + 5 x DlChannelReq";
+        b[2].port = 0;
+        for (unsigned i = 0; i < 5; ++i)
+                add(&b[2], putNewChannel(b[2].cmds + b[2].len, 3 + i, hz[i]), 2);
+        for (unsigned i = 0; i < 4; ++i)
+                add(&b[2], putLinkAdr(b[2].cmds + b[2].len, 0x00FF), 2);
+        for (unsigned i = 0; i < 5; ++i)
+                add(&b[2], putDlChannel(b[2].cmds + b[2].len, 3 + i, hz[4 - i]), 2);
+}
+
+static void resetSession(void) {
+        static const u1_t key[16];
+
+        LMIC_reset();
+        LMIC_setSession(1, 0x1234, (xref2u1_t) key, (xref2u1_t) key);
+        LMIC.macDlChannelAns = 0;
+}
+
+static void checkBatch(const batch_t *b) {
+        resetSession();
+        int const n = scan_mac_cmds(b->cmds, b->len, b->port);
+
+        SIMTEST_CHECK(n == b->len, "%s: decoded %d of %u bytes", b->name, n, b->len);
+        SIMTEST_CHECK(LMIC.pendMacLen == b->ansLen, "%s: %u answer bytes", b->name, LMIC.pendMacLen);
+
+        u1_t const *ans = b->port == 0 ? LMIC.pendTxData : LMIC.pendMacData;
+        for (unsigned i = 0; i + 1 < LMIC.pendMacLen; i += 2) {
+                u1_t const want = ans[i] == MCMD_LinkADRAns ? 0x07 : 0x03;
+                SIMTEST_CHECK(ans[i + 1] == want, "%s: answer %u is %02x %02x",
+                        b->name, i / 2, ans[i], ans[i + 1]);
+        }
+}
+
+static void benchBatch(const batch_t *b) {
+        resetSession();
+
+        double const t0 = simtest_cpu_seconds();
+        for (unsigned i = 0; i < N_DECODES; ++i) {
+                LMIC.macDlChannelAns = 0;
+                (void) scan_mac_cmds(b->cmds, b->len, b->port);
+        }
+        double const dt = simtest_cpu_seconds() - t0;
+
+        printf("  %s (%u bytes): %.0f decodes/s, %.0f ns/command\n",
+                b->name, b->len, N_DECODES / dt, dt * 1e9 / N_DECODES / b->nCmds);
+}
+
+// 4 x DevStatusReq leave 3 bytes of FOpts room, less than the 4 the
+// following 2-command LinkADRReq block needs.
+static void testAdrBlockRoom(void) {
+        u1_t cmds[LWAN_FCtrl_FOptsLen_MAX];
+        u1_t len = 0;
+
+        resetSession();
+        u2_t const mapBefore = LMIC.channelMap;
+
+        for (unsigned i = 0; i < 4; ++i)
+                cmds[len++] = MCMD_DevStatusReq;
+        len += putLinkAdr(cmds + len, 0x0001);
+        len += putLinkAdr(cmds + len, 0x0001);
+
+        int const n = scan_mac_cmds(cmds, len, -1);
+        SIMTEST_CHECK(n == 4, "decoded %d bytes", n);
+        SIMTEST_CHECK(LMIC.pendMacLen == 12, "%u answer bytes", LMIC.pendMacLen);
+        SIMTEST_CHECK(LMIC.channelMap == mapBefore, "channel map %04x, was %04x",
+                LMIC.channelMap, mapBefore);
+}
+
+int main(void) {
+        batch_t batches[3];
+
+        simtest_init();
+        makeBatches(batches);
+
+        printf("answers\n");
+        for (unsigned i = 0; i < 3; ++i)
+                checkBatch(&batches[i]);
+        testAdrBlockRoom();
+
+        printf("speed\n");
+        for (unsigned i = 0; i < 3; ++i)
+                benchBatch(&batches[i]);
+
+        return simtest_exit();
+}
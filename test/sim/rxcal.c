@@ -0,0 +1,127 @@
+/*
+
+Module:  rxcal.c
+
+Function:
+        RX window calibration (LMIC_ENABLE_rx_calibration): downlinks that
+        always arrive the same time after the nominal RX1 start, checked
+        for convergence of the estimate and narrowing of the window, then
+        a missed confirmation, which has to reset the RX1 entry.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_ENABLE_rx_calibration=1
+
+*/
+
+#include "simnet.h"
+
+// downlinks start this long after the nominal RX1 time.
+enum { DOWNLINK_LATE_US = 600 };
+enum { N_CALIBRATE = 24 };
+
+static volatile int done;
+static u1_t rxsymsSeen;
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE) {
+                rxsymsSeen = LMIC.rxsyms;
+                done = 1;
+        }
+}
+
+static lmic_rxcal_t const *rx1Entry(void) {
+        return &LMIC.rxcal[SF7 - SF7][BW125];
+}
+
+static unsigned nMissed;        // confirmed uplinks left unanswered so far
+static unsigned nToMiss;
+static int nAtRetry = -1;       // RX1 entry's sample count when the retry went out
+
+static void reply(const simnet_uplink_t *pUp, simnet_downlink_t *pDown) {
+        bit_t const confirmed = (pUp->mhdr & HDR_FTYPE) == HDR_FTYPE_DCUP;
+
+        if (confirmed && nMissed < nToMiss) {
+                ++nMissed;
+                return;
+        }
+        if (confirmed && nMissed != 0)
+                nAtRetry = rx1Entry()->n;
+        pDown->window = 1;
+        pDown->offset_us = DOWNLINK_LATE_US;
+        pDown->fctrl = confirmed ? FCT_ACK : 0;
+        pDown->port = 1;
+        pDown->len = 1;
+        pDown->data[0] = 0x5A;
+}
+
+static int exchange(u1_t confirmed) {
+        u1_t payload[4] = { 1, 2, 3, 4 };
+
+        done = 0;
+        LMIC.dataLen = 0;
+        SIMTEST_CHECK(LMIC_setTxData2(1, payload, sizeof(payload), confirmed) == LMIC_ERROR_SUCCESS,
+                "uplink refused");
+        simtest_run_until(&done, 600000000);
+        SIMTEST_CHECK(done, "the uplink didn't complete");
+        return done && LMIC.dataLen != 0 && (LMIC.txrxFlags & TXRX_DNW1) != 0;
+}
+
+// returns the window size before calibration.
+static u1_t testConverge(void) {
+        u1_t rxsymsStatic = 0;
+        unsigned nRx1 = 0;
+
+        for (unsigned i = 0; i < N_CALIBRATE; ++i) {
+                nRx1 += exchange(0);
+                if (i == 0)
+                        rxsymsStatic = rxsymsSeen;
+        }
+
+        lmic_rxcal_t const * const e = rx1Entry();
+        ostime_t const want = us2osticksRound(DOWNLINK_LATE_US);
+        printf("  %u/%u downlinks in RX1; offset %d ticks (want %d), spread %u, n %u\n",
+                nRx1, N_CALIBRATE, e->offset, (int) want, e->spread, e->n);
+        printf("  rxsyms %u static, %u calibrated\n", rxsymsStatic, rxsymsSeen);
+
+        SIMTEST_CHECK(nRx1 == N_CALIBRATE, "%u of %u downlinks received in RX1", nRx1, N_CALIBRATE);
+        SIMTEST_CHECK(e->n == N_CALIBRATE, "%u samples", e->n);
+        SIMTEST_CHECK(e->offset >= want - 3 && e->offset <= want + 3,
+                "offset %d ticks, want %d", e->offset, (int) want);
+        // the first sample seeds a spread of half the 2 ms static margin; a
+        // steady offset shrinks it.
+        SIMTEST_CHECK(e->spread < us2osticks(250),
+                "spread %u ticks", e->spread);
+        SIMTEST_CHECK(rxsymsSeen < rxsymsStatic, "window not narrowed: %u symbols, was %u",
+                rxsymsSeen, rxsymsStatic);
+        return rxsymsStatic;
+}
+
+// a confirmed uplink whose first attempt gets nothing back: the retry
+// has to go out with the RX1 entry reset and the static window.
+static void testMissResets(u1_t rxsymsStatic) {
+        nToMiss = 1;
+        int const got = exchange(1);
+
+        printf("  miss: entry n %d at the retry, %u after it; rxsyms %u\n",
+                nAtRetry, rx1Entry()->n, rxsymsSeen);
+        SIMTEST_CHECK(nMissed == 1, "%u attempts unanswered", nMissed);
+        SIMTEST_CHECK(got && (LMIC.txrxFlags & TXRX_ACK) != 0, "the retry wasn't acknowledged");
+        SIMTEST_CHECK(nAtRetry == 0, "RX1 entry had %d samples at the retry", nAtRetry);
+        SIMTEST_CHECK(rx1Entry()->n == 1, "RX1 entry has %u samples after the retry", rx1Entry()->n);
+        SIMTEST_CHECK(rxsymsSeen == rxsymsStatic, "retry window %u symbols, static is %u",
+                rxsymsSeen, rxsymsStatic);
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+        simnet.reply = reply;
+
+        printf("convergence\n");
+        u1_t const rxsymsStatic = testConverge();
+        printf("reset after a miss\n");
+        testMissResets(rxsymsStatic);
+        return simtest_exit();
+}
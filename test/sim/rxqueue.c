@@ -0,0 +1,141 @@
+/*
+
+Module:  rxqueue.c
+
+Function:
+        The receive queue (LMIC_RXQUEUE_DEPTH): downlinks queued before
+        onEvent() sees them, with their frame counter, window, RSSI and
+        SNR; drops while the queue is full or the downlink too long,
+        counted in `lost` of the next entry; and the ring wrapping.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_RXQUEUE_DEPTH=3 -DLMIC_RXQUEUE_MAXLEN=8
+
+*/
+
+#include "simnet.h"
+
+static volatile int done;
+static int countInEvent;        // rxqCount as onEvent(EV_TXCOMPLETE) saw it
+static s1_t rssiInEvent;        // LMIC.rssi, biased by RSSI_OFF
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE) {
+                countInEvent = LMIC.dataLen != 0 && LMIC_rxQueuePeek() != NULL ? LMIC.rxqCount : -1;
+                rssiInEvent = LMIC.rssi;
+                done = 1;
+        }
+}
+
+// what the network sends next, and what it was sent with.
+typedef struct {
+        u1_t window;
+        u1_t port;
+        u1_t len;
+        s2_t rssi;
+        s1_t snr;
+        u2_t fcnt;              // filled in when sent
+        s1_t rssiBiased;        // filled in when received
+} dn_t;
+
+static dn_t *pNext;
+
+static void reply(const simnet_uplink_t *pUp, simnet_downlink_t *pDown) {
+        LMIC_API_PARAMETER(pUp);
+        if (pNext == NULL)
+                return;
+        pNext->fcnt = simnet.fcntDown;
+        pDown->window = pNext->window;
+        pDown->port = pNext->port;
+        pDown->len = pNext->len;
+        for (unsigned i = 0; i < pNext->len; ++i)
+                pDown->data[i] = (u1_t) (pNext->port + i);
+        pDown->rssi = pNext->rssi;
+        pDown->snr = pNext->snr;
+        pNext = NULL;
+}
+
+// one uplink, answered with `*pDn`; returns rxqCount as onEvent saw it.
+static int exchange(dn_t *pDn) {
+        u1_t payload[1] = { 0 };
+
+        pNext = pDn;
+        done = 0;
+        countInEvent = 0;
+        LMIC_setTxData2(1, payload, sizeof(payload), 0);
+        simtest_run_until(&done, 600000000);
+        SIMTEST_CHECK(done && pNext == NULL, "port %u: no exchange", pDn->port);
+        SIMTEST_CHECK(LMIC.dataLen == pDn->len, "port %u: %u bytes received", pDn->port, LMIC.dataLen);
+        pDn->rssiBiased = rssiInEvent;
+        return countInEvent;
+}
+
+static void checkEntry(const dn_t *pDn, u1_t lost) {
+        lmic_rxqueue_entry_t const * const e = LMIC_rxQueuePeek();
+
+        SIMTEST_CHECK(e != NULL, "port %u: queue empty", pDn->port);
+        if (e == NULL)
+                return;
+        unsigned nBad = 0;
+        for (unsigned i = 0; i < e->len; ++i)
+                nBad += e->data[i] != (u1_t) (pDn->port + i);
+        SIMTEST_CHECK(e->port == pDn->port && e->len == pDn->len && nBad == 0,
+                "port %u: entry port %u, %u bytes, %u wrong", pDn->port, e->port, e->len, nBad);
+        SIMTEST_CHECK(e->seqnoDn == pDn->fcnt, "port %u: seqnoDn %u, sent as %u",
+                pDn->port, (unsigned) e->seqnoDn, pDn->fcnt);
+        u1_t const want = pDn->window == 1 ? TXRX_DNW1 : TXRX_DNW2;
+        SIMTEST_CHECK((e->txrxFlags & (TXRX_DNW1 | TXRX_DNW2)) == want && (e->txrxFlags & TXRX_PORT) != 0,
+                "port %u: flags %02x", pDn->port, e->txrxFlags);
+        // the driver corrects the register reading for SNR and
+        // nonlinearity; the queue only removes the bias.
+        SIMTEST_CHECK(e->rssi == pDn->rssiBiased - RSSI_OFF, "port %u: RSSI %d dBm, LMIC.rssi %d",
+                pDn->port, e->rssi, pDn->rssiBiased);
+        SIMTEST_CHECK(e->rssi >= pDn->rssi - 6 && e->rssi <= pDn->rssi + 6,
+                "port %u: RSSI %d dBm, sent at %d", pDn->port, e->rssi, pDn->rssi);
+        SIMTEST_CHECK(e->snr == pDn->snr * SNR_SCALEUP, "port %u: SNR %d/4 dB, sent at %d",
+                pDn->port, e->snr, pDn->snr);
+        SIMTEST_CHECK(e->lost == lost, "port %u: lost %u, want %u", pDn->port, e->lost, lost);
+        printf("  port %u: FCnt %u, window %u, RSSI %d dBm (sent %d), SNR %d/4 dB, lost %u\n",
+                e->port, (unsigned) e->seqnoDn, pDn->window, e->rssi, pDn->rssi, e->snr, e->lost);
+        LMIC_rxQueuePop();
+}
+
+int main(void) {
+        static dn_t dn[] = {
+                { 1, 10, 1,  -50,  8, 0, 0 },
+                { 2, 11, 2,  -90, -5, 0, 0 },
+                { 1, 12, 3, -110,  3, 0, 0 },
+                { 1, 13, 1,  -70,  6, 0, 0 },      // queue full
+                { 1, 14, 20, -70,  6, 0, 0 },      // too long
+                { 2, 15, 8,  -80,  2, 0, 0 },      // wraps to slot 0
+        };
+
+        simtest_init();
+        simnet_session();
+        simnet.reply = reply;
+
+        printf("fill\n");
+        for (unsigned i = 0; i < 3; ++i) {
+                int const n = exchange(&dn[i]);
+                SIMTEST_CHECK(n == (int) i + 1, "port %u: onEvent saw %d queued", dn[i].port, n);
+        }
+        printf("drops\n");
+        exchange(&dn[3]);
+        SIMTEST_CHECK(LMIC.rxqCount == 3 && LMIC.rxqLost == 1, "full: %u queued, %u lost",
+                LMIC.rxqCount, LMIC.rxqLost);
+        checkEntry(&dn[0], 0);
+        exchange(&dn[4]);
+        SIMTEST_CHECK(LMIC.rxqCount == 2 && LMIC.rxqLost == 2, "too long: %u queued, %u lost",
+                LMIC.rxqCount, LMIC.rxqLost);
+        int const n = exchange(&dn[5]);
+        SIMTEST_CHECK(n == 3 && LMIC.rxqHead == 1, "wrap: onEvent saw %d queued, head %u", n, LMIC.rxqHead);
+
+        printf("drain\n");
+        checkEntry(&dn[1], 0);
+        checkEntry(&dn[2], 0);
+        checkEntry(&dn[5], 2);
+        SIMTEST_CHECK(LMIC_rxQueuePeek() == NULL, "queue not empty");
+        return simtest_exit();
+}
@@ -0,0 +1,235 @@
+/*
+
+Module:  simnet.h
+
+Function:
+        A minimal network server for the host tests in test/sim: an ABP
+        session with known keys, uplinks decoded from the model's TX hook,
+        and downlinks built and injected into the receive windows.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+*/
+
+#ifndef _simnet_h_
+# define _simnet_h_
+
+#include "simtest.h"
+
+#if ! defined(CFG_eu868)
+# error "simnet.h places downlinks by the EU868 rules; build with CFG_eu868"
+#endif
+
+/*
+
+Overview:
+        simnet_session() resets the LMIC into an ABP session and installs
+        a TX hook. Every uplink the model sends is then checked, decrypted
+        and kept in simnet.up[], oldest first. If the test has set
+        simnet.reply, it is called with each uplink and may fill in a
+        downlink; simnet_downlink() sends it in RX1 or RX2, optionally
+        off the nominal window time.
+
+        RX1 is the uplink's channel and data rate (RX1DROffset 0), RX2 is
+        LMIC.dn2Freq at SF12, both LMIC.rxDelay seconds (plus one for RX2)
+        after the end of the uplink.
+
+*/
+
+enum { SIMNET_DEVADDR = 0x26011234 };
+enum { SIMNET_MAX_UPLINKS = 64 };
+enum { SIMNET_MIC_LEN = 4 };
+
+static const u1_t simnet_nwkSKey[16] = {
+        0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+        0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C,
+};
+static const u1_t simnet_appSKey[16] = {
+        0x3C, 0x4F, 0xCF, 0x09, 0x88, 0x15, 0xF7, 0xAB,
+        0xA6, 0xD2, 0xAE, 0x28, 0x16, 0x15, 0x7E, 0x2B,
+};
+
+typedef struct simnet_uplink_s simnet_uplink_t;
+
+struct simnet_uplink_s {
+        sx127x_sim_frame_t frame;       // as it went on the air
+        uint64_t        end_us;         // end of the frame, sim time
+        s1_t            txpow;          // LMIC.radio_txpow when it was sent
+        bit_t           micOk;
+        u1_t            mhdr;
+        u1_t            fctrl;
+        u2_t            fcnt;
+        u1_t            foptsLen;
+        u1_t            fopts[LWAN_FCtrl_FOptsLen_MAX];
+        int             port;           // -1 if the frame has none
+        u1_t            len;            // FRMPayload bytes
+        u1_t            data[MAX_LEN_PAYLOAD];  // decrypted
+};
+
+typedef struct simnet_downlink_s simnet_downlink_t;
+
+struct simnet_downlink_s {
+        u1_t            window;         // 1 or 2; 0 == don't send
+        s4_t            offset_us;      // from the nominal window time
+        u1_t            fctrl;          // e.g. FCT_ACK; FOptsLen is added
+        u1_t            foptsLen;
+        u1_t            fopts[LWAN_FCtrl_FOptsLen_MAX];
+        int             port;           // -1 for none
+        u1_t            len;
+        u1_t            data[MAX_LEN_PAYLOAD];
+        s2_t            rssi;           // dBm at the device
+        s1_t            snr;            // dB
+};
+
+typedef void simnet_reply_fn_t(const simnet_uplink_t *pUp, simnet_downlink_t *pDown);
+
+static struct {
+        simnet_reply_fn_t *reply;
+        u2_t            fcntDown;
+        unsigned        nUp;
+        simnet_uplink_t up[SIMNET_MAX_UPLINKS];
+} simnet;
+
+static u4_t simnet_mic(const u1_t *key, u4_t fcnt, int dndir, u1_t *pdu, int len) {
+        os_clearMem(AESaux, 16);
+        AESaux[0] = 0x49;
+        AESaux[5] = dndir ? 1 : 0;
+        AESaux[15] = (u1_t) len;
+        os_wlsbf4(AESaux + 6, SIMNET_DEVADDR);
+        os_wlsbf4(AESaux + 10, fcnt);
+        os_copyMem(AESkey, key, 16);
+        return os_aes(AES_MIC, pdu, (u2_t) len);
+}
+
+static void simnet_cipher(const u1_t *key, u4_t fcnt, int dndir, u1_t *buf, int len) {
+        if (len <= 0)
+                return;
+        os_clearMem(AESaux, 16);
+        AESaux[0] = AESaux[15] = 1;
+        AESaux[5] = dndir ? 1 : 0;
+        os_wlsbf4(AESaux + 6, SIMNET_DEVADDR);
+        os_wlsbf4(AESaux + 10, fcnt);
+        os_copyMem(AESkey, key, 16);
+        os_aes(AES_CTR, buf, (u2_t) len);
+}
+
+//! \brief check and decrypt a data uplink; returns 0 if it isn't one of ours.
+static int simnet_parse(const sx127x_sim_frame_t *pFrame, simnet_uplink_t *pUp) {
+        u1_t pdu[MAX_LEN_FRAME];
+        int const len = pFrame->len;
+
+        memset(pUp, 0, sizeof(*pUp));
+        pUp->frame = *pFrame;
+        pUp->port = -1;
+        if (len < OFF_DAT_OPTS + SIMNET_MIC_LEN)
+                return 0;
+        memcpy(pdu, pFrame->data, len);
+        pUp->mhdr = pdu[OFF_DAT_HDR];
+        if ((u4_t) os_rlsbf4(pdu + OFF_DAT_ADDR) != SIMNET_DEVADDR)
+                return 0;
+        pUp->fctrl = pdu[OFF_DAT_FCT];
+        pUp->fcnt = os_rlsbf2(pdu + OFF_DAT_SEQNO);
+        pUp->foptsLen = pUp->fctrl & FCT_OPTLEN;
+        memcpy(pUp->fopts, pdu + OFF_DAT_OPTS, pUp->foptsLen);
+
+        int const body = len - SIMNET_MIC_LEN;
+        pUp->micOk = simnet_mic(simnet_nwkSKey, pUp->fcnt, 0, pdu, body) == os_rmsbf4(pdu + body);
+
+        int const portOff = OFF_DAT_OPTS + pUp->foptsLen;
+        if (portOff < body) {
+                pUp->port = pdu[portOff];
+                pUp->len = (u1_t) (body - portOff - 1);
+                memcpy(pUp->data, pdu + portOff + 1, pUp->len);
+                simnet_cipher(pUp->port == 0 ? simnet_nwkSKey : simnet_appSKey,
+                              pUp->fcnt, 0, pUp->data, pUp->len);
+        }
+        return 1;
+}
+
+//! \brief put a downlink for `pUp` on the air.
+static void simnet_downlink(const simnet_uplink_t *pUp, const simnet_downlink_t *pDown) {
+        sx127x_sim_frame_t f;
+        u1_t *p = f.data;
+
+        memset(&f, 0, sizeof(f));
+        *p++ = HDR_FTYPE_DADN | HDR_MAJOR_V1;
+        os_wlsbf4(p, SIMNET_DEVADDR);
+        p += 4;
+        *p++ = (u1_t) (pDown->fctrl | pDown->foptsLen);
+        os_wlsbf2(p, simnet.fcntDown);
+        p += 2;
+        memcpy(p, pDown->fopts, pDown->foptsLen);
+        p += pDown->foptsLen;
+        if (pDown->port >= 0) {
+                *p++ = (u1_t) pDown->port;
+                memcpy(p, pDown->data, pDown->len);
+                simnet_cipher(pDown->port == 0 ? simnet_nwkSKey : simnet_appSKey,
+                              simnet.fcntDown, 1, p, pDown->len);
+                p += pDown->len;
+        }
+        int const body = (int) (p - f.data);
+        os_wmsbf4(p, simnet_mic(simnet_nwkSKey, simnet.fcntDown, 1, f.data, body));
+        f.len = (u1_t) (body + SIMNET_MIC_LEN);
+        ++simnet.fcntDown;
+
+        uint64_t const rx1 = pUp->end_us + (uint64_t) LMIC.rxDelay * 1000000;
+        if (pDown->window == 1) {
+                f.freq = pUp->frame.freq;
+                f.rps = makeRps(getSf(pUp->frame.rps), getBw(pUp->frame.rps), CR_4_5, 0, 1);
+                f.start_us = rx1 + pDown->offset_us;
+        } else {
+                f.freq = LMIC.dn2Freq;
+                f.rps = makeRps(SF12, BW125, CR_4_5, 0, 1);
+                f.start_us = rx1 + 1000000 + pDown->offset_us;
+        }
+        f.rssi = pDown->rssi;
+        f.snr = pDown->snr;
+        SIMTEST_CHECK(sx127x_sim_inject(&f) == 0, "no room to inject a downlink");
+}
+
+static void simnet_onTx(const sx127x_sim_frame_t *pFrame) {
+        simnet_uplink_t up;
+        simnet_downlink_t down;
+
+        if (! simnet_parse(pFrame, &up))
+                return;
+        up.end_us = sx127x_sim_now_us();
+        up.txpow = LMIC.radio_txpow;
+        SIMTEST_CHECK(up.micOk, "uplink %u has a bad MIC", up.fcnt);
+        if (simnet.nUp < SIMNET_MAX_UPLINKS)
+                simnet.up[simnet.nUp] = up;
+        ++simnet.nUp;
+
+        if (simnet.reply == NULL)
+                return;
+        memset(&down, 0, sizeof(down));
+        down.port = -1;
+        down.rssi = -80;
+        down.snr = 8;
+        simnet.reply(&up, &down);
+        if (down.window != 0)
+                simnet_downlink(&up, &down);
+}
+
+//! \brief the latest uplink, or NULL before the first.
+static const simnet_uplink_t *simnet_last(void) {
+        if (simnet.nUp == 0 || simnet.nUp > SIMNET_MAX_UPLINKS)
+                return NULL;
+        return &simnet.up[simnet.nUp - 1];
+}
+
+//! \brief reset the LMIC into an ABP session at SF7 with ADR off.
+static void simnet_session(void) {
+        LMIC_reset();
+        LMIC_setSession(0x13, SIMNET_DEVADDR, (xref2u1_t) simnet_nwkSKey, (xref2u1_t) simnet_appSKey);
+        LMIC_setAdrMode(0);
+        LMIC_setLinkCheckMode(0);
+        LMIC_setDrTxpow(EU868_DR_SF7, 14);
+        // txlora() sends with sysname_tx_rps rather than the MAC's rps.
+        LMIC.sysname_tx_rps = makeRps(SF7, BW125, CR_4_5, 0, 0);
+        memset(&simnet, 0, sizeof(simnet));
+        sx127x_sim_set_tx_hook(simnet_onTx);
+}
+
+#endif /* _simnet_h_ */
@@ -0,0 +1,98 @@
+/*
+
+Module:  simtest.h
+
+Function:
+        Scaffolding shared by the host tests in test/sim, which run the
+        LMIC against the sx127x_sim radio model.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+*/
+
+#ifndef _simtest_h_
+# define _simtest_h_
+
+#include "lmic/lmic.h"
+#include "hal/sx127x_sim.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+
+Overview:
+        Each test is one C file with a main(). ci/simtest.sh builds it
+        with the LMIC sources and src/hal/sx127x_sim.c, adding the flags
+        from a "SIMTEST_CFLAGS:" comment in the file, and runs it. A test
+        passes if it exits with status 0.
+
+        This header supplies what a sketch would: the pin map the
+        deprecated os_init() refers to, and the EUI/key callbacks. It
+        can only be included by one source file per program.
+
+*/
+
+// the real lmic_pinmap is C++; os_init_ex(NULL) never looks at it.
+struct lmic_pinmap { u1_t unused; };
+const struct lmic_pinmap lmic_pins;
+
+void os_getArtEui (u1_t *buf) { memset(buf, 0x00, 8); }
+void os_getDevEui (u1_t *buf) { memset(buf, 0x01, 8); }
+void os_getDevKey (u1_t *buf) { memset(buf, 0x02, 16); }
+
+static unsigned simtest_failures;
+
+#define SIMTEST_CHECK(cond, ...)                                        \
+        do {                                                            \
+                if (! (cond)) {                                         \
+                        ++simtest_failures;                             \
+                        printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+                        printf(__VA_ARGS__);                            \
+                        printf("\n");                                   \
+                }                                                       \
+        } while (0)
+
+//! \brief power up the model and the LMIC; the radio stays asleep.
+static void simtest_init(void) {
+        setvbuf(stdout, NULL, _IONBF, 0);
+        sx127x_sim_reset();
+        os_init_ex(NULL);
+        LMIC_reset();
+}
+
+//! \brief run the os loop until `*pDone` is set or `us` of sim time pass;
+//! returns the final value of `*pDone`.
+static int simtest_run_until(volatile int *pDone, uint64_t us) {
+        uint64_t const tEnd = sx127x_sim_now_us() + us;
+
+        while (! *pDone && sx127x_sim_now_us() < tEnd)
+                os_runloop_once();
+        return *pDone;
+}
+
+//! \brief run the os loop for `us` of sim time.
+static void simtest_run_for(uint64_t us) {
+        static volatile int never;
+
+        simtest_run_until(&never, us);
+}
+
+//! \brief host CPU time in seconds, for benchmarks.
+static double simtest_cpu_seconds(void) {
+        return (double) clock() / CLOCKS_PER_SEC;
+}
+
+static int simtest_exit(void) {
+        if (simtest_failures != 0) {
+                printf("%u check(s) failed\n", simtest_failures);
+                return 1;
+        }
+        printf("ok\n");
+        return 0;
+}
+
+#endif /* _simtest_h_ */
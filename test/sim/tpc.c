@@ -0,0 +1,156 @@
+/*
+
+Module:  tpc.c
+
+Function:
+        Closed-loop TX power control (LMIC_ENABLE_tx_power_control) against
+        steady downlink margins, a missed confirmed uplink and LinkCheckAns
+        margins near the top of their range.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_ENABLE_tx_power_control=1
+
+*/
+
+#include "simnet.h"
+
+enum { N_SETTLE = 12 };
+enum { ADR_TXPOW = 14 };
+
+static volatile int done;
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE)
+                done = 1;
+}
+
+static struct {
+        s1_t snr;               // of every downlink
+        u1_t linkCheckMargin;   // 0: no LinkCheckAns
+        u1_t nToMiss;           // confirmed attempts to leave unanswered
+        u1_t nMissed;
+} net;
+
+static struct {
+        bit_t seen;
+        s1_t offset;
+        u1_t samples;
+        s1_t txpow;
+} retry;
+
+static void reply(const simnet_uplink_t *pUp, simnet_downlink_t *pDown) {
+        bit_t const confirmed = (pUp->mhdr & HDR_FTYPE) == HDR_FTYPE_DCUP;
+
+        if (confirmed && net.nMissed < net.nToMiss) {
+                ++net.nMissed;
+                return;
+        }
+        if (confirmed && net.nMissed != 0 && ! retry.seen) {
+                retry.seen = 1;
+                retry.offset = LMIC.tpcOffset;
+                retry.samples = LMIC.tpcSamples;
+                retry.txpow = pUp->txpow;
+        }
+        pDown->window = 1;
+        pDown->fctrl = confirmed ? FCT_ACK : 0;
+        pDown->rssi = -80;
+        pDown->snr = net.snr;
+        if (net.linkCheckMargin != 0) {
+                pDown->fopts[0] = MCMD_LinkCheckAns;
+                pDown->fopts[1] = net.linkCheckMargin;
+                pDown->fopts[2] = 1;
+                pDown->foptsLen = 3;
+        }
+}
+
+// one uplink and its downlink; checks the bounds on the way.
+static void exchange(u1_t confirmed) {
+        u1_t payload[2] = { 0x10, 0x20 };
+
+        done = 0;
+        LMIC_setTxData2(1, payload, sizeof(payload), confirmed);
+        simtest_run_until(&done, 600000000);
+        SIMTEST_CHECK(done, "the uplink didn't complete");
+        SIMTEST_CHECK(LMIC.tpcOffset <= 0 && LMIC.tpcOffset >= -LMIC_TPC_MAX_BACKOFF_DB,
+                "offset %d dB", LMIC.tpcOffset);
+        SIMTEST_CHECK(LMIC.tpcHeadroom >= 0, "headroom estimate %d dB", LMIC.tpcHeadroom);
+
+        simnet_uplink_t const * const pUp = simnet_last();
+        SIMTEST_CHECK(pUp != NULL && pUp->txpow <= ADR_TXPOW, "sent above the ADR power");
+}
+
+// the margin the uplinks would now have: at the target, to within a step,
+// unless the back-off limit got in the way.
+static void checkSettled(const char *what) {
+        int const margin = LMIC.tpcHeadroom + LMIC.tpcOffset;
+
+        printf("  %s: headroom %d dB, offset %d dB, uplink margin %d dB\n",
+                what, LMIC.tpcHeadroom, LMIC.tpcOffset, margin);
+        if (LMIC.tpcOffset == -LMIC_TPC_MAX_BACKOFF_DB)
+                SIMTEST_CHECK(margin >= LMIC_TPC_TARGET_MARGIN_DB, "%s: margin %d dB", what, margin);
+        else
+                SIMTEST_CHECK(margin >= LMIC_TPC_TARGET_MARGIN_DB &&
+                              margin < LMIC_TPC_TARGET_MARGIN_DB + LMIC_TPC_STEP_DB,
+                              "%s: margin %d dB", what, margin);
+}
+
+static void settle(const char *what) {
+        s1_t last = 1;
+        unsigned nSame = 0;
+
+        for (unsigned i = 0; i < N_SETTLE; ++i) {
+                exchange(0);
+                nSame = (LMIC.tpcOffset == last) ? nSame + 1 : 0;
+                last = LMIC.tpcOffset;
+        }
+        SIMTEST_CHECK(nSame >= 3, "%s: offset still moving", what);
+        checkSettled(what);
+
+        simnet_uplink_t const * const pUp = simnet_last();
+        SIMTEST_CHECK(pUp != NULL && pUp->txpow == ADR_TXPOW + LMIC.tpcOffset,
+                "%s: sent at %d dBm", what, pUp ? pUp->txpow : 0);
+}
+
+static void testMiss(void) {
+        s1_t const before = LMIC.tpcOffset;
+
+        net.nToMiss = 1;
+        exchange(1);
+        net.nToMiss = 0;
+
+        s1_t want = before + 2 * LMIC_TPC_STEP_DB;
+        if (want > 0)
+                want = 0;
+        printf("  miss: offset %d -> %d dB, retry sent at %d dBm\n", before, retry.offset, retry.txpow);
+        SIMTEST_CHECK(net.nMissed == 1 && retry.seen, "no unanswered attempt and retry");
+        SIMTEST_CHECK(retry.offset == want, "offset %d after the miss, want %d", retry.offset, want);
+        SIMTEST_CHECK(retry.samples == 0, "estimate kept %u samples", retry.samples);
+        SIMTEST_CHECK(retry.txpow == ADR_TXPOW + want, "retry sent at %d dBm", retry.txpow);
+        SIMTEST_CHECK((LMIC.txrxFlags & TXRX_ACK) != 0, "the retry wasn't acknowledged");
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+        simnet.reply = reply;
+
+        printf("steady downlinks\n");
+        net.snr = 20;
+        settle("settled");
+
+        printf("missed confirmation\n");
+        testMiss();
+        settle("settled again");
+
+        // LinkCheckAns margins this high, referred back through the
+        // offset, used to wrap the estimate negative.
+        printf("LinkCheckAns\n");
+        net.snr = 30;
+        net.linkCheckMargin = 254;
+        settle("high LinkCheckAns margin");
+        SIMTEST_CHECK(LMIC.tpcOffset == -LMIC_TPC_MAX_BACKOFF_DB,
+                "offset %d, want the full back-off", LMIC.tpcOffset);
+        return simtest_exit();
+}
@@ -0,0 +1,143 @@
+/*
+
+Module:  txqueue.c
+
+Function:
+        The prioritized uplink queue (LMIC_TXQUEUE_DEPTH): order on the
+        air by priority and, within a priority, by submission; failure
+        callbacks for entries that expire and for LMIC_clearTxQueue();
+        and draining back to back without the application's help.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_TXQUEUE_DEPTH=8
+
+*/
+
+#include "simnet.h"
+
+// the id of each message is its port and its one payload byte.
+typedef struct {
+        u1_t id;
+        int fSuccess;
+} result_t;
+
+static result_t results[32];
+static volatile int nResults;
+
+static void LMIC_ABI_STD onTxMessage(void *pUserData, int fSuccess) {
+        if (nResults < (int) (sizeof(results) / sizeof(results[0]))) {
+                results[nResults].id = (u1_t) (uintptr_t) pUserData;
+                results[nResults].fSuccess = fSuccess;
+        }
+        ++nResults;
+}
+
+static lmic_tx_error_t queue(u1_t id, u1_t priority, ostime_t deadline) {
+        return LMIC_queueTxWithCallback(id, &id, 1, 0, priority, deadline,
+                                        onTxMessage, (void *) (uintptr_t) id);
+}
+
+// run the os loop until `n` callbacks are in.
+static void runUntilResults(int n, const char *what) {
+        uint64_t const tEnd = sx127x_sim_now_us() + 600000000;
+
+        while (nResults < n && sx127x_sim_now_us() < tEnd)
+                os_runloop_once();
+        SIMTEST_CHECK(nResults >= n, "%s: %d of %d callbacks", what, nResults, n);
+}
+
+static int resultOf(u1_t id) {
+        for (int i = 0; i < nResults; ++i)
+                if (results[i].id == id)
+                        return results[i].fSuccess;
+        return -1;
+}
+
+static void checkAir(const u1_t *pWant, unsigned nWant, unsigned first, const char *what) {
+        SIMTEST_CHECK(simnet.nUp == first + nWant, "%s: %u uplinks, want %u",
+                what, simnet.nUp - first, nWant);
+        for (unsigned i = 0; i < nWant && first + i < simnet.nUp; ++i) {
+                simnet_uplink_t const * const pUp = &simnet.up[first + i];
+                SIMTEST_CHECK(pUp->port == pWant[i] && pUp->len == 1 && pUp->data[0] == pWant[i],
+                        "%s: uplink %u is port %d, want %u", what, i, pUp->port, pWant[i]);
+        }
+}
+
+// A goes straight to the MAC; the rest queue behind it. 9 would be next,
+// but expires while A is still in its receive windows.
+static void testOrder(void) {
+        static const u1_t want[] = { 0xA, 0xC, 0xE, 0xF, 0xB, 0xD };
+        ostime_t const now = os_getTime();
+
+        SIMTEST_CHECK(queue(0xA, 1, 0) == 0, "A refused");
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 0, "A still queued");
+        queue(0xB, 1, 0);
+        queue(0xC, 3, 0);
+        queue(0xD, 1, 0);
+        queue(0xE, 3, 0);
+        queue(0xF, 2, 0);
+        queue(0x9, 5, now + sec2osticks(1));
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 6, "%u queued", LMIC_getTxQueueCount());
+
+        // back to back: nothing more from us until every callback is in.
+        runUntilResults(7, "order");
+        checkAir(want, sizeof(want), 0, "order");
+
+        SIMTEST_CHECK(resultOf(0x9) == 0, "expired entry reported %d", resultOf(0x9));
+        SIMTEST_CHECK(results[0].id == 0xA, "first callback for %x", results[0].id);
+        unsigned nOk = 0;
+        for (unsigned i = 0; i < sizeof(want); ++i)
+                nOk += resultOf(want[i]) == 1;
+        SIMTEST_CHECK(nOk == sizeof(want), "%u of %u sent entries reported success",
+                nOk, (unsigned) sizeof(want));
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 0, "%u left in the queue", LMIC_getTxQueueCount());
+        printf("  on air: A C E F B D; expired entry failed; %u s of sim time\n",
+                (unsigned) (sx127x_sim_now_us() / 1000000));
+}
+
+// everything still queued fails; the uplink already in the MAC goes out.
+static void testClear(void) {
+        static const u1_t want[] = { 0x1 };
+        unsigned const first = simnet.nUp;
+
+        nResults = 0;
+        queue(0x1, 0, 0);
+        queue(0x2, 0, 0);
+        queue(0x3, 7, 0);
+        queue(0x4, 0, 0);
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 3, "%u queued", LMIC_getTxQueueCount());
+        LMIC_clearTxQueue();
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 0, "%u left after clearing", LMIC_getTxQueueCount());
+        SIMTEST_CHECK(nResults == 3, "%d callbacks from clearing", nResults);
+        SIMTEST_CHECK(resultOf(0x2) == 0 && resultOf(0x3) == 0 && resultOf(0x4) == 0,
+                "cleared entries reported %d %d %d", resultOf(0x2), resultOf(0x3), resultOf(0x4));
+
+        runUntilResults(4, "clear");
+        simtest_run_for(10000000);
+        checkAir(want, sizeof(want), first, "clear");
+        SIMTEST_CHECK(resultOf(0x1) == 1, "the uplink in the MAC reported %d", resultOf(0x1));
+}
+
+static void testFull(void) {
+        nResults = 0;
+        // one to the MAC, then the queue's depth
+        for (unsigned i = 0; i <= LMIC_TXQUEUE_DEPTH; ++i)
+                SIMTEST_CHECK(queue((u1_t) (0x20 + i), 0, 0) == 0, "entry %u refused", i);
+        SIMTEST_CHECK(queue(0x30, 9, 0) == LMIC_ERROR_TX_BUSY, "a full queue took another entry");
+        runUntilResults(LMIC_TXQUEUE_DEPTH + 1, "full");
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+
+        printf("order\n");
+        testOrder();
+        printf("clear\n");
+        testClear();
+        printf("full\n");
+        testFull();
+        return simtest_exit();
+}
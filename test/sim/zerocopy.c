@@ -0,0 +1,123 @@
+/*
+
+Module:  zerocopy.c
+
+Function:
+        Zero-copy uplinks (LMIC_ENABLE_tx_zerocopy) with a small
+        pendTxData: a payload longer than pendTxData goes out from the
+        frame, a pendTxLen set past pendTxData is refused with a length
+        error, and the frame isn't lent while a record waits in the
+        transmit queue.
+
+Copyright & License:
+        See accompanying LICENSE file.
+
+SIMTEST_CFLAGS: -DCFG_eu868=1 -DLMIC_ENABLE_tx_zerocopy=1 -DLMIC_PENDTXDATA_SIZE=16 -DLMIC_TXQUEUE_DEPTH=4 -DLMIC_ENABLE_tx_aggregation=1
+
+*/
+
+#include "simnet.h"
+
+static volatile int done;
+static int nComplete;
+
+void onEvent(ev_t ev) {
+        if (ev == EV_TXCOMPLETE) {
+                ++nComplete;
+                done = 1;
+        }
+}
+
+static void LMIC_ABI_STD onTxMessage(void *pUserData, int fSuccess) {
+        *(int *) pUserData = fSuccess;
+}
+
+// longer than pendTxData, so it can only come from the frame.
+static void testCommit(void) {
+        u1_t maxLen = 0;
+        int fSuccess = -1;
+        u1_t * const p = LMIC_getTxBuffer(&maxLen);
+
+        SIMTEST_CHECK(p != NULL && maxLen >= 40, "no buffer, or only %u bytes", maxLen);
+        if (p == NULL)
+                return;
+        for (unsigned i = 0; i < 40; ++i)
+                p[i] = (u1_t) (0x40 + i);
+
+        done = 0;
+        SIMTEST_CHECK(LMIC_commitTxBuffer(2, 40, onTxMessage, &fSuccess) == 0, "commit refused");
+        simtest_run_until(&done, 10000000);
+
+        simnet_uplink_t const * const pUp = simnet_last();
+        SIMTEST_CHECK(done && fSuccess == 1 && pUp != NULL, "uplink not sent: callback %d", fSuccess);
+        if (pUp == NULL)
+                return;
+        unsigned nBad = 0;
+        for (unsigned i = 0; i < pUp->len; ++i)
+                nBad += pUp->data[i] != 0x40 + i;
+        SIMTEST_CHECK(pUp->port == 2 && pUp->len == 40 && nBad == 0,
+                "port %d, %u bytes, %u wrong", pUp->port, pUp->len, nBad);
+}
+
+// the old way of sending: the caller fills pendTxData and sets pendTxLen.
+static void testOverflow(void) {
+        unsigned const nUp = simnet.nUp;
+        int const nBefore = nComplete;
+
+        simtest_run_for(30000000);
+        LMIC.pendTxPort = 3;
+        LMIC.pendTxConf = 0;
+        LMIC.pendTxLen = sizeof(LMIC.pendTxData) + 1;
+        LMIC_setTxData();
+
+        SIMTEST_CHECK(nComplete == nBefore + 1, "%d completions", nComplete - nBefore);
+        SIMTEST_CHECK((LMIC.txrxFlags & TXRX_LENERR) != 0, "no length error: flags %02x", LMIC.txrxFlags);
+        SIMTEST_CHECK((LMIC.opmode & OP_TXDATA) == 0, "still pending");
+        simtest_run_for(10000000);
+        SIMTEST_CHECK(simnet.nUp == nUp, "%u uplinks sent", simnet.nUp - nUp);
+
+        // at the limit it goes.
+        u1_t data[sizeof(LMIC.pendTxData)];
+        memset(data, 0x33, sizeof(data));
+        done = 0;
+        SIMTEST_CHECK(LMIC_setTxData2(3, data, sizeof(data), 0) == 0, "full pendTxData refused");
+        simtest_run_until(&done, 10000000);
+        SIMTEST_CHECK(simnet.nUp == nUp + 1 && simnet_last()->len == sizeof(data),
+                "full pendTxData not sent");
+        printf("  pendTxLen %u refused, %u sent\n",
+                (unsigned) sizeof(LMIC.pendTxData) + 1, (unsigned) sizeof(LMIC.pendTxData));
+}
+
+// a record waiting for company or its deadline: nothing is in the MAC,
+// but the queue owns the next frame.
+static void testQueue(void) {
+        u1_t r[1] = { 0xA };
+        unsigned const nUp = simnet.nUp;
+
+        simtest_run_for(30000000);
+        SIMTEST_CHECK(LMIC_getTxBuffer(NULL) != NULL, "no buffer with the MAC idle");
+        LMIC_queueRecord(4, r, 1, 0, os_getTime() + sec2osticks(60));
+        SIMTEST_CHECK(LMIC_getTxQueueCount() == 1 && (LMIC.opmode & OP_TXDATA) == 0,
+                "record not waiting");
+        SIMTEST_CHECK(LMIC_getTxBuffer(NULL) == NULL, "frame lent with a record queued");
+        SIMTEST_CHECK(LMIC_commitTxBuffer(4, 1, NULL, NULL) == LMIC_ERROR_TX_BUSY,
+                "commit taken with a record queued");
+
+        LMIC_clearTxQueue();
+        SIMTEST_CHECK(LMIC_getTxBuffer(NULL) != NULL, "no buffer with the queue empty");
+        simtest_run_for(90000000);
+        SIMTEST_CHECK(simnet.nUp == nUp, "cleared record sent");
+}
+
+int main(void) {
+        simtest_init();
+        simnet_session();
+
+        printf("commit\n");
+        testCommit();
+        printf("pendTxLen too long\n");
+        testOverflow();
+        printf("queue\n");
+        testQueue();
+        return simtest_exit();
+}